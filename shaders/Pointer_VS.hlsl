@@ -17,9 +17,8 @@ cbuffer cbPerObject : register(b0)
 struct VS_INPUT
 {
 	float4 pos : POSITION;
-	float3 normal : NORMAL;	// unused
-	uint colour : COLOR;
-	float2 uv : TEXCOORD;	// unused
+	float2 normal : NORMAL;	// unused
+	uint4 colour : COLOR;	// palette index in x
 };
 
 struct VS_OUTPUT
@@ -32,6 +31,6 @@ VS_OUTPUT main(VS_INPUT input)
 {
 	VS_OUTPUT output;
 	output.pos = mul(float4(input.pos.xyz, 1.0f), WVP);
-	output.colour = Palette[input.colour];
+	output.colour = Palette[input.colour.x];
 	return output;
 }
@@ -8,7 +8,9 @@ struct VS_OUTPUT
 {
 	float4 pos : SV_POSITION;	// unused
 	float4 colour : COLOR0;
-	float2 uv : TEXCOORD;
+	float4 alt_colour : COLOR1;
+	float2 uv : TEXCOORD0;
+	nointerpolation uint checker : TEXCOORD1;
 };
 
 float rnd(float2 uv)
@@ -19,11 +21,16 @@ float rnd(float2 uv)
 
 float4 main(VS_OUTPUT input) : SV_TARGET
 {
+	// Odd map tiles use the alternate colour, with map coordinates in uv.
+	float4 colour = input.colour;
+	if (input.checker && ((uint(floor(input.uv.x)) ^ uint(floor(input.uv.y))) & 1))
+		colour = input.alt_colour;
+
 	if (dissolved == 0.0f)
-		return input.colour;
+		return colour;
 
 	float2 uv = frac(input.uv + float2(noise, noise));
 	clip(rnd(uv) - dissolved);
 
-	return input.colour;
+	return colour;
 }
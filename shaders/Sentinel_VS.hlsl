@@ -28,30 +28,39 @@ cbuffer cbPerObject : register(b0)
 struct VS_INPUT
 {
 	float4 pos : POSITION;
-	float3 normal : NORMAL;
-	uint colour : COLOR;
-	float2 uv : TEXCOORD;
+	float2 normal : NORMAL;		// octahedral
+	uint4 colour : COLOR;		// palette index, alternate palette index, u, v
 };
 
 struct VS_OUTPUT
 {
 	float4 pos : SV_POSITION;
-	float4 colour : COLOR;
-	float2 uv : TEXCOORD;
+	float4 colour : COLOR0;
+	float4 alt_colour : COLOR1;
+	float2 uv : TEXCOORD0;
+	nointerpolation uint checker : TEXCOORD1;
 };
 
+float3 OctahedralDecode(float2 e)
+{
+	float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+		n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+	return normalize(n);
+}
+
 VS_OUTPUT main(VS_INPUT input)
 {
 	VS_OUTPUT output;
 	output.pos = mul(float4(input.pos.xyz, 1.0f), WVP);
-	output.uv = input.uv;
+	output.uv = input.colour.zw / PACKED_TEXCOORD_SCALE;
 
 	float lightLevel = 1.0f;
 
 	if (lighting)
 	{
 		// Transform the model normal into a world direction.
-		float3 transformedNormal = mul(input.normal, (float3x3)W);
+		float3 transformedNormal = mul(OctahedralDecode(input.normal), (float3x3)W);
 
 		// Determine of the vertex from the eye position.
 		float3 vertexDir = mul(float4(input.pos.xyz, 1.0f), W).xyz - EyePos;
@@ -79,9 +88,16 @@ VS_OUTPUT main(VS_INPUT input)
 		}
 	}
 
-	float4 face_colour = saturate(lightLevel) * Palette[input.colour];
+	// Checkered landscape tiles carry both colours, with the pixel shader choosing.
+	uint colour_idx = input.colour.x;
+	uint alt_colour_idx = input.colour.y;
+	output.checker = (alt_colour_idx != colour_idx) ? 1 : 0;
+
+	float4 face_colour = saturate(lightLevel) * Palette[colour_idx];
+	float4 alt_face_colour = saturate(lightLevel) * Palette[alt_colour_idx];
 	float fog_level = 1.0f / exp(length(output.pos.xyz) * fog_density);
 	output.colour = lerp(Palette[fog_colour_idx], face_colour, fog_level);
+	output.alt_colour = lerp(Palette[fog_colour_idx], alt_face_colour, fog_level);
 
 	if (z_fade)
 	{
@@ -90,6 +106,7 @@ VS_OUTPUT main(VS_INPUT input)
 
 		float fade = 1.0f / exp(z * z_fade);
 		output.colour *= fade;
+		output.alt_colour *= fade;
 	}
 
 	return output;
@@ -5,6 +5,12 @@
 #include "FlatView.h"
 #include "VRView.h"
 #include "Settings.h"
+#include "Journal.h"
+#include "ReplayService.h"
+#include "Profiler.h"
+#include "Z80Test.h"
+#include "Mixer.h"
+#include "AssetLoader.h"
 
 // Initial window size, aspect corrected.
 static constexpr auto WINDOW_WIDTH = 1600;
@@ -22,6 +28,18 @@ Application::Application(HINSTANCE hinst)
 {
 }
 
+Application::~Application()
+{
+	// Release any emulation, so its profile is included in the report.
+	m_pGame.reset();
+
+	if (!m_profile_file.empty() && !WriteProfileReport(m_profile_file, m_symbols_file))
+		MessageBoxA(NULL, "Failed to write profile report.", APP_NAME, MB_ICONWARNING);
+
+	// Write any settings changes still waiting.
+	FlushSettings();
+}
+
 bool Application::Init()
 {
 	auto hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
@@ -34,6 +52,85 @@ bool Application::Init()
 	InitSettings(APP_NAME);
 	ProcessCommandLine();
 
+	if (!m_profile_file.empty())
+		EnableProfiling();
+
+	// Headless replay of a recorded session, without creating a window.
+	if (!m_replay_file.empty())
+	{
+		AttachParentConsole();
+		m_exit_code = ReplayJournalFile(m_replay_file);
+		return false;
+	}
+
+	// Headless verification of many recorded sessions.
+	if (!m_verify_source.empty())
+	{
+		AttachParentConsole();
+		m_exit_code = VerifyJournals(m_verify_source);
+		return false;
+	}
+
+	// Check display patches leave the game unchanged, over the first N landscapes.
+	if (m_check_display_landscapes > 0)
+	{
+		AttachParentConsole();
+		m_exit_code = CheckDisplayPatches(m_check_display_landscapes);
+		return false;
+	}
+
+	// Z80 core conformance, using a CP/M instruction exerciser.
+	if (!m_zex_file.empty())
+	{
+		AttachParentConsole();
+		m_exit_code = RunZ80Exerciser(m_zex_file);
+		return false;
+	}
+
+	// Sentinel memory hashes after playing each landscape, against a reference from a known good core.
+	if (m_diff_landscapes > 0)
+	{
+		AttachParentConsole();
+		m_exit_code = RunSentinelDifferential(m_diff_landscapes, m_diff_reference);
+		return false;
+	}
+
+	// Bulk landscape generation, for secret codes.
+	if (m_generate_count > 0)
+	{
+		AttachParentConsole();
+		m_exit_code = GenerateLandscapes(m_generate_first, m_generate_count);
+		return false;
+	}
+
+	// Copy the landscape codes to the settings file, for earlier versions or hand editing.
+	if (m_export_codes)
+	{
+		AttachParentConsole();
+		m_exit_code = ExportLandscapeCodes();
+		return false;
+	}
+
+	// Software mixer throughput with every voice busy, optionally saving the mix.
+	if (m_audio_bench)
+	{
+		AttachParentConsole();
+		m_exit_code = BenchmarkMixer(m_audio_bench_file);
+		return false;
+	}
+
+	// HRTF rendering cost for moving voices, optionally saving the mix.
+	if (m_hrtf_bench)
+	{
+		AttachParentConsole();
+		m_exit_code = BenchmarkHrtf(m_hrtf_bench_file);
+		return false;
+	}
+
+	// Start loading the game data while the window and view are created.
+	AssetLoader::Instance().Load(SPECTRUM_ROM_FILE);
+	AssetLoader::Instance().Load(SENTINEL_SNAPSHOT_FILE);
+
 	if (!InitializeWindow(WINDOW_WIDTH, WINDOW_HEIGHT))
 		throw std::exception("failed to create window");
 
@@ -64,14 +161,8 @@ bool Application::Init()
 	}
 
 	auto hrtf_enabled = GetFlag(HRTF_ENABLED_KEY, DEFAULT_HRTF_ENABLED);
-	if (hrtf_enabled)
-	{
-		// Load the hook DLL that adds HRTF support to X3D applications.
-		LoadLibrary(X3D_HRTF_HOOK_DLL);
-	}
-
-	m_pAudio = std::make_shared<Audio>();
-	m_pGame = std::make_unique<Augmentinel>(m_pView, m_pAudio);
+	m_pAudio = std::make_shared<Audio>(hrtf_enabled);
+	m_pGame = std::make_unique<Augmentinel>(m_pView, m_pAudio, m_record_file);
 
 	ShowWindow(m_hwnd, m_maximised ? SW_SHOWMAXIMIZED : SW_SHOW);
 
@@ -120,7 +211,104 @@ void Application::ProcessCommandLine()
 			m_viewMode = ViewMode::VR;
 		else if (!lstrcmpiA(__argv[arg], "--flat") || !lstrcmpiA(__argv[arg], "--no-vr"))
 			m_viewMode = ViewMode::Flat;
+		else if (!lstrcmpiA(__argv[arg], "--record") && arg + 1 < __argc)
+			m_record_file = to_wstring(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--replay") && arg + 1 < __argc)
+			m_replay_file = to_wstring(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--verify") && arg + 1 < __argc)
+			m_verify_source = to_wstring(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--check-display") && arg + 1 < __argc)
+			m_check_display_landscapes = std::atoi(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--generate") && arg + 2 < __argc)
+		{
+			// The first landscape is given as it's displayed, which may be hex.
+			auto hex_landscapes = GetFlag(HEX_LANDSCAPES_KEY, DEFAULT_HEX_LANDSCAPES);
+			m_generate_first = std::strtol(__argv[++arg], nullptr, hex_landscapes ? 16 : 10);
+			m_generate_count = std::atoi(__argv[++arg]);
+		}
+		else if (!lstrcmpiA(__argv[arg], "--export-codes"))
+			m_export_codes = true;
+		else if (!lstrcmpiA(__argv[arg], "--zex") && arg + 1 < __argc)
+			m_zex_file = to_wstring(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--z80-diff") && arg + 2 < __argc)
+		{
+			m_diff_landscapes = std::atoi(__argv[++arg]);
+			m_diff_reference = to_wstring(__argv[++arg]);
+		}
+		else if (!lstrcmpiA(__argv[arg], "--audio-bench"))
+		{
+			m_audio_bench = true;
+			if (arg + 1 < __argc && __argv[arg + 1][0] != '-')
+				m_audio_bench_file = to_wstring(__argv[++arg]);
+		}
+		else if (!lstrcmpiA(__argv[arg], "--hrtf-bench"))
+		{
+			m_hrtf_bench = true;
+			if (arg + 1 < __argc && __argv[arg + 1][0] != '-')
+				m_hrtf_bench_file = to_wstring(__argv[++arg]);
+		}
+		else if (!lstrcmpiA(__argv[arg], "--profile") && arg + 1 < __argc)
+			m_profile_file = to_wstring(__argv[++arg]);
+		else if (!lstrcmpiA(__argv[arg], "--symbols") && arg + 1 < __argc)
+			m_symbols_file = to_wstring(__argv[++arg]);
+	}
+}
+
+void Application::AttachParentConsole()
+{
+	// Report to the parent console, if there is one. Output may also be redirected.
+	FILE* fp{};
+	if (AttachConsole(ATTACH_PARENT_PROCESS) && !GetStdHandle(STD_OUTPUT_HANDLE))
+		freopen_s(&fp, "CONOUT$", "w", stdout);
+}
+
+int Application::ExportLandscapeCodes()
+{
+	// Without a codes file there's nothing newer than the settings file already has.
+	auto codes_path = LandscapeCodes::DefaultPath();
+	if (!fs::exists(codes_path))
+	{
+		printf("No landscape codes file: %s\n", to_string(codes_path).c_str());
+		return 1;
 	}
+
+	LandscapeCodes codes;
+	codes.Load(codes_path);
+	codes.Export(LANDSCAPES_SECTION);
+
+	printf("%zu landscape codes exported to [%ls] in %s\n", codes.Size(), LANDSCAPES_SECTION, to_string(settings_path).c_str());
+	return 0;
+}
+
+int Application::ReplayJournalFile(const std::wstring& filename)
+{
+	auto start_time = std::chrono::high_resolution_clock::now();
+	auto result = ReplayJournal(filename);
+	auto elapsed = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	printf("%s: %zu commands, %llu frames in %.2fs", result.passed ? "PASS" : "FAIL",
+		result.commands, static_cast<unsigned long long>(result.frames), elapsed);
+
+	if (result.complete)
+		printf(", completed landscape %04X code %08X", result.landscape_bcd, result.secret_code_bcd);
+
+	if (!result.passed)
+		printf(" (%s)", result.error.c_str());
+
+	printf("\n");
+
+	// Idle loops that were fast-forwarded, for spotting new candidates.
+	for (auto& [pc, stats] : result.idle_loops)
+	{
+		printf("  idle loop %04X-%04X: %d cycles/iteration, %llu hits, %llu cycles skipped\n",
+			pc, stats.end_pc, stats.period_cycles,
+			static_cast<unsigned long long>(stats.hits),
+			static_cast<unsigned long long>(stats.skipped_cycles));
+	}
+
+	fflush(stdout);
+
+	return result.passed ? 0 : 1;
 }
 
 bool Application::InitializeWindow(int width, int height)
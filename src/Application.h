@@ -10,11 +10,12 @@ class Application
 {
 public:
 	Application(HINSTANCE hinst);
-	virtual ~Application() = default;
+	virtual ~Application();
 	Application(const Application&) = delete;
 
 	bool Init();
 	void Run();
+	int ExitCode() const { return m_exit_code; }
 
 	static HWND Hwnd();
 	static LRESULT CALLBACK StaticWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
@@ -22,6 +23,9 @@ public:
 
 protected:
 	void ProcessCommandLine();
+	void AttachParentConsole();
+	int ReplayJournalFile(const std::wstring& filename);
+	int ExportLandscapeCodes();
 	bool InitializeWindow(int width, int height);
 	void ActivateWindow(bool active);
 	void SaveWindowPosition(HWND hwnd_);
@@ -39,6 +43,23 @@ protected:
 	HWND m_hwnd{ NULL };
 	bool m_maximised{ true };
 	ViewMode m_viewMode{ ViewMode::Unspecified };
+	std::wstring m_record_file;
+	std::wstring m_replay_file;
+	std::wstring m_verify_source;
+	int m_check_display_landscapes{ 0 };
+	int m_generate_first{ 0 };
+	int m_generate_count{ 0 };
+	bool m_export_codes{ false };
+	std::wstring m_zex_file;
+	std::wstring m_diff_reference;
+	int m_diff_landscapes{ 0 };
+	bool m_audio_bench{ false };
+	std::wstring m_audio_bench_file;
+	bool m_hrtf_bench{ false };
+	std::wstring m_hrtf_bench_file;
+	std::wstring m_profile_file;
+	std::wstring m_symbols_file;
+	int m_exit_code{ 0 };
 
 	bool m_bWindowActive{ false };
 	bool m_bIgnoreMouseMove{ false };
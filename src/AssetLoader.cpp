@@ -0,0 +1,86 @@
+#include "stdafx.h"
+#include "AssetLoader.h"
+
+static constexpr size_t MAX_LOADER_THREADS = 4;
+
+AssetLoader::AssetLoader(size_t num_threads)
+{
+	for (size_t i = 0; i < num_threads; ++i)
+		m_threads.emplace_back(&AssetLoader::WorkerThread, this);
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_cv.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+/*static*/ AssetLoader& AssetLoader::Instance()
+{
+	static AssetLoader loader(std::max<size_t>(1, std::min<size_t>(MAX_LOADER_THREADS, std::thread::hardware_concurrency())));
+	return loader;
+}
+
+std::shared_future<std::shared_ptr<const AssetData>> AssetLoader::Load(const fs::path& path)
+{
+	std::lock_guard<std::mutex> lock(m_files_mutex);
+
+	auto it = m_files.find(path);
+	if (it != m_files.end())
+		return it->second;
+
+	auto future = Run(path.filename(), [path]
+		{
+			return std::shared_ptr<const AssetData>(std::make_shared<AssetData>(FindFile(path)));
+		});
+
+	m_files[path] = future;
+	return future;
+}
+
+void AssetLoader::Queue(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+
+	m_cv.notify_one();
+}
+
+void AssetLoader::WorkerThread()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+
+			// Outstanding jobs are finished before stopping, so no future is left unset.
+			if (m_jobs.empty())
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+/*static*/ void AssetLoader::LogLoadTime(const std::wstring& name, std::chrono::high_resolution_clock::time_point start_time, bool loaded)
+{
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+	std::wstringstream ss;
+	ss << (loaded ? L"Loaded " : L"Failed to load ") << name << L" in " << std::fixed << std::setprecision(1) << elapsed << L"ms\n";
+	OutputDebugString(ss.str().c_str());
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "MappedFile.h"
+
+using AssetData = MappedFile;
+
+// Small thread pool for loading game data in the background. Each file is mapped
+// once and shared, with users waiting only on the assets they need.
+class AssetLoader
+{
+public:
+	AssetLoader(size_t num_threads);
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+	virtual ~AssetLoader();
+
+	static AssetLoader& Instance();
+
+	// File contents, with load errors rethrown by get(). They stay mapped for reuse.
+	std::shared_future<std::shared_ptr<const AssetData>> Load(const fs::path& path);
+
+	// Runs a loading job on the pool, such as reading and decoding a sound.
+	template <typename F>
+	auto Run(const std::wstring& name, F&& func) -> std::shared_future<decltype(func())>
+	{
+		using Result = decltype(func());
+		auto task = std::make_shared<std::packaged_task<Result()>>(
+			[name, func = std::forward<F>(func)]() mutable
+			{
+				auto start_time = std::chrono::high_resolution_clock::now();
+				try
+				{
+					auto result = func();
+					LogLoadTime(name, start_time, true);
+					return result;
+				}
+				catch (...)
+				{
+					LogLoadTime(name, start_time, false);
+					throw;
+				}
+			});
+
+		std::shared_future<Result> future = task->get_future();
+		Queue([task] { (*task)(); });
+		return future;
+	}
+
+protected:
+	void Queue(std::function<void()> job);
+	void WorkerThread();
+	static void LogLoadTime(const std::wstring& name, std::chrono::high_resolution_clock::time_point start_time, bool loaded);
+
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop{ false };
+
+	std::mutex m_files_mutex;
+	std::map<fs::path, std::shared_future<std::shared_ptr<const AssetData>>> m_files;
+};
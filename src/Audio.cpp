@@ -1,12 +1,9 @@
 #include "stdafx.h"
 #include "Audio.h"
+#include "AssetLoader.h"
+#include "SoundCache.h"
 
-#define fourccRIFF 'FFIR'
-#define fourccDATA 'atad'
-#define fourccFMT  ' tmf'
-#define fourccWAVE 'EVAW'
-
-Audio::Audio()
+Audio::Audio(bool hrtf)
 {
 	DWORD creationFlags = XAUDIO2_1024_QUANTUM;
 #if defined(_DEBUG)
@@ -17,31 +14,111 @@ Audio::Audio()
 	if (SUCCEEDED(hr))
 	{
 		IXAudio2MasteringVoice* pMasteringVoice{ nullptr };
-		hr = m_pXAudio2->CreateMasteringVoice(&pMasteringVoice, 2, 44100);
+		hr = m_pXAudio2->CreateMasteringVoice(&pMasteringVoice, MIXER_CHANNELS, AUDIO_SAMPLE_RATE);
 		if (SUCCEEDED(hr))
 			m_pMasteringVoice.reset(pMasteringVoice);
 		else
 			m_pXAudio2.Reset();
 	}
 
-	DWORD dwChannelMask{};
-	if (SUCCEEDED(hr))
-		hr = m_pMasteringVoice->GetChannelMask(&dwChannelMask);
+	m_mixer = std::make_unique<Mixer>(AUDIO_SAMPLE_RATE, hrtf ? LoadHrtf() : nullptr);
+	m_soundCache = std::make_shared<SoundCache>(AUDIO_SAMPLE_RATE);
 
-	if (SUCCEEDED(hr))
-		X3DAudioInitialize(dwChannelMask, X3DAUDIO_SPEED_OF_SOUND, m_hX3D);
+	if (SUCCEEDED(hr) && !CreateOutputVoice())
+	{
+		m_pMasteringVoice.reset();
+		m_pXAudio2.Reset();
+	}
 }
 
 Audio::~Audio()
 {
 	Stop();
+
+	// The output voice must go first, as its callback uses the mixer.
+	m_pOutputVoice.reset();
 	m_pMasteringVoice.reset();
 	m_pXAudio2.Reset();
 }
 
+// Positioned sounds fall back to stereo panning if the HRTF data can't be used.
+/*static*/ std::shared_ptr<const Hrtf> Audio::LoadHrtf()
+{
+	if (!fs::exists(FindFile(HRTF_DATA_FILE)))
+		return nullptr;
+
+	try
+	{
+		// The mixer can only use data measured at its own rate.
+		auto hrtf = std::make_shared<Hrtf>(HRTF_DATA_FILE);
+		if (hrtf->SampleRate() != AUDIO_SAMPLE_RATE)
+			throw std::runtime_error("HRTF data is " + std::to_string(hrtf->SampleRate()) + "Hz, not " + std::to_string(AUDIO_SAMPLE_RATE) + "Hz");
+
+		return hrtf;
+	}
+	catch (const std::exception& e)
+	{
+		OutputDebugStringA((std::string(e.what()) + "\n").c_str());
+		return nullptr;
+	}
+}
+
+// All sounds are mixed in software, and streamed through a single float stereo voice.
+bool Audio::CreateOutputVoice()
+{
+	WAVEFORMATEX wfx{};
+	wfx.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+	wfx.nChannels = MIXER_CHANNELS;
+	wfx.nSamplesPerSec = AUDIO_SAMPLE_RATE;
+	wfx.wBitsPerSample = 32;
+	wfx.nBlockAlign = wfx.nChannels * wfx.wBitsPerSample / 8;
+	wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+
+	m_callback = std::make_unique<StreamCallback>(*this);
+
+	IXAudio2SourceVoice* pSourceVoice{ nullptr };
+	auto hr = m_pXAudio2->CreateSourceVoice(&pSourceVoice, &wfx, 0U, XAUDIO2_DEFAULT_FREQ_RATIO, m_callback.get());
+	if (FAILED(hr))
+		return false;
+
+	m_pOutputVoice.reset(pSourceVoice);
+
+	for (size_t i = 0; i < m_buffers.size(); ++i)
+	{
+		m_buffers[i].resize(AUDIO_BUFFER_FRAMES * MIXER_CHANNELS);
+		SubmitBuffer(i);
+	}
+
+	hr = m_pOutputVoice->Start();
+	if (FAILED(hr))
+	{
+		m_pOutputVoice.reset();
+		return false;
+	}
+
+	return true;
+}
+
+void Audio::SubmitBuffer(size_t index)
+{
+	auto& samples = m_buffers[index];
+	m_mixer->Render(samples.data(), AUDIO_BUFFER_FRAMES);
+
+	XAUDIO2_BUFFER buffer{};
+	buffer.AudioBytes = static_cast<UINT32>(samples.size() * sizeof(float));
+	buffer.pAudioData = reinterpret_cast<const BYTE*>(samples.data());
+	buffer.pContext = reinterpret_cast<void*>(index);
+	m_pOutputVoice->SubmitSourceBuffer(&buffer);
+}
+
+void STDMETHODCALLTYPE Audio::StreamCallback::OnBufferEnd(void* pBufferContext)
+{
+	m_audio.SubmitBuffer(reinterpret_cast<size_t>(pBufferContext));
+}
+
 bool Audio::Available() const
 {
-	return m_pXAudio2 && m_pMasteringVoice;
+	return m_pXAudio2 && m_pMasteringVoice && m_pOutputVoice;
 }
 
 bool Audio::IsPlaying(AudioType type) const
@@ -51,7 +128,7 @@ bool Audio::IsPlaying(AudioType type) const
 		if (type != AudioType::Unknown && sound.type != type)
 			continue;
 
-		return IsPlaying(sound.voice);
+		return m_mixer->IsActive(sound.voice);
 	}
 
 	return false;
@@ -61,12 +138,12 @@ bool Audio::SetMusicVolume(float volume)
 {
 	for (auto& sound : m_playingSounds)
 	{
-		if (sound.type == AudioType::Music)
+		if (sound.type == AudioType::Music && m_mixer->IsActive(sound.voice))
 		{
-			std::array<float, 2> volumes{ volume, volume };
-			auto hr = sound.voice->SetChannelVolumes(
-				static_cast<UINT32>(volumes.size()), volumes.data());
-			return SUCCEEDED(hr);
+			sound.volume = volume;
+			sound.gains = SoundGains(sound);
+			m_mixer->SetGains(sound.voice, sound.gains);
+			return true;
 		}
 	}
 
@@ -77,17 +154,15 @@ bool Audio::SetMusicPlaying(bool play)
 {
 	for (auto& sound : m_playingSounds)
 	{
-		if (sound.type == AudioType::Music)
+		if (sound.type == AudioType::Music && m_mixer->IsActive(sound.voice))
 		{
-			HRESULT hr{ S_OK };
-
 			if (sound.playing != play)
 			{
-				hr = play ? sound.voice->Start() : sound.voice->Stop();
+				m_mixer->SetPaused(sound.voice, !play);
 				sound.playing = play;
 			}
 
-			return SUCCEEDED(hr);
+			return true;
 		}
 	}
 
@@ -96,212 +171,230 @@ bool Audio::SetMusicPlaying(bool play)
 
 float Audio::LengthInSeconds(const std::wstring& filename)
 {
-	const auto it = m_soundBank.find(filename);
-	if (it == m_soundBank.end())
-		return 0.0f;
+	if (auto data = BankSound(filename))
+		return data->LengthInSeconds();
 
-	auto& wfx = *reinterpret_cast<WAVEFORMATEX*>(it->second.first.data());
-	return static_cast<float>(it->second.second.size()) / wfx.nAvgBytesPerSec;
+	const auto it_streamed = m_streamedFiles.find(filename);
+	if (it_streamed != m_streamedFiles.end())
+	{
+		try
+		{
+			return SoundStream(it_streamed->second).LengthInSeconds();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	return 0.0f;
 }
 
-void Audio::LoadWAV(fs::path path)
+// Streamed sounds are only opened when played.
+void Audio::AddStreamedWAV(fs::path path)
 {
-	HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, NULL);
-	if (INVALID_HANDLE_VALUE == hFile)
-	{
-		auto str = "File not found: " + to_string(path);
-		throw std::runtime_error(str);
-	}
+	m_streamedFiles[path.filename()] = path;
+}
 
-	SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+// Sounds are read and decoded on the asset loader threads, and waited for only when used.
+// They're converted to the mix rate once, and cached, so playback needs no resampling.
+void Audio::LoadWAV(fs::path path)
+{
+	m_soundBank[path.filename()] = AssetLoader::Instance().Run(path.filename(),
+		[path, cache = m_soundCache] { return cache->Load(path, ReadWAV); });
+}
 
+/*static*/ std::shared_ptr<SoundData> Audio::ReadWAV(const MappedFile& file)
+{
 	try
 	{
-		DWORD dwChunkSize, dwChunkPosition;
-		FindChunk(hFile, fourccRIFF, dwChunkSize, dwChunkPosition);
-
-		DWORD filetype;
-		ReadChunkData(hFile, &filetype, sizeof(filetype), dwChunkPosition);
-		if (filetype != fourccWAVE)
-			throw std::exception("not a WAV");
-
-		WAVEFORMATEXTENSIBLE wfx{};
-		FindChunk(hFile, fourccFMT, dwChunkSize, dwChunkPosition);
-		std::vector<uint8_t> format(dwChunkSize);
-		ReadChunkData(hFile, format.data(), dwChunkSize, dwChunkPosition);
+		auto wav = ParseWAV(file.Span());
 
-		FindChunk(hFile, fourccDATA, dwChunkSize, dwChunkPosition);
-		std::vector<uint8_t> data(dwChunkSize);
-		ReadChunkData(hFile, data.data(), dwChunkSize, dwChunkPosition);
+		if (wav.format_tag == WAV_FORMAT_ADPCM)
+			return SoundData::FromADPCM(wav.channels, wav.sample_rate, wav.block_align, wav.data);
 
-		m_soundBank[path.filename()] = { format, data };
+		return SoundData::FromPCM(wav.format_tag, wav.channels, wav.sample_rate, wav.bits, wav.data);
 	}
 	catch (...)
 	{
-		auto str = "Invalid WAV: " + to_string(path);
+		auto str = "Invalid WAV: " + to_string(file.Path());
 		throw std::runtime_error(str);
 	}
 }
 
-void Audio::FindChunk(HANDLE hFile, DWORD fourcc, DWORD& dwChunkSize, DWORD& dwChunkDataPosition)
+// Waits for a sound bank entry if it's still loading. A sound that failed to load is
+// logged and dropped from the bank, so the game continues without it.
+std::shared_ptr<const SoundData> Audio::BankSound(const std::wstring& filename)
 {
-	SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
-
-	DWORD dwChunkType;
-	DWORD dwChunkDataSize;
-	DWORD dwRIFFDataSize = 0;
-	DWORD dwFileType;
-	DWORD bytesRead = 0;
-	DWORD dwOffset = 0;
+	auto it = m_soundBank.find(filename);
+	if (it == m_soundBank.end())
+		return nullptr;
 
-	for (;;)
+	try
 	{
-		DWORD dwRead;
-		if (0 == ReadFile(hFile, &dwChunkType, sizeof(DWORD), &dwRead, NULL))
-			throw std::exception("short file");
-
-		if (0 == ReadFile(hFile, &dwChunkDataSize, sizeof(DWORD), &dwRead, NULL))
-			throw std::exception("short file");
-
-		switch (dwChunkType)
-		{
-		case fourccRIFF:
-			dwRIFFDataSize = dwChunkDataSize;
-			dwChunkDataSize = 4;
-			if (0 == ReadFile(hFile, &dwFileType, sizeof(DWORD), &dwRead, NULL))
-				throw std::exception("short file");
-			break;
-
-		default:
-			if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, dwChunkDataSize, NULL, FILE_CURRENT))
-				throw std::exception("short file");
-		}
-
-		dwOffset += sizeof(DWORD) * 2;
-
-		if (dwChunkType == fourcc)
-		{
-			dwChunkSize = dwChunkDataSize;
-			dwChunkDataPosition = dwOffset;
-			return;
-		}
-
-		dwOffset += dwChunkDataSize;
-
-		if (bytesRead >= dwRIFFDataSize)
-			throw std::exception("short file");
+		return it->second.get();
+	}
+	catch (const std::exception& e)
+	{
+		OutputDebugStringA((std::string(e.what()) + "\n").c_str());
+		m_soundBank.erase(it);
+		return nullptr;
 	}
 }
 
-void Audio::ReadChunkData(HANDLE hFile, void* buffer, DWORD buffersize, DWORD bufferoffset)
+VoiceGains Audio::SoundGains(const Sound& sound) const
 {
-	if (INVALID_SET_FILE_POINTER == SetFilePointer(hFile, bufferoffset, NULL, FILE_BEGIN))
-		throw std::exception("short file");
+	if (!sound.Positioned())
+		return DefaultGains(sound.channels, sound.volume);
 
-	DWORD dwRead;
-	if (0 == ReadFile(hFile, buffer, buffersize, &dwRead, NULL))
-		throw std::exception("short file");
+	return m_spatialiser.Calculate(sound.pos, sound.channels, sound.volume);
 }
 
-void Audio::PositionSound(Sound& sound)
+// Forget sounds that have finished, before their mixer voices are reused.
+void Audio::RemoveFinishedSounds()
 {
-	if (!Available())
-		return;
+	m_playingSounds.erase(std::remove_if(m_playingSounds.begin(), m_playingSounds.end(),
+		[&](const Sound& sound) { return !m_mixer->IsActive(sound.voice); }), m_playingSounds.end());
+}
 
-	if (sound.pos.x == 0.0f && sound.pos.y == 0.0f && sound.pos.z == 0.0f)
+void Audio::PositionListener(XMFLOAT3 pos, XMFLOAT3 front_dir, XMFLOAT3 up_dir)
+{
+	if (!Available())
 		return;
 
-	X3DAUDIO_EMITTER emitter{};
-	emitter.CurveDistanceScaler = 6.0f;
-	emitter.Position = { sound.pos.x, sound.pos.y, sound.pos.z };
-	emitter.ChannelCount = sound.wfx.nChannels;
+	m_spatialiser.SetListener(pos, front_dir, up_dir);
 
-	XAUDIO2_VOICE_DETAILS master_details{};
-	m_pMasteringVoice->GetVoiceDetails(&master_details);
+	RemoveFinishedSounds();
 
-	std::vector<FLOAT32> matrix(master_details.InputChannels);
+	// Gather the positioned sounds to calculate their gains in one pass.
+	m_positioned.clear();
+	m_positions.clear();
+	m_channels.clear();
+	m_volumes.clear();
 
-	X3DAUDIO_DSP_SETTINGS dsp_settings{};
-	dsp_settings.SrcChannelCount = emitter.ChannelCount;
-	dsp_settings.DstChannelCount = master_details.InputChannels;
-	dsp_settings.pMatrixCoefficients = matrix.data();
+	for (auto& sound : m_playingSounds)
+	{
+		if (sound.Positioned())
+		{
+			m_positioned.push_back(&sound);
+			m_positions.push_back(sound.pos);
+			m_channels.push_back(sound.channels);
+			m_volumes.push_back(sound.volume);
+		}
+	}
 
-	X3DAudioCalculate(m_hX3D, &m_listener, &emitter, X3DAUDIO_CALCULATE_MATRIX, &dsp_settings);
-	sound.voice->SetOutputMatrix(m_pMasteringVoice.get(), emitter.ChannelCount, master_details.InputChannels, matrix.data());
-}
+	// With the HRTF, sounds are rendered from their direction instead of panned.
+	if (m_mixer->HrtfEnabled())
+	{
+		m_directions.resize(m_positioned.size());
+		m_spatialiser.Directions(m_positions.data(), m_volumes.data(), m_directions.data(), m_directions.size());
+	}
+	else
+	{
+		m_gains.resize(m_positioned.size());
+		m_spatialiser.Calculate(m_positions.data(), m_channels.data(), m_volumes.data(), m_gains.data(), m_gains.size());
+	}
 
-bool Audio::IsPlaying(const VoicePtr<IXAudio2SourceVoice>& voice) const
-{
-	XAUDIO2_VOICE_STATE state{};
-	voice->GetState(&state, XAUDIO2_VOICE_NOSAMPLESPLAYED);
-	return state.BuffersQueued != 0;
+	// Only send the mixer changes that are big enough to hear.
+	for (size_t i = 0; i < m_positioned.size(); ++i)
+	{
+		auto& sound = *m_positioned[i];
+		if (sound.directional)
+		{
+			if (Spatialiser::DirectionChanged(sound.direction, m_directions[i]))
+			{
+				sound.direction = m_directions[i];
+				m_mixer->SetDirection(sound.voice, sound.direction);
+			}
+		}
+		else
+		{
+			auto gains = m_mixer->HrtfEnabled() ? SoundGains(sound) : m_gains[i];
+			if (Spatialiser::GainsChanged(sound.gains, gains))
+			{
+				sound.gains = gains;
+				m_mixer->SetGains(sound.voice, sound.gains);
+			}
+		}
+	}
 }
 
-void Audio::PositionListener(XMFLOAT3 pos, XMFLOAT3 front_dir, XMFLOAT3 up_dir)
+bool Audio::Play(const std::wstring& filename, AudioType type, XMFLOAT3 pos, float speed)
 {
 	if (!Available())
-		return;
+		return false;
 
-	m_listener.OrientFront = { front_dir.x, front_dir.y, front_dir.z };
-	m_listener.OrientTop = { up_dir.x, up_dir.y, up_dir.z };
-	m_listener.Position = { pos.x, pos.y, pos.z };
+	Sound sound{};
+	std::shared_ptr<const SoundData> data;
 
-	for (auto it = m_playingSounds.begin(); it != m_playingSounds.end(); )
+	if (m_soundBank.count(filename))
 	{
-		if (IsPlaying(it->voice))
-			PositionSound(*it++);
-		else
-			it = m_playingSounds.erase(it);
+		data = BankSound(filename);
+		if (!data)
+			return false;
+
+		sound.channels = data->channels;
 	}
+	else
+	{
+		auto it_streamed = m_streamedFiles.find(filename);
+		if (it_streamed == m_streamedFiles.end())
+			return false;
+
+		try
+		{
+			sound.stream = std::make_shared<SoundStream>(it_streamed->second);
+			sound.channels = sound.stream->Channels();
+		}
+		catch (...)
+		{
+			return false;
+		}
+	}
+
+	return StartSound(std::move(sound), data, type, pos, speed);
 }
 
-bool Audio::Play(const std::wstring& filename, AudioType type, XMFLOAT3 pos, float speed)
+// Plays sound data that isn't in the sound bank, such as original Spectrum tunes.
+bool Audio::Play(std::shared_ptr<const SoundData> data, AudioType type, XMFLOAT3 pos, float speed)
 {
-	if (!Available())
+	if (!Available() || !data)
 		return false;
 
-	auto it = m_soundBank.find(filename);
-	if (it == m_soundBank.end())
-		return false;
+	Sound sound{};
+	sound.channels = data->channels;
 
-	IXAudio2SourceVoice* pSourceVoice{ nullptr };
-	auto& wfx = *reinterpret_cast<WAVEFORMATEX*>(it->second.first.data());
-	auto hr = m_pXAudio2->CreateSourceVoice(&pSourceVoice, &wfx, 0U, 4.0f);
-	VoicePtr<IXAudio2SourceVoice> spSourceVoice(pSourceVoice);
-	if (FAILED(hr))
-		return false;
+	return StartSound(std::move(sound), data, type, pos, speed);
+}
 
-	XAUDIO2_BUFFER buffer{};
-	buffer.AudioBytes = static_cast<DWORD>(it->second.second.size());
-	buffer.pAudioData = it->second.second.data();
-	buffer.Flags = XAUDIO2_END_OF_STREAM;
-	buffer.LoopCount = (type == AudioType::LoopingEffect) ? XAUDIO2_LOOP_INFINITE : 0;
+bool Audio::StartSound(Sound&& sound, std::shared_ptr<const SoundData> data, AudioType type, XMFLOAT3 pos, float speed)
+{
+	// Only one tune or music track at a time.
+	if (type == AudioType::Tune || type == AudioType::Music)
+		Stop(type);
 
-	pSourceVoice->SetFrequencyRatio(speed);
-	hr = pSourceVoice->SubmitSourceBuffer(&buffer);
-	if (FAILED(hr))
-		return false;
+	RemoveFinishedSounds();
 
-	Sound sound{};
 	sound.type = type;
-	sound.voice = std::move(spSourceVoice);
-	sound.wfx = wfx;
 	sound.pos = pos;
-	sound.loop = (buffer.LoopCount > 0);
 	sound.playing = (type != AudioType::Music);	// music not auto-started
 
-	PositionSound(sound);
+	auto loop = (type == AudioType::LoopingEffect);
+	sound.directional = sound.Positioned() && !sound.stream && m_mixer->HrtfEnabled();
 
-	if (sound.playing)
+	if (sound.directional)
 	{
-		hr = sound.voice->Start();
-		if (FAILED(hr))
-			return false;
+		sound.direction = m_spatialiser.Direction(sound.pos, sound.volume);
+		sound.voice = m_mixer->Play(data, sound.direction, speed, loop);
 	}
-
-	// Only one tune or music track at a time.
-	if (type == AudioType::Tune || type == AudioType::Music)
-		Stop(type);
+	else
+	{
+		sound.gains = SoundGains(sound);
+		sound.voice = sound.stream ?
+			m_mixer->Play(sound.stream, sound.gains, speed, loop, !sound.playing) :
+			m_mixer->Play(data, sound.gains, speed, loop, !sound.playing);
+	}
+	if (sound.voice < 0)
+		return false;
 
 	m_playingSounds.push_back(std::move(sound));
 
@@ -314,7 +407,7 @@ void Audio::Stop(AudioType type)
 	{
 		if (type == AudioType::Unknown || it->type == type)
 		{
-			it->voice->Stop();
+			m_mixer->Stop(it->voice);
 			it = m_playingSounds.erase(it);
 		}
 		else
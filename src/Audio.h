@@ -1,4 +1,8 @@
 #pragma once
+#include "Mixer.h"
+#include "Spatialiser.h"
+
+class SoundCache;
 
 template <typename T>
 struct VoiceDeleter { void operator()(T* p) { if (p) p->DestroyVoice(); } };
@@ -8,10 +12,14 @@ using VoicePtr = std::unique_ptr<T, VoiceDeleter<T>>;
 
 enum class AudioType { Unknown, Effect, LoopingEffect, Tune, Music };
 
+static constexpr int AUDIO_SAMPLE_RATE = 44100;
+static constexpr int AUDIO_BUFFER_FRAMES = 512;
+static constexpr int AUDIO_NUM_BUFFERS = 4;
+
 class Audio
 {
 public:
-	Audio();
+	Audio(bool hrtf = false);
 	virtual ~Audio();
 
 	bool Available() const;
@@ -19,8 +27,10 @@ public:
 	bool SetMusicVolume(float volume);
 	bool SetMusicPlaying(bool play);
 	void LoadWAV(fs::path path);
+	void AddStreamedWAV(fs::path path);
 	float LengthInSeconds(const std::wstring& filename);
 	bool Play(const std::wstring& filename, AudioType type = AudioType::Effect, XMFLOAT3 pos = {}, float speed = 1.0f);
+	bool Play(std::shared_ptr<const SoundData> data, AudioType type = AudioType::Effect, XMFLOAT3 pos = {}, float speed = 1.0f);
 	void Stop(AudioType type = AudioType::Unknown);
 	void PositionListener(XMFLOAT3 pos, XMFLOAT3 front_dir, XMFLOAT3 up_dir);
 
@@ -28,25 +38,67 @@ protected:
 	struct Sound
 	{
 		AudioType type{ AudioType::Unknown };
-		VoicePtr<IXAudio2SourceVoice> voice;
-		WAVEFORMATEX wfx{};
+		int voice{ -1 };
+		int channels{ 1 };
+		std::shared_ptr<SoundStream> stream;
 		XMFLOAT3 pos{};
-		bool loop{ false };
+		float volume{ 1.0f };
+		VoiceGains gains{};	// as last sent to the mixer.
+		HrtfDirection direction{};
+		bool directional{ false };	// rendered through the HRTF.
 		bool playing{ false };
+
+		bool Positioned() const { return pos.x != 0.0f || pos.y != 0.0f || pos.z != 0.0f; }
+	};
+
+	// Refills output buffers from the mixer, on the XAudio2 thread.
+	class StreamCallback : public IXAudio2VoiceCallback
+	{
+	public:
+		StreamCallback(Audio& audio) : m_audio(audio) {}
+
+		void STDMETHODCALLTYPE OnBufferEnd(void* pBufferContext) override;
+		void STDMETHODCALLTYPE OnVoiceProcessingPassStart(UINT32) override {}
+		void STDMETHODCALLTYPE OnVoiceProcessingPassEnd() override {}
+		void STDMETHODCALLTYPE OnStreamEnd() override {}
+		void STDMETHODCALLTYPE OnBufferStart(void*) override {}
+		void STDMETHODCALLTYPE OnLoopEnd(void*) override {}
+		void STDMETHODCALLTYPE OnVoiceError(void*, HRESULT) override {}
+
+	protected:
+		Audio& m_audio;
 	};
 
-	void FindChunk(HANDLE hFile, DWORD fourcc, DWORD& dwChunkSize, DWORD& dwChunkDataPosition);
-	void ReadChunkData(HANDLE hFile, void* buffer, DWORD buffersize, DWORD bufferoffset);
-	bool IsPlaying(const VoicePtr<IXAudio2SourceVoice>& voice) const;
-	void PositionSound(Sound& sound);
+	static std::shared_ptr<const Hrtf> LoadHrtf();
+	static std::shared_ptr<SoundData> ReadWAV(const MappedFile& file);
+	bool CreateOutputVoice();
+	void SubmitBuffer(size_t index);
+	std::shared_ptr<const SoundData> BankSound(const std::wstring& filename);
+	void RemoveFinishedSounds();
+	bool StartSound(Sound&& sound, std::shared_ptr<const SoundData> data, AudioType type, XMFLOAT3 pos, float speed);
+	VoiceGains SoundGains(const Sound& sound) const;
 
 protected:
 	ComPtr<IXAudio2> m_pXAudio2;
 	VoicePtr<IXAudio2MasteringVoice> m_pMasteringVoice;
 
-	X3DAUDIO_HANDLE m_hX3D;
-	X3DAUDIO_LISTENER m_listener{};
+	std::unique_ptr<Mixer> m_mixer;
+	std::unique_ptr<StreamCallback> m_callback;
+	std::array<std::vector<float>, AUDIO_NUM_BUFFERS> m_buffers;
+	VoicePtr<IXAudio2SourceVoice> m_pOutputVoice;
+
+	Spatialiser m_spatialiser;
+
+	// Positioned sound details, gathered for each listener update.
+	std::vector<Sound*> m_positioned;
+	std::vector<XMFLOAT3> m_positions;
+	std::vector<int> m_channels;
+	std::vector<float> m_volumes;
+	std::vector<VoiceGains> m_gains;
+	std::vector<HrtfDirection> m_directions;
 
-	std::map<std::wstring, std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> m_soundBank;
+	std::shared_ptr<SoundCache> m_soundCache;	// shared with loader jobs.
+	std::map<std::wstring, std::shared_future<std::shared_ptr<SoundData>>> m_soundBank;	// loaded in the background.
+	std::map<std::wstring, fs::path> m_streamedFiles;
 	std::vector<Sound> m_playingSounds;
 };
@@ -25,9 +25,6 @@ constexpr auto VOLUME_STEP = 10;			// volume adjustment step percentage.
 constexpr auto POINTER_SCALE = 4;			// 3D pointer block scale.
 constexpr auto TEMP_ID_BASE = 0x100;		// Base id for temporary model.
 
-constexpr auto SENTINEL_SNAPSHOT_FILE = L"./sentinel.sna";
-
-static const auto LANDSCAPES_SECTION{ L"Landscapes" };
 static const auto LAST_LANDSCAPE_KEY{ L"LastLandscape" };
 static const auto MOUSE_SPEED_KEY{ L"MouseSpeed" };
 static const auto SOUND_PACK_KEY{ L"SoundPack" };
@@ -127,20 +124,29 @@ std::vector<std::pair<int, std::wstring>> msaa_modes
 	{ 4, L"4x" },
 };
 
-Augmentinel::Augmentinel(std::shared_ptr<View>& pView, std::shared_ptr<Audio>& pAudio)
+Augmentinel::Augmentinel(std::shared_ptr<View>& pView, std::shared_ptr<Audio>& pAudio, const std::wstring& journal_file)
 	: m_pView(pView), m_pAudio(pAudio)
 {
-	// Pre-load all sound effects and music from the current sound pack.
+	// Record the emulation input for replaying later?
+	if (!journal_file.empty())
+		m_pJournal = std::make_shared<Journal>(journal_file);
+
+	// Pre-load all sound effects from the current sound pack, with music streamed when played.
+	// Loading is in the background, starting with the title tune as it's needed first.
 	auto sound_path = fs::path(SOUND_PACK_DIR) / GetSetting(SOUND_PACK_KEY, DEFAULT_SOUND_PACK);
+	pAudio->LoadWAV(sound_path / TITLE_TUNE);
 	for (auto& sound : effects_and_tunes)
-		pAudio->LoadWAV(sound_path / sound);
+	{
+		if (sound != TITLE_TUNE)
+			pAudio->LoadWAV(sound_path / sound);
+	}
 
 	auto music_path = fs::path(SOUND_PACK_DIR) / MUSIC_SUBDIR;
 	for (auto& p : fs::directory_iterator(music_path))
 	{
 		if (p.path().extension() == ".wav")
 		{
-			pAudio->LoadWAV(p.path());
+			pAudio->AddStreamedWAV(p.path());
 			music_files.push_back(p.path().filename());
 		}
 	}
@@ -177,9 +183,15 @@ Augmentinel::Augmentinel(std::shared_ptr<View>& pView, std::shared_ptr<Audio>& p
 	ChangeState(GameState::Reset);
 }
 
-void Augmentinel::PlayTune(const std::wstring& filename)
+// The original Spectrum tune is used instead of the sound pack's, if it was captured.
+void Augmentinel::PlayTune(const std::wstring& filename, std::shared_ptr<const SoundData> original)
 {
-	if (m_tunes_enabled)
+	if (!m_tunes_enabled)
+		return;
+
+	if (original)
+		m_pAudio->Play(original, AudioType::Tune);
+	else
 		m_pAudio->Play(filename, AudioType::Tune);
 }
 
@@ -360,10 +372,17 @@ void Augmentinel::Frame(float fElapsed)
 	m_pView->ProcessDebugKeys();
 #endif
 
+	// Handle game events raised by the emulation thread.
+	ProcessEmulationEvents();
+
 	switch (m_state)
 	{
 	case GameState::Reset:
 	{
+		// Wait for the title screen once emulation has started.
+		if (m_substate > 0)
+			break;
+
 		if (!m_pView->TransitionEffect(ViewEffect::Fade, 1.0f, fElapsed))
 			break;
 
@@ -377,13 +396,14 @@ void Augmentinel::Frame(float fElapsed)
 		m_text = {};
 		m_icons = {};
 
-		// Load the Spectrum game snapshot into an emulation object.
-		m_spectrum = std::move(std::make_unique<Spectrum>(SENTINEL_SNAPSHOT_FILE, this));
+		// Load the Spectrum game snapshot into an emulation object, with its own thread.
+		// The old emulation must finish first, as both may write to the journal.
+		m_emulation.reset();
+		m_emulation = std::make_unique<Emulation>(SENTINEL_SNAPSHOT_FILE, m_landscape_bcd, m_codes.SecretCode(m_landscape_bcd), m_pJournal);
+		m_seen_state = SeenState::Unseen;
 
 		// Limit the number of emulated frames to advance beyond reset state.
-		if (!RunUntilStateChange())
-			throw std::exception("Failed to reach title screen.\n\nSnapshot not saved at controls menu?");
-
+		RunUntilStateChange("Failed to reach title screen.\n\nSnapshot not saved at controls menu?");
 		break;
 	}
 
@@ -393,6 +413,10 @@ void Augmentinel::Frame(float fElapsed)
 		{
 		case 0:
 		{
+			// Spectrum state can only be read when the emulation thread is idle.
+			if (m_emulation->Busy())
+				break;
+
 			// Skip title screen?
 			if (m_title_shown)
 			{
@@ -409,22 +433,23 @@ void Augmentinel::Frame(float fElapsed)
 			}
 
 			// Extract  text as models.
-			m_drawn_models = m_spectrum->ExtractText();	// "THE SENTINEL"
+			auto& spectrum = m_emulation->GetSpectrum();
+			m_drawn_models = spectrum.ExtractText();	// "THE SENTINEL"
 
 			m_pView->EnableFreeLook(false);
 			m_pView->SetCameraPosition({ -11.63f, 57.8f, -61.5f });
 			m_pView->SetCameraRotation({ 0.64f, 0.42f, 0.0f });
 
 			m_pView->SetFillColour(DARK_BLUE_PALETTE_INDEX);
-			m_pView->SetPalette(m_spectrum->GetGamePalette(2));
+			m_pView->SetPalette(spectrum.GetGamePalette(2));
 			m_pView->SetEffect(ViewEffect::ZFade, 0.01f);
 
-			auto sentinel = m_spectrum->GetModel(ModelType::Sentinel);
+			auto sentinel = spectrum.GetModel(ModelType::Sentinel);
 			sentinel.pos = { -8.31f, 54.06f, -57.11f };
 			sentinel.rot = { -0.47f, 4.16f, -0.31f };
 			m_drawn_models.push_back(std::move(sentinel));
 
-			auto pedestal = m_spectrum->GetModel(ModelType::Pedestal);
+			auto pedestal = spectrum.GetModel(ModelType::Pedestal);
 			pedestal.pos = { -8.5f, 53.19f, -57.58f };
 			pedestal.rot = { -0.47f, 4.16f, -0.31f };
 			m_drawn_models.push_back(std::move(pedestal));
@@ -452,9 +477,7 @@ void Augmentinel::Frame(float fElapsed)
 			if (!m_pView->TransitionEffect(ViewEffect::Fade, 1.0f, fElapsed))
 				break;
 
-			if (!RunUntilStateChange())
-				throw std::exception("Failed to reach landscape preview.\n\nPlease report this bug!");
-
+			RunUntilStateChange("Failed to reach landscape preview.\n\nPlease report this bug!");
 			break;
 		}
 		break;
@@ -466,10 +489,14 @@ void Augmentinel::Frame(float fElapsed)
 		{
 		case 0:
 		{
+			if (m_emulation->Busy())
+				break;
+
 			m_rotate_landscape = GetFlag(L"RotateLandscape", m_rotate_landscape);
 
-			m_landscape = m_spectrum->ExtractLandscape();
-			m_drawn_models = m_spectrum->ExtractPlacedModels();
+			auto& spectrum = m_emulation->GetSpectrum();
+			m_landscape = spectrum.ExtractLandscape(GetFlag(L"OptimisedLandscape", false));
+			m_drawn_models = spectrum.ExtractPlacedModels();
 
 			// Remove trees and double size of humanoids.
 			for (auto it = m_drawn_models.begin(); it != m_drawn_models.end(); )
@@ -496,7 +523,7 @@ void Augmentinel::Frame(float fElapsed)
 
 			m_pView->SetVerticalFOV(SENTINEL_VERT_FOV);
 			m_pView->SetFillColour(BLACK_PALETTE_INDEX);
-			m_pView->SetPalette(m_spectrum->GetGamePalette());
+			m_pView->SetPalette(spectrum.GetGamePalette());
 			m_pView->SetEffect(ViewEffect::Dissolve, 0.0f);
 			m_pView->SetEffect(ViewEffect::Desaturate, 0.0f);
 			m_pView->SetEffect(ViewEffect::FogDensity, 0.0f);
@@ -525,11 +552,12 @@ void Augmentinel::Frame(float fElapsed)
 			AddText(ss.str(), 15.0f, 20.0f, -1.0f);
 
 			// Shown left arrow if there is a previous landscape in the unlocked list.
-			if (std::prev(m_codes.find(m_landscape_bcd)) != m_codes.end())
+			const auto index = m_codes.Find(m_landscape_bcd);
+			if (index != LandscapeCodes::npos && index > 0)
 				AddText("<", 2.0f, 20.0f, -1.0f);
 
 			// Shown right arrow if there is a next landscape in the unlocked list.
-			if (std::next(m_codes.find(m_landscape_bcd)) != m_codes.end())
+			if (index != LandscapeCodes::npos && index + 1 < m_codes.Size())
 				AddText(">", 28.0f, 20.0f, -1.0f);
 
 			// If the player can see this they're facing the wrong way!
@@ -548,46 +576,39 @@ void Augmentinel::Frame(float fElapsed)
 			// Fade in landscape preview without delaying keyboard interaction.
 			m_pView->TransitionEffect(ViewEffect::Fade, 0.0f, fElapsed);
 
-			const auto it_current = m_codes.find(m_landscape_bcd);
-			auto it_new = it_current;
+			// A landscape missing from the unlocked list can only jump to the first or last.
+			const auto index_current = m_codes.Find(m_landscape_bcd);
+			const auto found = index_current != LandscapeCodes::npos;
+			const auto page_step = m_codes.Size() / PAGE_STEPS;
+			auto index_new = index_current;
 
 			if (m_pView->InputAction(Action::LandscapePrev))
 			{
-				if (std::prev(it_new) != m_codes.end())
-					it_new = std::prev(it_new);
+				if (found && index_new > 0)
+					index_new--;
 			}
 			else if (m_pView->InputAction(Action::LandscapeNext))
 			{
-				if (std::next(it_new) != m_codes.end())
-					it_new = std::next(it_new);
+				if (found && index_new + 1 < m_codes.Size())
+					index_new++;
 			}
 			else if (m_pView->InputAction(Action::LandscapePgUp))
 			{
-				for (size_t i = 0; i < m_codes.size() / PAGE_STEPS; ++i)
-				{
-					if (std::prev(it_new) != m_codes.end())
-						it_new = std::prev(it_new);
-					else
-						break;
-				}
+				if (found)
+					index_new -= std::min(index_new, page_step);
 			}
 			else if (m_pView->InputAction(Action::LandscapePgDn))
 			{
-				for (size_t i = 0; i < m_codes.size() / PAGE_STEPS; ++i)
-				{
-					if (std::next(it_new) != m_codes.end())
-						it_new = std::next(it_new);
-					else
-						break;
-				}
+				if (found)
+					index_new = std::min(index_new + page_step, m_codes.Size() - 1);
 			}
 			else if (m_pView->InputAction(Action::LandscapeFirst))
 			{
-				it_new = m_codes.begin();
+				index_new = 0;
 			}
 			else if (m_pView->InputAction(Action::LandscapeLast))
 			{
-				it_new = std::prev(m_codes.end());
+				index_new = m_codes.Size() - 1;
 			}
 			else if (m_pView->InputAction(Action::Quit))
 			{
@@ -610,9 +631,9 @@ void Augmentinel::Frame(float fElapsed)
 				break;
 			}
 
-			if (it_new != it_current)
+			if (index_new != index_current)
 			{
-				m_landscape_bcd = it_new->first;
+				m_landscape_bcd = m_codes[index_new].landscape_bcd;
 				ChangeState(GameState::Reset);
 			}
 			break;
@@ -623,9 +644,7 @@ void Augmentinel::Frame(float fElapsed)
 
 			m_landscape.rot.y = 0.0f;
 
-			if (!RunUntilStateChange())
-				throw std::exception("Failed to reach main game.\n\nPlease report this bug with landscape number.");
-
+			RunUntilStateChange("Failed to reach main game.\n\nPlease report this bug with landscape number.");
 			break;
 		}
 		break;
@@ -637,16 +656,20 @@ void Augmentinel::Frame(float fElapsed)
 		{
 		case 0:	// init main game
 		{
+			if (m_emulation->Busy())
+				break;
+
 			m_pView->SetFogColour(SKY_PALETTE_INDEX);
 			m_pView->SetEffect(ViewEffect::FogDensity, 0.025f);
 			m_pView->SetEffect(ViewEffect::Desaturate, 0.0f);
 			m_pView->SetEffect(ViewEffect::Dissolve, 0.0f);
 			m_pView->SetEffect(ViewEffect::ZFade, 0.0f);
 
-			m_drawn_models = m_spectrum->ExtractPlacedModels();
-			m_player = m_spectrum->ExtractPlayerModel();
+			m_drawn_models = m_emulation->GetSpectrum().ExtractPlacedModels();
+			m_player = m_emulation->GetSpectrum().ExtractPlayerModel();
 			m_animations.clear();
 			m_text.clear();
+			m_input = {};
 
 			// Create a coloured skybox centred around the landscape.
 			m_skybox = Model::CreateBlock(200.0f, 200.0f, 200.0f, SKY_PALETTE_INDEX, ModelType::SkyBox);
@@ -741,24 +764,49 @@ void Augmentinel::Frame(float fElapsed)
 				return m.dissolved == 1.0f;
 				}), m_drawn_models.end());
 
-			// Run the Spectrum game if there are no active dissolve animations.
-			if (!PlayerAnimationActive())
-				m_spectrum->RunFrame(false);
-
 			static float total_elapsed = 0.0f;
+			static float unposted_elapsed = 0.0f;
 			total_elapsed += fElapsed;
+			unposted_elapsed += fElapsed;
 
-			// Run the Spectrum interrupt handler if it's due. This advances the Spectrum
-			// game timers used for various game events.
-			while (total_elapsed >= m_frame_time)
+			// Poll input every frame, as actions are only seen on the frame they're pressed.
+			// Any action is latched until the emulation thread can take it.
+			if (!PlayerAnimationActive())
+				PollInputAction(m_input);
+
+			// Hand the next game frame to the emulation thread once it has finished
+			// the last one. Rendering continues meanwhile, with events arriving later.
+			if (!m_emulation->Busy())
 			{
-				m_spectrum->RunInterrupt();
-				total_elapsed -= m_frame_time;
+				EmulationCommand command{ EmulationCommandType::RunGameFrame };
+				command.elapsed = unposted_elapsed;
+				unposted_elapsed = 0.0f;
+
+				// Run the Spectrum game if there are no active dissolve animations.
+				if (!PlayerAnimationActive())
+				{
+					command.run_frame = true;
+					command.sky_view = m_input.sky_view;
+					command.action = m_input.action;
+					command.yaw = m_input.yaw;
+					command.pitch = m_input.pitch;
+					m_input = {};
+				}
+
+				// Run the Spectrum interrupt handler if it's due. This advances the Spectrum
+				// game timers used for various game events.
+				while (total_elapsed >= m_frame_time)
+				{
+					command.frames++;
+					total_elapsed -= m_frame_time;
+				}
+
+				m_emulation->Post(std::move(command));
 			}
 
 			// Require the seen state to persist for a certain number of
 			// frames before we trust acting on it, with sound/vision.
-			auto seen_state = m_spectrum->GetPlayerSeenState();
+			auto seen_state = m_seen_state;
 			if (seen_state != SeenState::Unseen)
 			{
 				if (++m_seen_count > SEEN_FRAME_THRESHOLD)
@@ -821,10 +869,13 @@ void Augmentinel::Frame(float fElapsed)
 
 		case 1:
 		{
+			if (m_emulation->Busy())
+				break;
+
 			PlayTune(UTURN_TUNE);
 
 			// Extract player model with current facing direction, but clear any pitch.
-			m_player = m_spectrum->ExtractPlayerModel();
+			m_player = m_emulation->GetSpectrum().ExtractPlayerModel();
 			m_player.rot.x = 0.0f;
 
 			XMFLOAT3 ray_pos{}, ray_dir{};
@@ -887,14 +938,15 @@ void Augmentinel::Frame(float fElapsed)
 		{
 			// Fade to black in VR rather than disintegrate.
 			auto effect = m_pView->IsVR() ? ViewEffect::Fade : ViewEffect::Dissolve;
-			if (!m_pView->TransitionEffect(effect, 1.0f, fElapsed, 3.0f))
+			if (!m_pView->TransitionEffect(effect, 1.0f, fElapsed, 3.0f) || m_emulation->Busy())
 				break;
 
 			m_landscape = {};
 			m_skybox = {};
 
-			m_drawn_models = { m_spectrum->GetModel(1, true) };
-			m_player = m_spectrum->GetModel(2, true);
+			auto& spectrum = m_emulation->GetSpectrum();
+			m_drawn_models = { spectrum.GetModel(1, true) };
+			m_player = spectrum.GetModel(2, true);
 
 			m_pView->SetCameraPosition(m_player.pos);
 			m_pView->SetCameraRotation({ PitchToRadians(0xf4), 0.0f, 0.0f });
@@ -923,7 +975,8 @@ void Augmentinel::Frame(float fElapsed)
 		}
 
 		default:
-			m_spectrum->RunFrame();
+			if (!m_emulation->Busy())
+				m_emulation->Post({ EmulationCommandType::RunFrame });
 			break;
 		}
 
@@ -961,11 +1014,14 @@ void Augmentinel::Frame(float fElapsed)
 
 	case GameState::Complete:
 	{
+		if (m_emulation->Busy())
+			break;
+
 		// Get the new landscape number and its secret code.
 		uint32_t secret_code_bcd{};
-		m_spectrum->GetLandscapeAndCode(m_landscape_bcd, secret_code_bcd);
+		m_emulation->GetSpectrum().GetLandscapeAndCode(m_landscape_bcd, secret_code_bcd);
 
-		// Store them in the settings file as a future selectable landscape.
+		// Store them in the codes file as a future selectable landscape.
 		AddLandscapeCode(m_landscape_bcd, secret_code_bcd);
 
 		// Reset the game back to preview the new landscape.
@@ -984,7 +1040,7 @@ void Augmentinel::Frame(float fElapsed)
 		m_pView->GetUpDirection());
 }
 
-void Augmentinel::AddText(const std::string& str, float x_centre, float y, float z, int colour, bool reversed)
+void Augmentinel::AddText(const std::string& str, float x_centre, float y, float z, int colour, bool reversed, bool merged)
 {
 	constexpr auto spacing = 1.4f;
 	constexpr auto scale = 1.8f;
@@ -994,14 +1050,29 @@ void Augmentinel::AddText(const std::string& str, float x_centre, float y, float
 	auto x = x_centre - (x_sign * str_size / 2.0f);
 	auto yaw = reversed ? XM_PI : 0.0f;
 
-	for (auto ch : str)
+	// The game font has no zero, so use the letter O.
+	auto text = str;
+	std::replace(text.begin(), text.end(), '0', 'O');
+
+	if (merged)
 	{
-		if (ch != ' ')
+		// Single mesh for the whole string, with spacing in unscaled model units.
+		auto model = m_emulation->GetSpectrum().StringToModel(text, colour, spacing / scale);
+		if (model)
 		{
-			if (ch == '0')
-				ch = 'O';
+			model.pos = { x, y, z };
+			model.rot.y = yaw;
+			model.scale = scale;
+			m_text.push_back(std::move(model));
+		}
+		return;
+	}
 
-			auto model = m_spectrum->CharToModel(ch, colour);
+	for (auto ch : text)
+	{
+		if (ch != ' ')
+		{
+			auto model = m_emulation->GetSpectrum().CharToModel(ch, colour);
 			model.pos = { x, y, z };
 			model.rot.y = yaw;
 			model.scale = scale;
@@ -1043,23 +1114,22 @@ void Augmentinel::SetSeen(SeenState seen_state)
 
 void Augmentinel::LoadLandscapeCodes()
 {
-	m_codes.clear();
+	auto codes_path = LandscapeCodes::DefaultPath();
+	auto imported = fs::exists(codes_path);
+	m_codes.Load(codes_path);
 
-	// Add the secret code for landscape 0000.
-	m_codes[0x0000] = SPECTRUM_LANDSCAPE_0000_CODE;
+	// Bring across codes from the settings file written by earlier versions.
+	if (!imported)
+		m_codes.Import(LANDSCAPES_SECTION);
 
-	for (auto& landscape_key : GetSettingKeys(LANDSCAPES_SECTION))
-	{
-		auto landscape_bcd = std::stoul(landscape_key.c_str(), nullptr, 16);
-		auto secret_code_bcd = std::stoul(GetSetting(landscape_key, L"0", LANDSCAPES_SECTION), nullptr, 16);
-		m_codes[landscape_bcd] = secret_code_bcd;
-	}
+	// Add the secret code for landscape 0000.
+	m_codes.Add(0x0000, SPECTRUM_LANDSCAPE_0000_CODE);
 
 	auto last_landscape_bcd = GetSetting(LAST_LANDSCAPE_KEY, L"0");
 	m_landscape_bcd = std::stoul(last_landscape_bcd, nullptr, 16);
 
 	// If the last landscape isn't valid, use 0000.
-	if (m_codes.find(m_landscape_bcd) == m_codes.end())
+	if (m_codes.Find(m_landscape_bcd) == LandscapeCodes::npos)
 		m_landscape_bcd = 0;
 }
 
@@ -1073,25 +1143,12 @@ void Augmentinel::SaveLastLandscape(int landscape_bcd)
 
 void Augmentinel::AddLandscapeCode(int landscape_bcd, uint32_t secret_code_bcd)
 {
-	m_codes[landscape_bcd] = secret_code_bcd;
-
-	std::wstringstream ss_landscape;
-	ss_landscape << std::hex << std::uppercase << std::setw(4) << std::setfill(L'0') << landscape_bcd;
-
-	std::wstringstream ss_secret_code;
-	ss_secret_code << std::hex << std::setw(8) << std::setfill(L'0') << secret_code_bcd;
-
-	SetSetting(ss_landscape.str(), ss_secret_code.str(), LANDSCAPES_SECTION);
+	m_codes.Add(landscape_bcd, secret_code_bcd);
 }
 
 void Augmentinel::RemoveLandscapeCode(int landscape_bcd)
 {
-	m_codes.erase(landscape_bcd);
-
-	std::wstringstream ss_landscape;
-	ss_landscape << std::hex << std::uppercase << std::setw(4) << std::setfill(L'0') << landscape_bcd;
-
-	RemoveSetting(ss_landscape.str(), LANDSCAPES_SECTION);
+	m_codes.Remove(landscape_bcd);
 }
 
 bool Augmentinel::SceneRayTest(XMVECTOR vRayPos, XMVECTOR vRayDir, RayTarget& hit, int ignore_id)
@@ -1215,6 +1272,10 @@ bool Augmentinel::SceneModelVisible(const XMVECTOR vRayPos, const Model& model,
 
 bool Augmentinel::SceneTileVisible(const XMVECTOR vRayPos, int tile_x, int tile_z)
 {
+	// Only flat tiles can be targetted.
+	if (m_landscape.m_pLandscapeTiles->height_field.Shape(tile_x, tile_z) != 0)
+		return false;
+
 	auto world_corners = m_landscape.GetTileCorners(tile_x, tile_z);
 
 	XMFLOAT3 eye_pos{};
@@ -1225,8 +1286,8 @@ bool Augmentinel::SceneTileVisible(const XMVECTOR vRayPos, int tile_x, int tile_
 	{
 		XMStoreFloat3(&corner_pos[i], world_corners[i]);
 
-		// Reject non-flat tiles, and those at/above eye height.
-		if (corner_pos[i].y != corner_pos[0].y || corner_pos[i].y >= eye_pos.y)
+		// Reject tiles at/above eye height.
+		if (corner_pos[i].y >= eye_pos.y)
 			return false;
 	}
 
@@ -1304,31 +1365,79 @@ void Augmentinel::ChangeState(GameState new_state)
 	m_substate = 0;
 }
 
-bool Augmentinel::RunUntilStateChange()
+void Augmentinel::RunUntilStateChange(const char* failure_message)
 {
-	auto current_state = m_state;
-	auto frame_count = MAX_STATE_FRAMES;
+	m_emulation->Post({ EmulationCommandType::RunUntilStateChange, MAX_STATE_FRAMES });
+	m_state_change_error = failure_message;
 
-	while (m_state == current_state && frame_count-- > 0)
-		m_spectrum->RunFrame();
+	// Wait in the next substate for the state change event.
+	m_substate++;
+}
 
-	return frame_count > 0;
+void Augmentinel::ProcessEmulationEvents()
+{
+	EmulationEvent event;
+	while (m_emulation && m_emulation->PollEvent(event))
+	{
+		switch (event.type)
+		{
+		case EmulationEventType::TitleScreen:
+			OnTitleScreen();
+			break;
+		case EmulationEventType::LandscapeGenerated:
+			OnLandscapeGenerated();
+			break;
+		case EmulationEventType::NewPlayerView:
+			OnNewPlayerView();
+			break;
+		case EmulationEventType::PlayerDead:
+			OnPlayerDead();
+			break;
+		case EmulationEventType::SkyView:
+			ChangeState(GameState::SkyView);
+			break;
+		case EmulationEventType::GameModelChanged:
+			OnGameModelChanged(event.value, event.player_initiated, std::move(event.model));
+			break;
+		case EmulationEventType::TargetActionTile:
+		{
+			// The emulation thread is waiting for the answer.
+			EmulationCommand answer{ EmulationCommandType::TargetAnswer };
+			answer.target_valid = OnTargetActionTile(static_cast<InputAction>(event.value), answer.tile_x, answer.tile_z);
+			m_emulation->Post(std::move(answer));
+			break;
+		}
+		case EmulationEventType::PlayTune:
+			OnPlayTune(event.value, std::move(event.sound));
+			break;
+		case EmulationEventType::SoundEffect:
+			OnSoundEffect(event.value, event.param);
+			break;
+		case EmulationEventType::HideEnergyPanel:
+			OnHideEnergyPanel();
+			break;
+		case EmulationEventType::AddEnergySymbol:
+			OnAddEnergySymbol(std::move(event.model), event.param);
+			break;
+		case EmulationEventType::SeenState:
+			m_seen_state = event.seen_state;
+			break;
+		case EmulationEventType::Done:
+			break;
+		case EmulationEventType::Failed:
+			throw std::exception(m_state_change_error);
+		}
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// ISentinelEvents overrides.
+// Emulation event handlers.
 
 void Augmentinel::OnTitleScreen()
 {
 	ChangeState(GameState::TitleScreen);
 }
 
-void Augmentinel::OnLandscapeInput(int& landscape_bcd, uint32_t& secret_code_bcd)
-{
-	landscape_bcd = m_landscape_bcd;
-	secret_code_bcd = m_codes[landscape_bcd];
-}
-
 void Augmentinel::OnLandscapeGenerated()
 {
 	ChangeState(GameState::LandscapePreview);
@@ -1347,12 +1456,8 @@ void Augmentinel::OnPlayerDead()
 	m_music_playing = false;
 }
 
-void Augmentinel::OnInputAction(uint8_t& action)
+void Augmentinel::PollInputAction(EmulationCommand& command)
 {
-	// Return if any player animations are still active.
-	if (PlayerAnimationActive())
-		return;
-
 	XMFLOAT3 ray_dir{};
 	XMVECTOR vRayPos, vRayDir;
 	m_pView->GetSelectionRay(vRayPos, vRayDir);
@@ -1363,8 +1468,12 @@ void Augmentinel::OnInputAction(uint8_t& action)
 	auto ray_yaw = yaw_from_dir(ray_dir);
 
 	// Update player yaw and pitch in emulated game.
-	m_spectrum->SetPlayerYaw(ray_yaw);
-	m_spectrum->SetPlayerPitch(ray_pitch);
+	command.yaw = ray_yaw;
+	command.pitch = ray_pitch;
+
+	// Keep any action still waiting to be handed over.
+	if (command.sky_view || command.action >= 0)
+		return;
 
 	if (m_pView->InputAction(Action::Robot))
 	{
@@ -1375,22 +1484,22 @@ void Augmentinel::OnInputAction(uint8_t& action)
 			RayTarget hit;
 			if (!SceneRayTest(vRayPos, vRayDir, hit, m_player.id))
 			{
-				ChangeState(GameState::SkyView);
+				command.sky_view = true;
 				return;
 			}
 		}
 
-		action = 0x00;	// create robot
+		command.action = 0x00;	// create robot
 	}
 	else if (m_pView->InputAction(Action::Tree))
-		action = 0x02;	// create tree
+		command.action = 0x02;	// create tree
 	else if (m_pView->InputAction(Action::Boulder))
-		action = 0x03;	// create boulder
+		command.action = 0x03;	// create boulder
 	else if (m_pView->InputAction(Action::Absorb))
-		action = 0x20;	// absorb
+		command.action = 0x20;	// absorb
 	else if (m_pView->InputAction(Action::Transfer))
 	{
-		action = 0x21;	// transfer
+		command.action = 0x21;	// transfer
 
 		// Is the selection target pitched at a steep enough angle to consider?
 		if (XMConvertToDegrees(ray_pitch) < -HYPERSPACE_ANGLE)
@@ -1398,16 +1507,16 @@ void Augmentinel::OnInputAction(uint8_t& action)
 			// If nothing is targetted (i.e. sky) change the action to hyperspace.
 			RayTarget hit;
 			if (!SceneRayTest(vRayPos, vRayDir, hit, m_player.id))
-				action = 0x22;
+				command.action = 0x22;
 		}
 	}
 	else if (m_pView->InputAction(Action::Hyperspace))
-		action = 0x22;	// hyperspace
+		command.action = 0x22;	// hyperspace
 	else if (m_pView->InputAction(Action::U_Turn))
-		action = 0x23;	// u-turn
+		command.action = 0x23;	// u-turn
 }
 
-void Augmentinel::OnGameModelChanged(int id, bool player_initiated)
+void Augmentinel::OnGameModelChanged(int id, bool player_initiated, Model new_model)
 {
 	// Temporary ids used for destroyed or changed models.
 	static int fade_out_id = TEMP_ID_BASE;
@@ -1415,7 +1524,6 @@ void Augmentinel::OnGameModelChanged(int id, bool player_initiated)
 	if (m_state != GameState::Game)
 		return;
 
-	auto new_model = m_spectrum->GetModel(id);
 	auto existing_model = FindModelById(id);
 
 	// Model removed?
@@ -1580,33 +1688,31 @@ bool Augmentinel::OnTargetActionTile(InputAction action, int& tile_x, int& tile_
 		{
 		case ModelType::Landscape:
 		{
-			// Get the index of the triangle and it's map location.
-			auto vertex_index = hit.index;
-			auto tri_index = (vertex_index % ZX_VERTICES_PER_TILE) / 3;
-			vertex_index -= (vertex_index % ZX_VERTICES_PER_TILE);
-			m_spectrum->LandscapeVertexIndexToTile(static_cast<int>(vertex_index), tile_x, tile_z);
+			// Get the map location of the hit, and which tile triangle it was.
+			int tri_index{};
+			model->GetHitTile(hit, tile_x, tile_z, tri_index);
 
-			// Get the vertices of the triangle.
-			auto& vertices = *(model->m_pVertices);
-			auto& indices = *(model->m_pIndices);
+			// Get the vertices of the tile triangles.
+			auto& height_field = model->m_pLandscapeTiles->height_field;
+			auto tile_vertices = model->GetTileVertices(tile_x, tile_z);
 
-			auto& v1 = vertices[indices[vertex_index + 0]].pos;
-			auto& v2 = vertices[indices[vertex_index + 1]].pos;
-			auto& v3 = vertices[indices[vertex_index + 2]].pos;
+			auto& v1 = tile_vertices[0];
+			auto& v2 = tile_vertices[1];
+			auto& v3 = tile_vertices[2];
 
 			// If the tile isn't level, the player may have selected a neighbouring slope.
 			// Move the selection up the slope to help targetting distant tiles in VR.
 			if (v1.y != v2.y || v2.y != v3.y)
 			{
-				auto& v4 = vertices[indices[vertex_index + 3]].pos;
-				auto& v5 = vertices[indices[vertex_index + 4]].pos;
-				auto& v6 = vertices[indices[vertex_index + 5]].pos;
+				auto& v4 = tile_vertices[3];
+				auto& v5 = tile_vertices[4];
+				auto& v6 = tile_vertices[5];
 
 				float dx = 0.0f, dz = 0.0f;
 				auto [dx0, dz0] = LandscapeSlopeUpOffset(v1, v2, v3);
 				auto [dx1, dz1] = LandscapeSlopeUpOffset(v4, v5, v6);
 
-				switch (m_spectrum->GetTileShape(tile_x, tile_z))
+				switch (height_field.Shape(tile_x, tile_z))
 				{
 				case 0b0000:	// flat
 				case 0b1000:	// unused
@@ -1647,7 +1753,7 @@ bool Augmentinel::OnTargetActionTile(InputAction action, int& tile_x, int& tile_
 			}
 
 			// Calculate the map location of the hit.
-			if (m_spectrum->GetTileShape(tile_x, tile_z) != 0)
+			if (height_field.Shape(tile_x, tile_z) != 0)
 				return false;
 
 			// Reject the player tile so we can't absorb ourself!
@@ -1740,7 +1846,7 @@ void Augmentinel::OnHideEnergyPanel()
 	m_icons.clear();
 }
 
-void Augmentinel::OnAddEnergySymbol(int symbol_idx, int x_offset)
+void Augmentinel::OnAddEnergySymbol(Model icon, int x_offset)
 {
 	static constexpr auto x_base = -10.0f;
 	static constexpr auto y = 970.0f;
@@ -1752,27 +1858,9 @@ void Augmentinel::OnAddEnergySymbol(int symbol_idx, int x_offset)
 	if (x_offset == 0)
 		m_icons.clear();
 
-	auto colour_idx = -1;
-	switch (symbol_idx)
+	// Only symbols with a known colour have an icon.
+	if (icon)
 	{
-	case 1:					// robot
-		colour_idx = 12;	// light blue
-		break;
-	case 2:					// tree
-		colour_idx = 5;		// green
-		break;
-	case 4:					// boulder
-		colour_idx = 11;	// cyan
-		break;
-	case 6:					// golden robot
-		colour_idx = 9;		// yellow
-		break;
-	}
-
-	if (colour_idx >= 0)
-	{
-		auto icon = m_spectrum->IconToModel(symbol_idx, colour_idx);
-
 		if (!m_pView->IsVR())
 		{
 			icon.pos = { x_base + spacing * x_offset, y, z };
@@ -1785,7 +1873,7 @@ void Augmentinel::OnAddEnergySymbol(int symbol_idx, int x_offset)
 	}
 }
 
-void Augmentinel::OnPlayTune(int tune_number)
+void Augmentinel::OnPlayTune(int tune_number, std::shared_ptr<const SoundData> original)
 {
 	bool blank_view = false;
 
@@ -1796,25 +1884,28 @@ void Augmentinel::OnPlayTune(int tune_number)
 	switch (tune_number)
 	{
 	case 0x00:	// Hyperspace
-		PlayTune(HYPERSPACE_TUNE);
+		PlayTune(HYPERSPACE_TUNE, original);
 		blank_view = true;
 		m_music_playing = !m_tunes_enabled;
 		break;
 	case 0x19:	// Robot transfer
-		PlayTune(TRANSFER_TUNE);
+		PlayTune(TRANSFER_TUNE, original);
 		blank_view = true;
 		break;
 	case 0x20:	// U-turn
-		PlayTune(UTURN_TUNE);
+		PlayTune(UTURN_TUNE, original);
 		blank_view = true;
 		break;
 	case 0x32:	// Game Over
 		ChangeState(GameState::ShowKiller);
-		m_pAudio->Play(GAMEOVER_TUNE, AudioType::Tune);	// always played
+		if (original)
+			m_pAudio->Play(original, AudioType::Tune);	// always played
+		else
+			m_pAudio->Play(GAMEOVER_TUNE, AudioType::Tune);
 		break;
-	case 0x42:	// Landscape complete
+	case SENTINEL_COMPLETE_TUNE:
 		ChangeState(GameState::Complete);
-		PlayTune(COMPLETE_TUNE);
+		PlayTune(COMPLETE_TUNE, original);
 		break;
 	default:
 		DebugBreak();
@@ -1904,10 +1995,7 @@ static INT_PTR CALLBACK OptionsDialogProc(HWND hdlg, UINT uMsg, WPARAM wParam, L
 		hwndMusicEnabled = GetDlgItem(hdlg, IDC_MUSIC_ENABLED);
 		hwndMusicVolume = GetDlgItem(hdlg, IDC_MUSIC_VOLUME);
 
-		auto hdll = LoadLibrary(X3D_HRTF_HOOK_DLL);
-		if (hdll)
-			FreeLibrary(hdll);
-		else
+		if (!fs::exists(FindFile(HRTF_DATA_FILE)))
 			EnableWindow(hwndHrtfEnabled, FALSE);
 
 		AddToolTip(hwndSeatedVR, L"Centre player on seated position facing keyboard/monitor.");
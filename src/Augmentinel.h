@@ -1,19 +1,22 @@
 #pragma once
 #include "Game.h"
-#include "Spectrum.h"
+#include "Emulation.h"
+#include "Journal.h"
 #include "Animate.h"
+#include "LandscapeCodes.h"
 
 enum class GameState
 {
 	Unknown, Reset, TitleScreen, LandscapePreview, Game, SkyView, PlayerDead, ShowKiller, Complete
 };
 
-class Augmentinel : public Game, public IModelSource, public ISentinelEvents
+class Augmentinel : public Game, public IModelSource
 {
 public:
 	Augmentinel(
 		std::shared_ptr<View>& pView,
-		std::shared_ptr<Audio>& pAudio);
+		std::shared_ptr<Audio>& pAudio,
+		const std::wstring& journal_file = L"");
 
 	void Render(IScene* pScene) final override;
 	void Frame(float elapsed_seconds) final override;
@@ -21,7 +24,7 @@ public:
 	static void Options(HINSTANCE hinst, HWND hwndParent);
 
 protected:
-	void PlayTune(const std::wstring& filename);
+	void PlayTune(const std::wstring& filename, std::shared_ptr<const SoundData> original = nullptr);
 	void PlayMusic();
 
 	bool SceneRayTest(XMVECTOR vRayPos, XMVECTOR vRayDir, RayTarget& hit, int ignore_id = -1);
@@ -29,10 +32,12 @@ protected:
 	bool SceneTileVisible(XMVECTOR vRayPos, int tile_x, int tile_z);
 
 	void ChangeState(GameState new_state);
-	bool RunUntilStateChange();
+	void RunUntilStateChange(const char* failure_message);
+	void ProcessEmulationEvents();
+	void PollInputAction(EmulationCommand& command);
 
 	std::vector<Model> GetModelStack(int tile_x, int tile_z);
-	void AddText(const std::string& str, float x_centre, float y, float z, int colour = 1, bool reversed = false);
+	void AddText(const std::string& str, float x_centre, float y, float z, int colour = 1, bool reversed = false, bool merged = true);
 	bool PlayerAnimationActive() const;
 	void SetSeen(SeenState seen_state);
 
@@ -44,19 +49,17 @@ protected:
 	// IModelSource implementation.
 	Model* FindModelById(int id) final override;
 
-	// ISentinelEvents implementation.
-	void OnTitleScreen() final override;
-	void OnLandscapeInput(int& landscape_bcd, uint32_t& secret_code_bcd) final override;
-	void OnLandscapeGenerated() final override;
-	void OnNewPlayerView() final override;
-	void OnPlayerDead() final override;
-	void OnInputAction(uint8_t& action) final override;
-	void OnGameModelChanged(int id, bool player_initiated) final override;
-	bool OnTargetActionTile(InputAction action, int& tile_x, int& tile_z) final override;
-	void OnPlayTune(int n) final override;
-	void OnSoundEffect(int n, int idx) final override;
-	void OnHideEnergyPanel() final override;
-	void OnAddEnergySymbol(int symbol_idx, int x_offset) final override;
+	// Emulation event handlers.
+	void OnTitleScreen();
+	void OnLandscapeGenerated();
+	void OnNewPlayerView();
+	void OnPlayerDead();
+	void OnGameModelChanged(int id, bool player_initiated, Model new_model);
+	bool OnTargetActionTile(InputAction action, int& tile_x, int& tile_z);
+	void OnPlayTune(int n, std::shared_ptr<const SoundData> original);
+	void OnSoundEffect(int n, int idx);
+	void OnHideEnergyPanel();
+	void OnAddEnergySymbol(Model icon, int x_offset);
 
 	std::shared_ptr<View> m_pView;
 	std::shared_ptr<Audio> m_pAudio;
@@ -72,9 +75,11 @@ protected:
 	std::vector<Model> m_icons;
 	std::vector<Animation> m_animations;
 
+	SeenState m_seen_state{ SeenState::Unseen };
 	int m_seen_count{ 0 };
 	bool m_seen_sound{ false };
 	float m_frame_time{ 0.0f };
+	EmulationCommand m_input{};	// input latched until the next game frame is posted.
 
 	GameState m_state{ GameState::Unknown };
 	int m_substate{ 0 };
@@ -87,6 +92,8 @@ protected:
 	int m_music_volume{ 100 };
 
 	int m_landscape_bcd{ 0 };
-	std::map<int, uint32_t> m_codes;
-	std::unique_ptr<Spectrum> m_spectrum;
+	LandscapeCodes m_codes;
+	std::unique_ptr<Emulation> m_emulation;
+	std::shared_ptr<Journal> m_pJournal;
+	const char* m_state_change_error{ nullptr };
 };
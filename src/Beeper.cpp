@@ -0,0 +1,95 @@
+#include "stdafx.h"
+#include "Beeper.h"
+
+Beeper::Beeper(int cpu_rate, int sample_rate)
+	: m_cpu_rate(cpu_rate), m_sample_rate(sample_rate)
+{
+	// Blackman windowed sinc impulses, one row per sub-sample offset, each summing to
+	// one so the integrated steps land exactly on the new level.
+	auto half_taps = BEEPER_BLEP_TAPS / 2;
+	auto cutoff = 0.45;	// cycles per sample, just below Nyquist.
+
+	m_impulses.resize((BEEPER_BLEP_PHASES + 1) * BEEPER_BLEP_TAPS);
+	for (int p = 0; p <= BEEPER_BLEP_PHASES; ++p)
+	{
+		auto row = &m_impulses[p * BEEPER_BLEP_TAPS];
+		auto frac = static_cast<double>(p) / BEEPER_BLEP_PHASES;
+
+		double sum = 0.0;
+		for (int k = 0; k < BEEPER_BLEP_TAPS; ++k)
+		{
+			auto t = k - half_taps - frac + 1;
+			auto x = 2.0 * cutoff * t;
+			auto sinc = (x == 0.0) ? 1.0 : std::sin(XM_PI * x) / (XM_PI * x);
+
+			auto w = (t + half_taps) / BEEPER_BLEP_TAPS;
+			auto window = (w > 0.0 && w < 1.0) ? 0.42 - 0.5 * std::cos(XM_2PI * w) + 0.08 * std::cos(2 * XM_2PI * w) : 0.0;
+
+			row[k] = static_cast<float>(sinc * window);
+			sum += row[k];
+		}
+
+		for (int k = 0; k < BEEPER_BLEP_TAPS; ++k)
+			row[k] = static_cast<float>(row[k] / sum);
+	}
+}
+
+void Beeper::Start(bool level)
+{
+	m_start_level = m_level = level;
+	m_edges.clear();
+}
+
+void Beeper::Write(uint64_t cycle, bool level)
+{
+	if (level != m_level)
+	{
+		m_edges.push_back(cycle);
+		m_level = level;
+	}
+}
+
+std::shared_ptr<SoundData> Beeper::Render(uint64_t end_cycle) const
+{
+	auto sound = std::make_shared<SoundData>();
+	sound->channels = 1;
+	sound->sample_rate = m_sample_rate;
+
+	auto frames = static_cast<size_t>(end_cycle * m_sample_rate / m_cpu_rate) + BEEPER_BLEP_TAPS;
+	std::vector<float> deltas(frames + 1);
+
+	// Each edge adds a band-limited impulse of the level change, centred on its
+	// exact time. The output is delayed by half the impulse length.
+	auto level = m_start_level;
+	for (auto cycle : m_edges)
+	{
+		level = !level;
+		auto delta = level ? BEEPER_VOLUME : -BEEPER_VOLUME;
+
+		auto pos = static_cast<double>(cycle) * m_sample_rate / m_cpu_rate;
+		auto frame = static_cast<size_t>(pos);
+		auto phase = static_cast<int>((pos - frame) * BEEPER_BLEP_PHASES + 0.5);
+		auto row = &m_impulses[phase * BEEPER_BLEP_TAPS];
+
+		if (frame + BEEPER_BLEP_TAPS > frames)
+			break;
+
+		for (int k = 0; k < BEEPER_BLEP_TAPS; ++k)
+			deltas[frame + k] += delta * row[k];
+	}
+
+	// Integrate the impulses into steps, then block DC as the speaker circuit does.
+	sound->samples.resize(frames);
+	auto x = m_start_level ? BEEPER_VOLUME / 2 : -BEEPER_VOLUME / 2;
+	auto prev_x = x;
+	auto y = 0.0f;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		x += deltas[i];
+		y = x - prev_x + BEEPER_DC_BLOCK * y;
+		prev_x = x;
+		sound->samples[i] = y;
+	}
+
+	return sound;
+}
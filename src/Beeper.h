@@ -0,0 +1,31 @@
+#pragma once
+#include "SoundData.h"
+
+static constexpr int BEEPER_SAMPLE_RATE = 44100;
+static constexpr int BEEPER_BLEP_PHASES = 64;		// sub-sample edge positions.
+static constexpr int BEEPER_BLEP_TAPS = 16;			// band-limited impulse length, in samples.
+static constexpr float BEEPER_VOLUME = 0.5f;		// peak to peak.
+static constexpr float BEEPER_DC_BLOCK = 0.995f;	// speaker coupling high-pass, about 35Hz.
+
+// Spectrum speaker level changes, timed in CPU cycles, rendered as a band-limited
+// waveform with a band-limited step (BLEP) at each edge, so fast toggling doesn't alias.
+class Beeper
+{
+public:
+	Beeper(int cpu_rate, int sample_rate = BEEPER_SAMPLE_RATE);
+
+	void Start(bool level = false);
+	void Write(uint64_t cycle, bool level);
+	bool Empty() const { return m_edges.empty(); }
+
+	// Renders from the start to the given cycle, plus the filter tail.
+	std::shared_ptr<SoundData> Render(uint64_t end_cycle) const;
+
+protected:
+	int m_cpu_rate{ 0 };
+	int m_sample_rate{ 0 };
+	bool m_start_level{ false };
+	bool m_level{ false };
+	std::vector<uint64_t> m_edges;		// cycle of each level change since Start().
+	std::vector<float> m_impulses;		// BEEPER_BLEP_PHASES + 1 rows of BEEPER_BLEP_TAPS.
+};
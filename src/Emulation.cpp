@@ -0,0 +1,290 @@
+#include "stdafx.h"
+#include "Emulation.h"
+#include "Journal.h"
+
+Emulation::Emulation(
+	const std::wstring& snapshot_file,
+	int landscape_bcd,
+	uint32_t secret_code_bcd,
+	std::shared_ptr<Journal> pJournal,
+	bool threaded,
+	bool display_patches)
+	: m_pJournal(pJournal), m_threaded(threaded), m_landscape_bcd(landscape_bcd), m_secret_code_bcd(secret_code_bcd)
+{
+	// Load the snapshot here so any errors are reported on the main thread.
+	m_spectrum = std::make_unique<Spectrum>(snapshot_file, this, display_patches);
+
+	if (m_pJournal)
+		m_pJournal->WriteStart(landscape_bcd, secret_code_bcd, m_spectrum->MemoryHash());
+
+	if (m_threaded)
+		m_thread = std::thread(&Emulation::ThreadProc, this);
+}
+
+Emulation::~Emulation()
+{
+	m_quit = true;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_cv.notify_one();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void Emulation::Post(EmulationCommand&& command)
+{
+	// Target answers are replies to a command that's already running.
+	if (command.type != EmulationCommandType::TargetAnswer)
+		m_busy = true;
+
+	while (!m_commands.Push(std::move(command)))
+		std::this_thread::yield();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_cv.notify_one();
+}
+
+bool Emulation::PollEvent(EmulationEvent& event)
+{
+	if (!m_events.Pop(event))
+		return false;
+
+	if (event.type == EmulationEventType::Done || event.type == EmulationEventType::Failed)
+		m_busy = false;
+
+	return true;
+}
+
+bool Emulation::Run(const EmulationCommand& command)
+{
+	assert(!m_threaded);
+	return RunCommand(command);
+}
+
+Spectrum& Emulation::GetSpectrum()
+{
+	// Spectrum state is only safe to read while the emulation thread is idle.
+	assert(!m_busy);
+	return *m_spectrum;
+}
+
+void Emulation::ThreadProc()
+{
+	EmulationCommand command;
+	while (WaitCommand(command))
+		RunCommand(command);
+}
+
+bool Emulation::RunCommand(const EmulationCommand& command)
+{
+	m_command = command;
+
+	if (m_pJournal)
+		m_pJournal->WriteCommand(command);
+
+	switch (command.type)
+	{
+	case EmulationCommandType::RunUntilStateChange:
+	{
+		m_state_changed = false;
+
+		for (auto frame = 0; frame < command.frames && !m_state_changed; ++frame)
+		{
+			if (m_quit)
+				return false;
+
+			m_spectrum->RunFrame();
+			m_frames++;
+		}
+
+		if (!m_state_changed)
+		{
+			PostEvent({ EmulationEventType::Failed });
+			return false;
+		}
+		break;
+	}
+
+	case EmulationCommandType::RunFrame:
+		m_spectrum->RunFrame();
+		m_frames++;
+		break;
+
+	case EmulationCommandType::RunGameFrame:
+	{
+		if (command.run_frame)
+			m_spectrum->RunFrame(false);
+
+		for (auto i = 0; i < command.frames; ++i)
+			m_spectrum->RunInterrupt();
+
+		m_frames += command.frames;
+
+		EmulationEvent event{ EmulationEventType::SeenState };
+		event.seen_state = m_spectrum->GetPlayerSeenState();
+		PostEvent(std::move(event));
+		break;
+	}
+
+	case EmulationCommandType::TargetAnswer:
+		// Late answer to an abandoned request.
+		break;
+	}
+
+	// The replay checks the game reached the same state after each command.
+	if (m_pJournal && !m_quit)
+		m_pJournal->WriteHash(m_spectrum->MemoryHash());
+
+	PostEvent({ EmulationEventType::Done });
+	return true;
+}
+
+bool Emulation::WaitCommand(EmulationCommand& command)
+{
+	// Without a thread any answers must already be queued.
+	if (!m_threaded)
+		return m_commands.Pop(command);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait(lock, [&] { return m_quit || !m_commands.Empty(); });
+
+	return !m_quit && m_commands.Pop(command);
+}
+
+void Emulation::PostEvent(EmulationEvent&& event)
+{
+	// Wait for the main thread to make space if the ring is full.
+	// Without a thread nothing can drain it, so the event is dropped.
+	while (!m_events.Push(std::move(event)) && !m_quit && m_threaded)
+		std::this_thread::yield();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ISentinelEvents overrides.
+
+void Emulation::OnTitleScreen()
+{
+	m_state_changed = true;
+	PostEvent({ EmulationEventType::TitleScreen });
+}
+
+void Emulation::OnLandscapeInput(int& landscape_bcd, uint32_t& secret_code_bcd)
+{
+	landscape_bcd = m_landscape_bcd;
+	secret_code_bcd = m_secret_code_bcd;
+}
+
+void Emulation::OnLandscapeGenerated()
+{
+	m_state_changed = true;
+	PostEvent({ EmulationEventType::LandscapeGenerated });
+}
+
+void Emulation::OnNewPlayerView()
+{
+	m_state_changed = true;
+	PostEvent({ EmulationEventType::NewPlayerView });
+}
+
+void Emulation::OnPlayerDead()
+{
+	m_state_changed = true;
+	PostEvent({ EmulationEventType::PlayerDead });
+}
+
+void Emulation::OnInputAction(uint8_t& action)
+{
+	// Input is only supplied with game frames that run the game code.
+	if (m_command.type != EmulationCommandType::RunGameFrame || !m_command.run_frame)
+		return;
+
+	m_spectrum->SetPlayerYaw(m_command.yaw);
+	m_spectrum->SetPlayerPitch(m_command.pitch);
+
+	if (m_command.sky_view)
+		PostEvent({ EmulationEventType::SkyView });
+	else if (m_command.action >= 0)
+		action = static_cast<uint8_t>(m_command.action);
+
+	// Each action is only delivered once.
+	m_command.sky_view = false;
+	m_command.action = -1;
+}
+
+void Emulation::OnGameModelChanged(int id, bool player_initiated)
+{
+	EmulationEvent event{ EmulationEventType::GameModelChanged, id };
+	event.player_initiated = player_initiated;
+	event.model = m_spectrum->GetModel(id);
+	PostEvent(std::move(event));
+}
+
+bool Emulation::OnTargetActionTile(InputAction action, int& tile_x, int& tile_z)
+{
+	// The scene belongs to the main thread, so wait for it to check the target.
+	PostEvent({ EmulationEventType::TargetActionTile, static_cast<int>(action) });
+
+	EmulationCommand answer;
+	while (WaitCommand(answer))
+	{
+		if (answer.type == EmulationCommandType::TargetAnswer)
+		{
+			if (m_pJournal)
+				m_pJournal->WriteCommand(answer, JournalRecordType::TargetAnswer);
+
+			tile_x = answer.tile_x;
+			tile_z = answer.tile_z;
+			return answer.target_valid;
+		}
+	}
+
+	return false;
+}
+
+void Emulation::OnPlayTune(int n)
+{
+	EmulationEvent event{ EmulationEventType::PlayTune, n };
+	event.sound = m_spectrum->GetTuneSound();
+	PostEvent(std::move(event));
+}
+
+void Emulation::OnSoundEffect(int n, int idx)
+{
+	PostEvent({ EmulationEventType::SoundEffect, n, idx });
+}
+
+void Emulation::OnHideEnergyPanel()
+{
+	PostEvent({ EmulationEventType::HideEnergyPanel });
+}
+
+void Emulation::OnAddEnergySymbol(int symbol_idx, int x_offset)
+{
+	auto colour_idx = -1;
+	switch (symbol_idx)
+	{
+	case 1:					// robot
+		colour_idx = 12;	// light blue
+		break;
+	case 2:					// tree
+		colour_idx = 5;		// green
+		break;
+	case 4:					// boulder
+		colour_idx = 11;	// cyan
+		break;
+	case 6:					// golden robot
+		colour_idx = 9;		// yellow
+		break;
+	}
+
+	EmulationEvent event{ EmulationEventType::AddEnergySymbol, symbol_idx, x_offset };
+	if (colour_idx >= 0)
+		event.model = m_spectrum->IconToModel(symbol_idx, colour_idx);
+
+	PostEvent(std::move(event));
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "Spectrum.h"
+#include "SpscRing.h"
+
+class Journal;
+
+enum class EmulationEventType
+{
+	TitleScreen, LandscapeGenerated, NewPlayerView, PlayerDead, SkyView,
+	GameModelChanged, TargetActionTile, PlayTune, SoundEffect,
+	HideEnergyPanel, AddEnergySymbol, SeenState, Done, Failed
+};
+
+// Game hook event raised on the emulation thread, for handling on the main thread.
+struct EmulationEvent
+{
+	EmulationEventType type{};
+	int value{};				// model id, tune/effect/symbol number, or target action.
+	int param{};				// sound source id, or energy symbol x offset.
+	bool player_initiated{};
+	SeenState seen_state{};
+	Model model;				// changed game model, or energy symbol icon.
+	std::shared_ptr<const SoundData> sound;	// original Spectrum tune, if captured.
+};
+
+enum class EmulationCommandType
+{
+	RunUntilStateChange, RunFrame, RunGameFrame, TargetAnswer
+};
+
+// Request from the main thread, including player input for a game frame.
+struct EmulationCommand
+{
+	EmulationCommandType type{};
+	int frames{};				// max frames before state change, or interrupts to run.
+	float elapsed{};			// real time since the previous game frame.
+	bool run_frame{};			// run the game code before any interrupts.
+	bool sky_view{};
+	int action{ -1 };
+	float yaw{}, pitch{};
+	bool target_valid{};
+	int tile_x{}, tile_z{};
+};
+
+// Runs the Spectrum on its own thread so emulation never stalls rendering.
+// Without a thread, commands are run on the caller thread using Run().
+class Emulation : public ISentinelEvents
+{
+public:
+	Emulation(
+		const std::wstring& snapshot_file,
+		int landscape_bcd,
+		uint32_t secret_code_bcd,
+		std::shared_ptr<Journal> pJournal = nullptr,
+		bool threaded = true,
+		bool display_patches = true);
+	~Emulation();
+
+	void Post(EmulationCommand&& command);
+	bool PollEvent(EmulationEvent& event);
+	bool Busy() const { return m_busy; }
+	bool Run(const EmulationCommand& command);
+	Spectrum& GetSpectrum();
+	uint64_t FrameCount() const { return m_frames; }
+
+protected:
+	void ThreadProc();
+	bool RunCommand(const EmulationCommand& command);
+	bool WaitCommand(EmulationCommand& command);
+	void PostEvent(EmulationEvent&& event);
+
+	// ISentinelEvents implementation, called on the emulation thread.
+	void OnTitleScreen() final override;
+	void OnLandscapeInput(int& landscape_bcd, uint32_t& secret_code_bcd) final override;
+	void OnLandscapeGenerated() final override;
+	void OnNewPlayerView() final override;
+	void OnPlayerDead() final override;
+	void OnInputAction(uint8_t& action) final override;
+	void OnGameModelChanged(int id, bool player_initiated) final override;
+	bool OnTargetActionTile(InputAction action, int& tile_x, int& tile_z) final override;
+	void OnPlayTune(int n) final override;
+	void OnSoundEffect(int n, int idx) final override;
+	void OnHideEnergyPanel() final override;
+	void OnAddEnergySymbol(int symbol_idx, int x_offset) final override;
+
+	std::unique_ptr<Spectrum> m_spectrum;
+	std::shared_ptr<Journal> m_pJournal;
+	bool m_threaded{ true };
+	int m_landscape_bcd{ 0 };
+	uint32_t m_secret_code_bcd{ 0 };
+
+	SpscRing<EmulationCommand, 16> m_commands;
+	SpscRing<EmulationEvent, 256> m_events;
+
+	// Only used to wake the emulation thread when a command is posted.
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+
+	std::atomic<bool> m_quit{ false };
+	bool m_busy{ false };			// main thread only.
+	bool m_state_changed{ false };	// emulation thread only.
+	EmulationCommand m_command;		// emulation thread only.
+	uint64_t m_frames{ 0 };			// emulation thread only.
+
+	std::thread m_thread;
+};
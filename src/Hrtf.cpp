@@ -0,0 +1,367 @@
+#include "stdafx.h"
+#include "Hrtf.h"
+#include "MappedFile.h"
+
+static constexpr auto HRTF_MAGIC = "MinPHR01";
+
+// Twiddle factors and bit reversal order for the FFT size.
+struct FftTables
+{
+	FftTables()
+	{
+		auto bits = 0;
+		while ((1 << bits) < HRTF_FFT_SIZE)
+			++bits;
+
+		for (int i = 0; i < HRTF_FFT_SIZE; ++i)
+		{
+			int r = 0;
+			for (int b = 0; b < bits; ++b)
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+			bitrev[i] = static_cast<uint16_t>(r);
+		}
+
+		// Each stage of half size h uses entries h to 2h-1, so each stage is 16-byte aligned from h=4.
+		for (int h = 1; h < HRTF_FFT_SIZE; h *= 2)
+		{
+			for (int j = 0; j < h; ++j)
+			{
+				auto angle = -XM_PI * j / h;
+				tw_re[h + j] = std::cos(angle);
+				tw_im[h + j] = std::sin(angle);
+			}
+		}
+	}
+
+	std::array<uint16_t, HRTF_FFT_SIZE> bitrev{};
+	alignas(16) std::array<float, HRTF_FFT_SIZE> tw_re{};
+	alignas(16) std::array<float, HRTF_FFT_SIZE> tw_im{};
+};
+
+// In-place radix-2 complex FFT, with later stages done 4 butterflies at a time.
+static void Fft(float* re, float* im)
+{
+	static const FftTables tables;
+
+	for (int i = 0; i < HRTF_FFT_SIZE; ++i)
+	{
+		auto j = tables.bitrev[i];
+		if (i < j)
+		{
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+
+	for (int h = 1; h < HRTF_FFT_SIZE; h *= 2)
+	{
+		auto wr = tables.tw_re.data() + h;
+		auto wi = tables.tw_im.data() + h;
+
+		for (int k = 0; k < HRTF_FFT_SIZE; k += 2 * h)
+		{
+			auto ar = re + k, ai = im + k;
+			auto br = ar + h, bi = ai + h;
+
+			if (h >= 4)
+			{
+				for (int j = 0; j < h; j += 4)
+				{
+					auto xar = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(ar + j));
+					auto xai = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(ai + j));
+					auto xbr = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(br + j));
+					auto xbi = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(bi + j));
+					auto xwr = XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(wr + j));
+					auto xwi = XMLoadFloat4A(reinterpret_cast<const XMFLOAT4A*>(wi + j));
+
+					auto tr = XMVectorNegativeMultiplySubtract(xbi, xwi, XMVectorMultiply(xbr, xwr));
+					auto ti = XMVectorMultiplyAdd(xbi, xwr, XMVectorMultiply(xbr, xwi));
+
+					XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(br + j), XMVectorSubtract(xar, tr));
+					XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(bi + j), XMVectorSubtract(xai, ti));
+					XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(ar + j), XMVectorAdd(xar, tr));
+					XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(ai + j), XMVectorAdd(xai, ti));
+				}
+			}
+			else
+			{
+				for (int j = 0; j < h; ++j)
+				{
+					auto tr = br[j] * wr[j] - bi[j] * wi[j];
+					auto ti = br[j] * wi[j] + bi[j] * wr[j];
+					br[j] = ar[j] - tr;
+					bi[j] = ai[j] - ti;
+					ar[j] += tr;
+					ai[j] += ti;
+				}
+			}
+		}
+	}
+}
+
+// Unscaled inverse FFT, by swapping real and imaginary parts around the forward FFT.
+static void InverseFft(float* re, float* im)
+{
+	Fft(im, re);
+}
+
+// Accumulates the product of complex spectra x and h into y.
+static void ComplexMultiplyAdd(const float* xr, const float* xi, const float* hr, const float* hi, float* yr, float* yi)
+{
+	for (int i = 0; i < HRTF_FFT_SIZE; i += 4)
+	{
+		auto vxr = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(xr + i));
+		auto vxi = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(xi + i));
+		auto vhr = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(hr + i));
+		auto vhi = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(hi + i));
+		auto vyr = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(yr + i));
+		auto vyi = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(yi + i));
+
+		vyr = XMVectorNegativeMultiplySubtract(vxi, vhi, XMVectorMultiplyAdd(vxr, vhr, vyr));
+		vyi = XMVectorMultiplyAdd(vxi, vhr, XMVectorMultiplyAdd(vxr, vhi, vyi));
+
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(yr + i), vyr);
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(yi + i), vyi);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Layout: magic, 32-bit rate, IR size, elevation count, azimuth count per elevation,
+// then 16-bit coefficients for every IR, and finally a delay in samples for each.
+Hrtf::Hrtf(const fs::path& path)
+{
+	MappedFile file(FindFile(path));
+	size_t offset = 0;
+
+	auto need = [&](size_t bytes)
+	{
+		if (file.size() - offset < bytes)
+			throw std::runtime_error("Invalid HRTF data: " + to_string(path));
+	};
+
+	need(14);
+	if (std::memcmp(file.data(), HRTF_MAGIC, 8))
+		throw std::runtime_error("Unsupported HRTF data: " + to_string(path));
+
+	m_sample_rate = file[8] | (file[9] << 8) | (file[10] << 16) | (file[11] << 24);
+	m_ir_size = file[12];
+	auto num_elevations = file[13];
+	offset = 14;
+
+	need(num_elevations);
+	int num_irs = 0;
+	for (int i = 0; i < num_elevations; ++i)
+	{
+		m_offsets.push_back(num_irs);
+		m_azimuths.push_back(file[offset++]);
+		num_irs += m_azimuths.back();
+
+		if (!m_azimuths.back())
+			throw std::runtime_error("Invalid HRTF data: " + to_string(path));
+	}
+
+	if (num_elevations < 2 || !m_ir_size)
+		throw std::runtime_error("Invalid HRTF data: " + to_string(path));
+
+	need(static_cast<size_t>(num_irs) * m_ir_size * 2 + num_irs);
+	m_coeffs.resize(static_cast<size_t>(num_irs) * m_ir_size);
+	for (auto& coeff : m_coeffs)
+	{
+		coeff = static_cast<int16_t>(file[offset] | (file[offset + 1] << 8)) / 32768.0f;
+		offset += 2;
+	}
+
+	m_delays.assign(file.begin() + offset, file.begin() + offset + num_irs);
+
+	// Enough partitions for the longest response, including its delay.
+	auto max_delay = *std::max_element(m_delays.begin(), m_delays.end());
+	m_partitions = (m_ir_size + max_delay + HRTF_BLOCK_FRAMES - 1) / HRTF_BLOCK_FRAMES;
+	if (m_partitions > HRTF_MAX_PARTITIONS)
+		throw std::runtime_error("HRTF responses too long: " + to_string(path));
+}
+
+// Left ear response, interpolated between the 4 nearest measurements.
+void Hrtf::Response(float azimuth, float elevation, float* ir, float& delay) const
+{
+	std::fill(ir, ir + m_ir_size, 0.0f);
+	delay = 0.0f;
+
+	auto num_elevations = static_cast<int>(m_azimuths.size());
+	auto ev = (elevation + XM_PIDIV2) / XM_PI * (num_elevations - 1);
+	ev = std::max(std::min(ev, static_cast<float>(num_elevations - 1)), 0.0f);
+
+	auto ev0 = static_cast<int>(ev);
+	auto ev1 = std::min(ev0 + 1, num_elevations - 1);
+	auto ev_frac = ev - ev0;
+
+	auto az = std::fmod(azimuth, XM_2PI);
+	if (az < 0.0f)
+		az += XM_2PI;
+
+	for (auto& [e, e_weight] : { std::make_pair(ev0, 1.0f - ev_frac), std::make_pair(ev1, ev_frac) })
+	{
+		auto count = m_azimuths[e];
+		auto a = az / XM_2PI * count;
+		auto a0 = static_cast<int>(a) % count;
+		auto a1 = (a0 + 1) % count;
+		auto a_frac = a - std::floor(a);
+
+		for (auto& [index, a_weight] : { std::make_pair(a0, 1.0f - a_frac), std::make_pair(a1, a_frac) })
+		{
+			auto weight = e_weight * a_weight;
+			if (weight <= 0.0f)
+				continue;
+
+			auto measurement = m_offsets[e] + index;
+			auto src = &m_coeffs[static_cast<size_t>(measurement) * m_ir_size];
+			for (int i = 0; i < m_ir_size; ++i)
+				ir[i] += src[i] * weight;
+
+			delay += m_delays[measurement] * weight;
+		}
+	}
+}
+
+void Hrtf::Filter(const HrtfDirection& direction, float* re, float* im) const
+{
+	std::array<float, HRTF_MAX_PARTITIONS * HRTF_BLOCK_FRAMES> left{}, right{};
+	std::array<float, HRTF_MAX_PARTITIONS * HRTF_BLOCK_FRAMES> ir;
+	float delay{};
+
+	// Scaled for the unscaled inverse FFT.
+	auto gain = direction.gain / HRTF_FFT_SIZE;
+
+	// The right ear hears the left ear response for the mirrored direction.
+	for (auto [ear, azimuth] : { std::make_pair(&left, direction.azimuth), std::make_pair(&right, -direction.azimuth) })
+	{
+		Response(azimuth, direction.elevation, ir.data(), delay);
+
+		auto start = static_cast<int>(delay + 0.5f);
+		for (int i = 0; i < m_ir_size; ++i)
+			(*ear)[start + i] = ir[i] * gain;
+	}
+
+	for (int p = 0; p < m_partitions; ++p)
+	{
+		auto pr = re + p * HRTF_FFT_SIZE;
+		auto pi = im + p * HRTF_FFT_SIZE;
+
+		std::copy_n(left.begin() + p * HRTF_BLOCK_FRAMES, HRTF_BLOCK_FRAMES, pr);
+		std::copy_n(right.begin() + p * HRTF_BLOCK_FRAMES, HRTF_BLOCK_FRAMES, pi);
+		std::fill(pr + HRTF_BLOCK_FRAMES, pr + HRTF_FFT_SIZE, 0.0f);
+		std::fill(pi + HRTF_BLOCK_FRAMES, pi + HRTF_FFT_SIZE, 0.0f);
+
+		Fft(pr, pi);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+HrtfRenderer::HrtfRenderer(std::shared_ptr<const Hrtf> hrtf)
+	: m_hrtf(std::move(hrtf)), m_partitions(m_hrtf->Partitions())
+{
+	auto size = static_cast<size_t>(m_partitions) * HRTF_FFT_SIZE;
+	m_history_re.resize(size);
+	m_history_im.resize(size);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		m_filter_re[i].resize(size);
+		m_filter_im[i].resize(size);
+	}
+}
+
+void HrtfRenderer::Reset(const HrtfDirection& direction)
+{
+	std::fill(m_history_re.begin(), m_history_re.end(), 0.0f);
+	std::fill(m_history_im.begin(), m_history_im.end(), 0.0f);
+	m_prev_input.fill(0.0f);
+	m_output.fill(0.0f);
+	m_block_pos = 0;
+
+	m_target = direction;
+	m_target_changed = false;
+	m_hrtf->Filter(direction, m_filter_re[m_filter].data(), m_filter_im[m_filter].data());
+}
+
+void HrtfRenderer::SetDirection(const HrtfDirection& direction)
+{
+	m_target = direction;
+	m_target_changed = true;
+}
+
+void HrtfRenderer::Process(const float* in, float* out, int frames)
+{
+	for (int i = 0; i < frames; ++i)
+	{
+		m_input[m_block_pos] = in[i];
+		out[i * 2 + 0] += m_output[m_block_pos * 2 + 0];
+		out[i * 2 + 1] += m_output[m_block_pos * 2 + 1];
+
+		if (++m_block_pos == HRTF_BLOCK_FRAMES)
+		{
+			ProcessBlock();
+			m_block_pos = 0;
+		}
+	}
+}
+
+void HrtfRenderer::ProcessBlock()
+{
+	// Spectrum of the previous and current input blocks, for overlap-save.
+	m_history_pos = (m_history_pos + 1) % m_partitions;
+	auto re = m_history_re.data() + m_history_pos * HRTF_FFT_SIZE;
+	auto im = m_history_im.data() + m_history_pos * HRTF_FFT_SIZE;
+
+	std::copy(m_prev_input.begin(), m_prev_input.end(), re);
+	std::copy(m_input.begin(), m_input.end(), re + HRTF_BLOCK_FRAMES);
+	std::fill(im, im + HRTF_FFT_SIZE, 0.0f);
+	Fft(re, im);
+	m_prev_input = m_input;
+
+	Convolve(m_filter, m_re.data(), m_im.data());
+
+	// At most one filter change per block, to bound the cost of moving sounds.
+	if (m_target_changed)
+	{
+		auto next = m_filter ^ 1;
+		m_hrtf->Filter(m_target, m_filter_re[next].data(), m_filter_im[next].data());
+		Convolve(next, m_fade_re.data(), m_fade_im.data());
+
+		for (int i = HRTF_BLOCK_FRAMES; i < HRTF_FFT_SIZE; ++i)
+		{
+			auto t = static_cast<float>(i - HRTF_BLOCK_FRAMES + 1) / HRTF_BLOCK_FRAMES;
+			m_re[i] += (m_fade_re[i] - m_re[i]) * t;
+			m_im[i] += (m_fade_im[i] - m_im[i]) * t;
+		}
+
+		m_filter = next;
+		m_target_changed = false;
+	}
+
+	// Only the second half is free of wrap-around, with left and right as real and imaginary.
+	for (int i = 0; i < HRTF_BLOCK_FRAMES; ++i)
+	{
+		m_output[i * 2 + 0] = m_re[HRTF_BLOCK_FRAMES + i];
+		m_output[i * 2 + 1] = m_im[HRTF_BLOCK_FRAMES + i];
+	}
+}
+
+// Sums each filter partition with the input spectrum from as many blocks ago.
+void HrtfRenderer::Convolve(int filter, float* re, float* im)
+{
+	std::fill(re, re + HRTF_FFT_SIZE, 0.0f);
+	std::fill(im, im + HRTF_FFT_SIZE, 0.0f);
+
+	for (int p = 0; p < m_partitions; ++p)
+	{
+		auto h = (m_history_pos - p + m_partitions) % m_partitions;
+		ComplexMultiplyAdd(
+			m_history_re.data() + h * HRTF_FFT_SIZE, m_history_im.data() + h * HRTF_FFT_SIZE,
+			m_filter_re[filter].data() + p * HRTF_FFT_SIZE, m_filter_im[filter].data() + p * HRTF_FFT_SIZE,
+			re, im);
+	}
+
+	InverseFft(re, im);
+}
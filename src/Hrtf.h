@@ -0,0 +1,81 @@
+#pragma once
+
+static constexpr auto HRTF_DATA_FILE = L"hrtf/MIT_KEMAR-44100.mhr";
+static constexpr int HRTF_BLOCK_FRAMES = 128;				// convolution block and filter partition size.
+static constexpr int HRTF_FFT_SIZE = 2 * HRTF_BLOCK_FRAMES;
+static constexpr int HRTF_MAX_PARTITIONS = 4;
+
+// Direction of a positioned sound relative to the listener.
+struct HrtfDirection
+{
+	float azimuth{};	// radians, clockwise from front.
+	float elevation{};	// radians, up from horizontal.
+	float gain{};		// distance attenuation and volume.
+};
+
+// Head related impulse responses from an OpenAL Soft MinPHR01 data set.
+class Hrtf
+{
+public:
+	Hrtf(const fs::path& path);
+
+	int SampleRate() const { return m_sample_rate; }
+	int Partitions() const { return m_partitions; }
+
+	// Frequency domain filter for a direction, as Partitions() blocks of HRTF_FFT_SIZE bins.
+	// The left ear response is in the real part of the time domain, the right in the imaginary.
+	void Filter(const HrtfDirection& direction, float* re, float* im) const;
+
+protected:
+	void Response(float azimuth, float elevation, float* ir, float& delay) const;
+
+	int m_sample_rate{ 0 };
+	int m_ir_size{ 0 };
+	int m_partitions{ 0 };
+	std::vector<int> m_azimuths;		// measurements per elevation, from -90 to +90 degrees.
+	std::vector<int> m_offsets;			// index of the first measurement at each elevation.
+	std::vector<float> m_coeffs;
+	std::vector<uint8_t> m_delays;
+};
+
+// Uniformly partitioned FFT convolution of a mono voice with the HRTF for its direction.
+// Direction changes crossfade between the old and new filters over a block.
+class HrtfRenderer
+{
+public:
+	HrtfRenderer(std::shared_ptr<const Hrtf> hrtf);
+
+	void Reset(const HrtfDirection& direction);
+	void SetDirection(const HrtfDirection& direction);
+
+	// Adds stereo output for mono input, delayed by one block.
+	void Process(const float* in, float* out, int frames);
+
+protected:
+	void ProcessBlock();
+	void Convolve(int filter, float* re, float* im);
+
+	std::shared_ptr<const Hrtf> m_hrtf;
+	int m_partitions{ 0 };
+
+	// Spectra of recent input windows, as a ring of partitions.
+	std::vector<float> m_history_re;
+	std::vector<float> m_history_im;
+	int m_history_pos{ 0 };
+
+	// Current and next filters.
+	std::array<std::vector<float>, 2> m_filter_re;
+	std::array<std::vector<float>, 2> m_filter_im;
+	int m_filter{ 0 };
+
+	HrtfDirection m_target{};
+	bool m_target_changed{ false };
+
+	std::array<float, HRTF_BLOCK_FRAMES> m_prev_input{};
+	std::array<float, HRTF_BLOCK_FRAMES> m_input{};
+	std::array<float, HRTF_BLOCK_FRAMES * 2> m_output{};
+	int m_block_pos{ 0 };
+
+	std::array<float, HRTF_FFT_SIZE> m_re{}, m_im{};
+	std::array<float, HRTF_FFT_SIZE> m_fade_re{}, m_fade_im{};
+};
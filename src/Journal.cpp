@@ -0,0 +1,289 @@
+#include "stdafx.h"
+#include "Journal.h"
+
+static constexpr uint32_t JOURNAL_MAGIC = 0x4a475541;	// "AUGJ"
+static constexpr uint32_t JOURNAL_VERSION = 2;
+
+// Largest frame count in a single command, to reject corrupt or crafted journals.
+static constexpr int32_t MAX_COMMAND_FRAMES = SPECTRUM_FRAMES_PER_SECOND * 60;
+
+Journal::Journal(const std::wstring& filename)
+{
+	m_file.open(filename, std::ios::binary);
+	if (!m_file)
+		throw std::runtime_error("failed to create journal file");
+
+	m_file.write(reinterpret_cast<const char*>(&JOURNAL_MAGIC), sizeof(JOURNAL_MAGIC));
+	m_file.write(reinterpret_cast<const char*>(&JOURNAL_VERSION), sizeof(JOURNAL_VERSION));
+}
+
+void Journal::WriteStart(int landscape_bcd, uint32_t secret_code_bcd, uint64_t hash)
+{
+	JournalRecord record{ JournalRecordType::Start, landscape_bcd, secret_code_bcd };
+	record.hash = hash;
+	Write(record);
+
+	// Keep completed sessions on disk, even if the game doesn't exit cleanly.
+	m_file.flush();
+}
+
+void Journal::WriteCommand(const EmulationCommand& command, JournalRecordType type)
+{
+	JournalRecord record{ type };
+	record.command = command;
+	Write(record);
+}
+
+void Journal::WriteHash(uint64_t hash)
+{
+	JournalRecord record{ JournalRecordType::Hash };
+	record.hash = hash;
+	Write(record);
+}
+
+// Fields are stored individually so struct padding never reaches the file.
+template <typename T>
+static void WriteField(std::ostream& stream, T value)
+{
+	stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static void ReadField(std::istream& stream, T& value)
+{
+	stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+void Journal::Write(const JournalRecord& record)
+{
+	auto& command = record.command;
+
+	WriteField(m_file, static_cast<uint32_t>(record.type));
+	WriteField(m_file, static_cast<int32_t>(record.landscape_bcd));
+	WriteField(m_file, record.secret_code_bcd);
+	WriteField(m_file, static_cast<uint32_t>(command.type));
+	WriteField(m_file, static_cast<int32_t>(command.frames));
+	WriteField(m_file, command.elapsed);
+	WriteField(m_file, static_cast<uint8_t>(command.run_frame));
+	WriteField(m_file, static_cast<uint8_t>(command.sky_view));
+	WriteField(m_file, static_cast<int32_t>(command.action));
+	WriteField(m_file, command.yaw);
+	WriteField(m_file, command.pitch);
+	WriteField(m_file, static_cast<uint8_t>(command.target_valid));
+	WriteField(m_file, static_cast<int32_t>(command.tile_x));
+	WriteField(m_file, static_cast<int32_t>(command.tile_z));
+	WriteField(m_file, record.hash);
+}
+
+/*static*/ bool Journal::ReadHeader(std::istream& stream)
+{
+	uint32_t magic{}, version{};
+	stream.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	stream.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+	return stream && magic == JOURNAL_MAGIC && version == JOURNAL_VERSION;
+}
+
+static bool IsInputAction(int32_t action)
+{
+	switch (static_cast<InputAction>(action))
+	{
+	case InputAction::CreateRobot:
+	case InputAction::CreateTree:
+	case InputAction::CreateBoulder:
+	case InputAction::Absorb:
+	case InputAction::Transfer:
+	case InputAction::Hyperspace:
+	case InputAction::UTurn:
+		return true;
+	}
+
+	return false;
+}
+
+/*static*/ bool Journal::ReadRecord(std::istream& stream, JournalRecord& record)
+{
+	uint32_t type{}, command_type{};
+	int32_t landscape_bcd{}, frames{}, action{}, tile_x{}, tile_z{};
+	uint8_t run_frame{}, sky_view{}, target_valid{};
+
+	record = {};
+	auto& command = record.command;
+
+	ReadField(stream, type);
+	ReadField(stream, landscape_bcd);
+	ReadField(stream, record.secret_code_bcd);
+	ReadField(stream, command_type);
+	ReadField(stream, frames);
+	ReadField(stream, command.elapsed);
+	ReadField(stream, run_frame);
+	ReadField(stream, sky_view);
+	ReadField(stream, action);
+	ReadField(stream, command.yaw);
+	ReadField(stream, command.pitch);
+	ReadField(stream, target_valid);
+	ReadField(stream, tile_x);
+	ReadField(stream, tile_z);
+	ReadField(stream, record.hash);
+
+	if (!stream)
+		return false;
+
+	// Anything the game wouldn't produce could stall or derail the replay.
+	if (frames < 0 || frames > MAX_COMMAND_FRAMES)
+		throw std::runtime_error("journal command frame count out of range");
+	else if (action != -1 && !IsInputAction(action))
+		throw std::runtime_error("journal command action out of range");
+	else if (tile_x < 0 || tile_x >= SENTINEL_MAP_SIZE || tile_z < 0 || tile_z >= SENTINEL_MAP_SIZE)
+		throw std::runtime_error("journal target tile out of range");
+
+	record.type = static_cast<JournalRecordType>(type);
+	record.landscape_bcd = landscape_bcd;
+	command.type = static_cast<EmulationCommandType>(command_type);
+	command.frames = frames;
+	command.run_frame = run_frame != 0;
+	command.sky_view = sky_view != 0;
+	command.action = action;
+	command.target_valid = target_valid != 0;
+	command.tile_x = tile_x;
+	command.tile_z = tile_z;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void AddEmulationTotals(ReplayResult& result, Emulation& emulation)
+{
+	result.frames += emulation.FrameCount();
+
+	for (auto& [pc, stats] : emulation.GetSpectrum().GetIdleLoopStats())
+	{
+		auto& total = result.idle_loops[pc];
+		total.end_pc = stats.end_pc;
+		total.period_cycles = stats.period_cycles;
+		total.hits += stats.hits;
+		total.skipped_cycles += stats.skipped_cycles;
+	}
+}
+
+ReplayResult ReplayJournal(std::istream& stream, const std::wstring& snapshot_file)
+{
+	ReplayResult result;
+
+	if (!Journal::ReadHeader(stream))
+	{
+		result.error = "not a journal file";
+		return result;
+	}
+
+	std::unique_ptr<Emulation> emulation;
+	JournalRecord record;
+
+	try
+	{
+		auto have_record = Journal::ReadRecord(stream, record);
+
+		while (have_record)
+		{
+			switch (record.type)
+			{
+			case JournalRecordType::Start:
+				if (emulation)
+					AddEmulationTotals(result, *emulation);
+
+				// Each session segment starts from a fresh snapshot, as the game does on reset.
+				emulation.reset();
+				emulation = std::make_unique<Emulation>(
+					snapshot_file, record.landscape_bcd, record.secret_code_bcd, nullptr, false);
+
+				// Game option patches (such as invisibility) must match the recording.
+				if (emulation->GetSpectrum().MemoryHash() != record.hash)
+				{
+					result.error = "snapshot or game options differ from the recording";
+					break;
+				}
+
+				have_record = Journal::ReadRecord(stream, record);
+				break;
+
+			case JournalRecordType::Command:
+			{
+				if (!emulation)
+				{
+					result.error = "journal command before start";
+					return result;
+				}
+
+				auto command = record.command;
+				++result.commands;
+
+				// Queue any recorded target answers, which the command will wait for.
+				while ((have_record = Journal::ReadRecord(stream, record)) && record.type == JournalRecordType::TargetAnswer)
+					emulation->Post(std::move(record.command));
+
+				if (!emulation->Run(command))
+				{
+					result.error = "emulation failed to reach the next game state";
+					break;
+				}
+
+				// Landscape complete tune?
+				EmulationEvent event;
+				while (emulation->PollEvent(event))
+				{
+					if (event.type == EmulationEventType::PlayTune && event.value == SENTINEL_COMPLETE_TUNE)
+					{
+						result.complete = true;
+						emulation->GetSpectrum().GetLandscapeAndCode(result.landscape_bcd, result.secret_code_bcd);
+					}
+				}
+
+				// The hash is missing if the game was reset part way through the command.
+				if (have_record && record.type == JournalRecordType::Hash)
+				{
+					if (emulation->GetSpectrum().MemoryHash() != record.hash)
+					{
+						std::stringstream ss;
+						ss << "memory hash mismatch after command " << result.commands;
+						result.error = ss.str();
+						break;
+					}
+
+					have_record = Journal::ReadRecord(stream, record);
+				}
+				break;
+			}
+
+			default:
+				result.error = "unexpected journal record";
+				break;
+			}
+
+			if (!result.error.empty())
+				break;
+		}
+	}
+	catch (std::exception& e)
+	{
+		result.error = e.what();
+	}
+
+	if (emulation)
+		AddEmulationTotals(result, *emulation);
+
+	result.passed = result.error.empty();
+	return result;
+}
+
+ReplayResult ReplayJournal(const std::wstring& filename, const std::wstring& snapshot_file)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		ReplayResult result;
+		result.error = "failed to open journal file";
+		return result;
+	}
+
+	return ReplayJournal(file, snapshot_file);
+}
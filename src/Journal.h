@@ -0,0 +1,50 @@
+#pragma once
+#include "Emulation.h"
+
+enum class JournalRecordType : uint32_t
+{
+	Start, Command, TargetAnswer, Hash
+};
+
+struct JournalRecord
+{
+	JournalRecordType type{};
+	int landscape_bcd{};			// Start: landscape entered at the title screen.
+	uint32_t secret_code_bcd{};		// Start: secret code entered for the landscape.
+	EmulationCommand command{};		// Command or TargetAnswer.
+	uint64_t hash{};				// Spectrum memory after loading (Start) or the last command (Hash).
+};
+
+// Records every command given to the emulation, so a whole session can be replayed.
+class Journal
+{
+public:
+	Journal(const std::wstring& filename);
+
+	void WriteStart(int landscape_bcd, uint32_t secret_code_bcd, uint64_t hash);
+	void WriteCommand(const EmulationCommand& command, JournalRecordType type = JournalRecordType::Command);
+	void WriteHash(uint64_t hash);
+
+	static bool ReadHeader(std::istream& stream);
+	static bool ReadRecord(std::istream& stream, JournalRecord& record);	// throws if out of range.
+
+protected:
+	void Write(const JournalRecord& record);
+
+	std::ofstream m_file;
+};
+
+struct ReplayResult
+{
+	bool passed{ false };
+	size_t commands{ 0 };
+	uint64_t frames{ 0 };
+	bool complete{ false };			// landscape completed.
+	int landscape_bcd{ 0 };
+	uint32_t secret_code_bcd{ 0 };
+	std::map<uint16_t, IdleLoopStats> idle_loops;
+	std::string error;
+};
+
+ReplayResult ReplayJournal(std::istream& stream, const std::wstring& snapshot_file = SENTINEL_SNAPSHOT_FILE);
+ReplayResult ReplayJournal(const std::wstring& filename, const std::wstring& snapshot_file = SENTINEL_SNAPSHOT_FILE);
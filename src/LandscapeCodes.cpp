@@ -0,0 +1,214 @@
+#include "stdafx.h"
+#include "LandscapeCodes.h"
+#include "Settings.h"
+#include "MappedFile.h"
+
+#define fourccCODES 'SDCL'
+
+struct LandscapeCodesHeader
+{
+	uint32_t fourcc;
+	uint32_t version;
+	uint32_t sorted_count;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(LandscapeCode) == 8, "LandscapeCode must be packed");
+
+// Codes are kept alongside the settings file.
+fs::path LandscapeCodes::DefaultPath()
+{
+	return fs::path(settings_path).replace_extension(LANDSCAPE_CODES_EXTENSION);
+}
+
+void LandscapeCodes::Load(const fs::path& path)
+{
+	m_path = path;
+	m_codes.clear();
+	m_log_entries = 0;
+
+	std::error_code ec;
+	if (!fs::exists(path, ec))
+		return;
+
+	try
+	{
+		// Unmapped again before any compaction replaces the file.
+		MappedFile file(path);
+
+		LandscapeCodesHeader header{};
+		if (file.size() >= sizeof(header))
+			std::memcpy(&header, file.data(), sizeof(header));
+
+		auto total_entries = file.size() >= sizeof(header) ? (file.size() - sizeof(header)) / sizeof(LandscapeCode) : 0;
+		if (header.fourcc == fourccCODES && header.version == LANDSCAPE_CODES_VERSION && header.sorted_count <= total_entries)
+		{
+			// The sorted array is used as-is, with any logged changes applied on top.
+			auto entries = reinterpret_cast<const LandscapeCode*>(file.data() + sizeof(header));
+			m_codes.assign(entries, entries + header.sorted_count);
+
+			for (auto i = header.sorted_count; i < total_entries; ++i)
+				Apply(entries[i]);
+
+			m_log_entries = total_entries - header.sorted_count;
+		}
+	}
+	catch (...)
+	{
+		// Unreadable files are treated as empty.
+	}
+
+	if (m_log_entries >= LANDSCAPE_CODES_MAX_LOG)
+		Compact();
+}
+
+size_t LandscapeCodes::Find(int landscape_bcd) const
+{
+	auto it = std::lower_bound(m_codes.begin(), m_codes.end(), landscape_bcd,
+		[](const LandscapeCode& code, int bcd) { return code.landscape_bcd < bcd; });
+
+	if (it == m_codes.end() || it->landscape_bcd != landscape_bcd)
+		return npos;
+
+	return static_cast<size_t>(it - m_codes.begin());
+}
+
+uint32_t LandscapeCodes::SecretCode(int landscape_bcd) const
+{
+	auto index = Find(landscape_bcd);
+	return (index != npos) ? m_codes[index].secret_code_bcd : 0;
+}
+
+void LandscapeCodes::Apply(const LandscapeCode& entry)
+{
+	auto it = std::lower_bound(m_codes.begin(), m_codes.end(), entry.landscape_bcd,
+		[](const LandscapeCode& code, int bcd) { return code.landscape_bcd < bcd; });
+	auto found = it != m_codes.end() && it->landscape_bcd == entry.landscape_bcd;
+
+	if (entry.flags & LANDSCAPE_CODE_REMOVED)
+	{
+		if (found)
+			m_codes.erase(it);
+	}
+	else if (found)
+		it->secret_code_bcd = entry.secret_code_bcd;
+	else
+		m_codes.insert(it, { entry.landscape_bcd, 0, entry.secret_code_bcd });
+}
+
+void LandscapeCodes::Add(int landscape_bcd, uint32_t secret_code_bcd)
+{
+	LandscapeCode entry{ static_cast<uint16_t>(landscape_bcd), 0, secret_code_bcd };
+
+	auto index = Find(landscape_bcd);
+	if (index != npos && m_codes[index].secret_code_bcd == secret_code_bcd)
+		return;
+
+	Apply(entry);
+	AppendLog(entry);
+}
+
+void LandscapeCodes::Remove(int landscape_bcd)
+{
+	if (Find(landscape_bcd) == npos)
+		return;
+
+	LandscapeCode entry{ static_cast<uint16_t>(landscape_bcd), LANDSCAPE_CODE_REMOVED, 0 };
+	Apply(entry);
+	AppendLog(entry);
+}
+
+// Changes are appended to the file, so each is a single small write.
+void LandscapeCodes::AppendLog(const LandscapeCode& entry)
+{
+	if (m_path.empty())
+		return;
+
+	if (m_log_entries + 1 >= LANDSCAPE_CODES_MAX_LOG || !fs::exists(m_path))
+	{
+		Compact();
+		return;
+	}
+
+	std::ofstream file(m_path, std::ios::binary | std::ios::app);
+	file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	if (file)
+		m_log_entries++;
+}
+
+// Rewrites the file as a sorted array with an empty log, replacing the old one in one step.
+bool LandscapeCodes::Compact()
+{
+	if (m_path.empty())
+		return false;
+
+	LandscapeCodesHeader header{};
+	header.fourcc = fourccCODES;
+	header.version = LANDSCAPE_CODES_VERSION;
+	header.sorted_count = static_cast<uint32_t>(m_codes.size());
+
+	auto temp_path = m_path;
+	temp_path += L".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(m_codes.data()), m_codes.size() * sizeof(LandscapeCode));
+		if (!file)
+		{
+			file.close();
+			DeleteFile(temp_path.c_str());
+			return false;
+		}
+	}
+
+	if (!MoveFileEx(temp_path.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		DeleteFile(temp_path.c_str());
+		return false;
+	}
+
+	m_log_entries = 0;
+	return true;
+}
+
+// Landscape numbers and secret codes are stored as hex strings of their BCD values.
+void LandscapeCodes::Import(const std::wstring& section)
+{
+	for (auto& landscape_key : GetSettingKeys(section))
+	{
+		try
+		{
+			auto landscape_bcd = static_cast<int>(std::stoul(landscape_key, nullptr, 16));
+			auto secret_code_bcd = static_cast<uint32_t>(std::stoul(GetSetting(landscape_key, L"0", section), nullptr, 16));
+			if (landscape_bcd <= 0xffff)
+				Apply({ static_cast<uint16_t>(landscape_bcd), 0, secret_code_bcd });
+		}
+		catch (...)
+		{
+			// Skip anything that isn't a landscape entry.
+		}
+	}
+
+	Compact();
+}
+
+// The section is replaced, so it lists exactly the codes held here.
+void LandscapeCodes::Export(const std::wstring& section) const
+{
+	std::vector<std::pair<std::wstring, std::wstring>> values;
+	values.reserve(m_codes.size());
+
+	for (auto& code : m_codes)
+	{
+		std::wstringstream ss_landscape;
+		ss_landscape << std::hex << std::uppercase << std::setw(4) << std::setfill(L'0') << code.landscape_bcd;
+
+		std::wstringstream ss_secret_code;
+		ss_secret_code << std::hex << std::setw(8) << std::setfill(L'0') << code.secret_code_bcd;
+
+		values.emplace_back(ss_landscape.str(), ss_secret_code.str());
+	}
+
+	// Replace the whole section at once, as changing keys one by one rescans it each time.
+	SetSettingSection(section, values);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+static constexpr auto LANDSCAPE_CODES_EXTENSION = L".codes";
+static constexpr auto LANDSCAPES_SECTION = L"Landscapes";	// settings file section used by earlier versions.
+static constexpr uint32_t LANDSCAPE_CODES_VERSION = 1;
+static constexpr size_t LANDSCAPE_CODES_MAX_LOG = 64;	// changes appended before compacting.
+
+struct LandscapeCode
+{
+	uint16_t landscape_bcd;
+	uint16_t flags;				// LANDSCAPE_CODE_REMOVED in log entries.
+	uint32_t secret_code_bcd;
+};
+
+static constexpr uint16_t LANDSCAPE_CODE_REMOVED = 1;
+
+// Unlocked landscapes and their secret codes, kept in landscape order. The file holds
+// a sorted array, which loads with a single copy from a memory mapping, followed by a
+// log of later changes that's merged back into the array once it grows.
+class LandscapeCodes
+{
+public:
+	static constexpr size_t npos = ~size_t(0);
+
+	static fs::path DefaultPath();
+	void Load(const fs::path& path);
+	size_t Size() const { return m_codes.size(); }
+	const LandscapeCode& operator[](size_t index) const { return m_codes[index]; }
+	size_t Find(int landscape_bcd) const;
+	uint32_t SecretCode(int landscape_bcd) const;
+
+	void Add(int landscape_bcd, uint32_t secret_code_bcd);
+	void Remove(int landscape_bcd);
+
+	// Conversion to and from the settings file section used by earlier versions.
+	void Import(const std::wstring& section);
+	void Export(const std::wstring& section) const;
+
+protected:
+	void Apply(const LandscapeCode& entry);
+	void AppendLog(const LandscapeCode& entry);
+	bool Compact();
+
+	fs::path m_path;
+	std::vector<LandscapeCode> m_codes;
+	size_t m_log_entries{ 0 };
+};
@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const fs::path& path, bool sequential)
+	: m_path(path)
+{
+	HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		auto str = "File not found: " + to_string(path);
+		throw std::runtime_error(str);
+	}
+
+	LARGE_INTEGER size{};
+	auto ok = GetFileSizeEx(hFile, &size) && static_cast<ULONGLONG>(size.QuadPart) <= SIZE_MAX;
+	auto file_size = ok ? static_cast<size_t>(size.QuadPart) : 0;
+
+	// Empty files can't be mapped, but there's nothing to read either. The view
+	// stays valid after the handles are closed.
+	if (ok && file_size)
+	{
+		HANDLE hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (hMapping)
+		{
+			m_pView = static_cast<const uint8_t*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(hMapping);
+		}
+
+		if (m_pView)
+		{
+			m_span = ByteSpan(m_pView, file_size);
+		}
+		else
+		{
+			// Fall back to reading it, in chunks as ReadFile sizes are only 32-bit.
+			m_buffer.resize(file_size);
+			for (size_t offset = 0; ok && offset < file_size; )
+			{
+				auto chunk = static_cast<DWORD>(std::min<size_t>(file_size - offset, 0x40000000));
+				DWORD dwRead{};
+				ok = ReadFile(hFile, m_buffer.data() + offset, chunk, &dwRead, NULL) && dwRead;
+				offset += dwRead;
+			}
+
+			m_span = ByteSpan(m_buffer.data(), m_buffer.size());
+		}
+	}
+
+	CloseHandle(hFile);
+
+	if (!ok)
+	{
+		auto str = "Failed to read: " + to_string(path);
+		throw std::runtime_error(str);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_pView)
+		UnmapViewOfFile(m_pView);
+}
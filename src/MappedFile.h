@@ -0,0 +1,54 @@
+#pragma once
+
+// Read-only view of a run of bytes, such as part of a mapped file.
+class ByteSpan
+{
+public:
+	ByteSpan() = default;
+	ByteSpan(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	bool empty() const { return !m_size; }
+	const uint8_t* begin() const { return m_data; }
+	const uint8_t* end() const { return m_data + m_size; }
+	const uint8_t& operator[](size_t index) const { return m_data[index]; }
+
+	// Clamped to the end of the span, like std::string::substr.
+	ByteSpan subspan(size_t offset, size_t count = ~size_t(0)) const
+	{
+		offset = std::min(offset, m_size);
+		return { m_data + offset, std::min(count, m_size - offset) };
+	}
+
+protected:
+	const uint8_t* m_data{ nullptr };
+	size_t m_size{ 0 };
+};
+
+// File contents, memory-mapped so they're parsed in place without a copy. If the file
+// can't be mapped it's read into a buffer instead, which looks the same to users.
+class MappedFile
+{
+public:
+	MappedFile(const fs::path& path, bool sequential = false);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	virtual ~MappedFile();
+
+	const fs::path& Path() const { return m_path; }
+	ByteSpan Span() const { return m_span; }
+
+	const uint8_t* data() const { return m_span.data(); }
+	size_t size() const { return m_span.size(); }
+	bool empty() const { return m_span.empty(); }
+	const uint8_t* begin() const { return m_span.begin(); }
+	const uint8_t* end() const { return m_span.end(); }
+	const uint8_t& operator[](size_t index) const { return m_span[index]; }
+
+protected:
+	fs::path m_path;
+	const uint8_t* m_pView{ nullptr };
+	std::vector<uint8_t> m_buffer;
+	ByteSpan m_span;
+};
@@ -0,0 +1,514 @@
+#include "stdafx.h"
+#include "Mixer.h"
+
+Mixer::Mixer(int sample_rate, std::shared_ptr<const Hrtf> hrtf)
+	: m_sample_rate(sample_rate)
+{
+	// Renderers are allocated up front, as voices are started on the audio thread.
+	if (hrtf && hrtf->SampleRate() == sample_rate)
+	{
+		for (int i = 0; i < MIXER_MAX_VOICES; ++i)
+			m_renderers.push_back(std::make_unique<HrtfRenderer>(hrtf));
+	}
+}
+
+int Mixer::Play(std::shared_ptr<const SoundData> sound, const VoiceGains& gains, float speed, bool loop, bool paused)
+{
+	MixerCommand command{ MixerCommandType::Play, 0, 0, std::move(sound), gains, speed, loop, paused };
+	return Play(std::move(command));
+}
+
+int Mixer::Play(std::shared_ptr<SoundStream> stream, const VoiceGains& gains, float speed, bool loop, bool paused)
+{
+	// The first block is decoded here, before the audio thread sees the stream.
+	stream->Rewind();
+	auto block = stream->NextBlock();
+	if (!block)
+		return -1;
+
+	std::shared_ptr<const SoundData> sound(stream, block);
+	MixerCommand command{ MixerCommandType::Play, 0, 0, std::move(sound), gains, speed, loop, paused, std::move(stream) };
+	return Play(std::move(command));
+}
+
+int Mixer::Play(std::shared_ptr<const SoundData> sound, const HrtfDirection& direction, float speed, bool loop)
+{
+	if (!HrtfEnabled())
+		return -1;
+
+	MixerCommand command{ MixerCommandType::Play, 0, 0, std::move(sound), {}, speed, loop };
+	command.direction = direction;
+	command.directional = true;
+	return Play(std::move(command));
+}
+
+int Mixer::Play(MixerCommand&& command)
+{
+	if (!command.sound || !command.sound->Frames())
+		return -1;
+
+	for (int voice = 0; voice < MIXER_MAX_VOICES; ++voice)
+	{
+		if (IsActive(voice))
+			continue;
+
+		// Zero is never used, so unused voices are inactive.
+		if (!++m_next_id)
+			++m_next_id;
+
+		m_ids[voice] = m_next_id;
+		m_stopped[voice] = false;
+
+		command.voice = voice;
+		command.id = m_next_id;
+		Post(std::move(command));
+
+		return voice;
+	}
+
+	// All voices busy.
+	return -1;
+}
+
+void Mixer::Stop(int voice)
+{
+	if (!IsActive(voice))
+		return;
+
+	m_stopped[voice] = true;
+	Post({ MixerCommandType::Stop, voice, m_ids[voice] });
+}
+
+void Mixer::SetGains(int voice, const VoiceGains& gains)
+{
+	if (IsActive(voice))
+		Post({ MixerCommandType::SetGains, voice, m_ids[voice], nullptr, gains });
+}
+
+void Mixer::SetDirection(int voice, const HrtfDirection& direction)
+{
+	if (IsActive(voice))
+	{
+		MixerCommand command{ MixerCommandType::SetDirection, voice, m_ids[voice] };
+		command.direction = direction;
+		Post(std::move(command));
+	}
+}
+
+void Mixer::SetPaused(int voice, bool paused)
+{
+	if (IsActive(voice))
+	{
+		MixerCommand command{ MixerCommandType::SetPaused, voice, m_ids[voice] };
+		command.paused = paused;
+		Post(std::move(command));
+	}
+}
+
+bool Mixer::IsActive(int voice) const
+{
+	if (voice < 0 || voice >= MIXER_MAX_VOICES || !m_ids[voice] || m_stopped[voice])
+		return false;
+
+	return m_finished_ids[voice].load(std::memory_order_acquire) != m_ids[voice];
+}
+
+void Mixer::Post(MixerCommand&& command)
+{
+	// Wait for the audio thread to make space if the queue is full.
+	while (!m_commands.Push(std::move(command)))
+		std::this_thread::yield();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Mixer::Render(float* out, int frames)
+{
+	MixerCommand command;
+	while (m_commands.Pop(command))
+		Apply(command);
+
+	std::fill(out, out + frames * MIXER_CHANNELS, 0.0f);
+
+	for (int i = 0; i < MIXER_MAX_VOICES; ++i)
+	{
+		auto& voice = m_voices[i];
+		if (!voice.sound || voice.paused)
+			continue;
+
+		auto playing = voice.directional ?
+			MixDirectional(voice, *m_renderers[i], out, frames) :
+			MixVoice(voice, out, frames);
+
+		if (!playing)
+			Finish(voice, i);
+	}
+}
+
+void Mixer::Apply(MixerCommand& command)
+{
+	auto& voice = m_voices[command.voice];
+
+	if (command.type == MixerCommandType::Play)
+	{
+		voice.sound = std::move(command.sound);
+		voice.stream = std::move(command.stream);
+		voice.id = command.id;
+		voice.pos = 0.0;
+		voice.step = static_cast<double>(voice.sound->sample_rate) * command.speed / m_sample_rate;
+		voice.gains = command.gains;
+		voice.loop = command.loop;
+		voice.paused = command.paused;
+		voice.directional = command.directional;
+
+		// Directional voices are first mixed to mono, in the left channel.
+		if (voice.directional)
+		{
+			voice.gains = (voice.sound->channels == 1) ?
+				VoiceGains{ 1.0f, 0.0f, 0.0f, 0.0f } : VoiceGains{ 0.5f, 0.0f, 0.5f, 0.0f };
+			m_renderers[command.voice]->Reset(command.direction);
+		}
+		return;
+	}
+
+	// Ignore commands for an earlier sound on the same voice.
+	if (!voice.sound || voice.id != command.id)
+		return;
+
+	switch (command.type)
+	{
+	case MixerCommandType::Stop:
+		Finish(voice, command.voice);
+		break;
+	case MixerCommandType::SetGains:
+		voice.gains = command.gains;
+		break;
+	case MixerCommandType::SetPaused:
+		voice.paused = command.paused;
+		break;
+	case MixerCommandType::SetDirection:
+		if (voice.directional)
+			m_renderers[command.voice]->SetDirection(command.direction);
+		break;
+	default:
+		break;
+	}
+}
+
+void Mixer::Finish(Voice& voice, int index)
+{
+	voice.sound.reset();
+	voice.stream.reset();
+	m_finished_ids[index].store(voice.id, std::memory_order_release);
+}
+
+// At the end of the current sound data, move to the next streamed block, or back to
+// the start if looping. Returns false if there's nothing more to play.
+bool Mixer::NextSoundData(Voice& voice)
+{
+	if (!voice.stream)
+		return voice.loop;
+
+	auto block = voice.stream->NextBlock();
+	if (!block && voice.loop)
+	{
+		voice.stream->Rewind();
+		block = voice.stream->NextBlock();
+	}
+
+	if (!block)
+		return false;
+
+	// The block belongs to the stream, so share its ownership without allocating.
+	voice.sound = std::shared_ptr<const SoundData>(voice.stream, block);
+	return true;
+}
+
+// Returns false once a non-looping voice reaches the end of its sound.
+bool Mixer::MixVoice(Voice& voice, float* out, int frames)
+{
+	// Sounds at the output rate are mixed directly, in blocks up to the end of the sound.
+	if (voice.step == 1.0)
+	{
+		while (frames > 0)
+		{
+			auto src_frames = voice.sound->Frames();
+			auto src_frame = static_cast<size_t>(voice.pos);
+			auto block = static_cast<int>(std::min<size_t>(frames, src_frames - src_frame));
+
+			MixUnitRate(voice, src_frame, out, block);
+			out += block * MIXER_CHANNELS;
+			frames -= block;
+			voice.pos += block;
+
+			if (static_cast<size_t>(voice.pos) >= src_frames)
+			{
+				if (!NextSoundData(voice))
+					return false;
+
+				voice.pos = 0.0;
+			}
+		}
+
+		return true;
+	}
+
+	// Otherwise linear interpolation between source frames.
+	auto& g = voice.gains;
+	auto src = voice.sound->samples.data();
+	auto src_frames = voice.sound->Frames();
+	auto channels = voice.sound->channels;
+	auto wrap = voice.loop && !voice.stream;
+
+	for (int i = 0; i < frames; ++i)
+	{
+		auto frame = static_cast<size_t>(voice.pos);
+		auto next = (frame + 1 < src_frames) ? frame + 1 : (wrap ? 0 : frame);
+		auto frac = static_cast<float>(voice.pos - frame);
+
+		if (channels == 1)
+		{
+			auto s = src[frame] + (src[next] - src[frame]) * frac;
+			out[i * 2 + 0] += s * g[0];
+			out[i * 2 + 1] += s * g[1];
+		}
+		else
+		{
+			auto l = src[frame * 2 + 0] + (src[next * 2 + 0] - src[frame * 2 + 0]) * frac;
+			auto r = src[frame * 2 + 1] + (src[next * 2 + 1] - src[frame * 2 + 1]) * frac;
+			out[i * 2 + 0] += l * g[0] + r * g[2];
+			out[i * 2 + 1] += l * g[1] + r * g[3];
+		}
+
+		voice.pos += voice.step;
+		if (voice.pos >= src_frames)
+		{
+			if (!NextSoundData(voice))
+				return false;
+
+			voice.pos -= src_frames;
+			src = voice.sound->samples.data();
+			src_frames = voice.sound->Frames();
+		}
+	}
+
+	return true;
+}
+
+// Mix a voice to mono in scratch space, then through its HRTF renderer to the output.
+bool Mixer::MixDirectional(Voice& voice, HrtfRenderer& renderer, float* out, int frames)
+{
+	auto playing = true;
+
+	for (int done = 0; done < frames; )
+	{
+		auto block = std::min(frames - done, MIXER_SCRATCH_FRAMES);
+
+		// Once the sound ends, silence flushes the last of it through the renderer.
+		std::fill(m_scratch.begin(), m_scratch.begin() + block * MIXER_CHANNELS, 0.0f);
+		if (playing)
+			playing = MixVoice(voice, m_scratch.data(), block);
+
+		for (int i = 0; i < block; ++i)
+			m_mono[i] = m_scratch[i * MIXER_CHANNELS];
+
+		renderer.Process(m_mono.data(), out + done * MIXER_CHANNELS, block);
+		done += block;
+	}
+
+	return playing;
+}
+
+// Mix source frames without rate conversion, two output frames per vector.
+/*static*/ void Mixer::MixUnitRate(const Voice& voice, size_t src_frame, float* out, int frames)
+{
+	auto& g = voice.gains;
+	auto src = voice.sound->samples.data() + src_frame * voice.sound->channels;
+	int i = 0;
+
+	if (voice.sound->channels == 1)
+	{
+		auto gains = XMVectorSet(g[0], g[1], g[0], g[1]);
+		for (; i + 2 <= frames; i += 2)
+		{
+			auto s = XMVectorSet(src[i], src[i], src[i + 1], src[i + 1]);
+			auto o = XMLoadFloat4(reinterpret_cast<XMFLOAT4*>(out + i * 2));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out + i * 2), XMVectorMultiplyAdd(s, gains, o));
+		}
+
+		for (; i < frames; ++i)
+		{
+			out[i * 2 + 0] += src[i] * g[0];
+			out[i * 2 + 1] += src[i] * g[1];
+		}
+	}
+	else
+	{
+		// Each output channel takes its own source channel plus the crossed one.
+		auto direct = XMVectorSet(g[0], g[3], g[0], g[3]);
+		auto crossed = XMVectorSet(g[2], g[1], g[2], g[1]);
+		for (; i + 2 <= frames; i += 2)
+		{
+			auto s = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(src + i * 2));
+			auto o = XMLoadFloat4(reinterpret_cast<XMFLOAT4*>(out + i * 2));
+			o = XMVectorMultiplyAdd(s, direct, o);
+			o = XMVectorMultiplyAdd(XMVectorSwizzle<1, 0, 3, 2>(s), crossed, o);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out + i * 2), o);
+		}
+
+		for (; i < frames; ++i)
+		{
+			auto l = src[i * 2 + 0], r = src[i * 2 + 1];
+			out[i * 2 + 0] += l * g[0] + r * g[2];
+			out[i * 2 + 1] += l * g[1] + r * g[3];
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void WriteWav(const std::wstring& wav_file, const std::vector<float>& samples, int sample_rate)
+{
+	std::ofstream file(wav_file, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("failed to create WAV file");
+
+	auto write = [&](auto value) { file.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+	auto data_size = static_cast<uint32_t>(samples.size() * sizeof(float));
+
+	file.write("RIFF", 4);
+	write(static_cast<uint32_t>(36 + data_size));
+	file.write("WAVEfmt ", 8);
+	write(uint32_t{ 16 });
+	write(WAV_FORMAT_IEEE_FLOAT);
+	write(static_cast<uint16_t>(MIXER_CHANNELS));
+	write(static_cast<uint32_t>(sample_rate));
+	write(static_cast<uint32_t>(sample_rate * MIXER_CHANNELS * sizeof(float)));
+	write(static_cast<uint16_t>(MIXER_CHANNELS * sizeof(float)));
+	write(uint16_t{ 32 });
+	file.write("data", 4);
+	write(data_size);
+	file.write(reinterpret_cast<const char*>(samples.data()), data_size);
+}
+
+int BenchmarkMixer(const std::wstring& wav_file)
+{
+	constexpr auto sample_rate = 44100;
+	constexpr auto block_frames = 512;
+	constexpr auto seconds = 60;
+
+	// One second of tone at each of the common rates, in mono and stereo.
+	std::vector<std::shared_ptr<const SoundData>> sounds;
+	for (auto rate : { 44100, 22050 })
+	{
+		for (auto channels : { 1, 2 })
+		{
+			auto sound = std::make_shared<SoundData>();
+			sound->channels = channels;
+			sound->sample_rate = rate;
+			for (int i = 0; i < rate; ++i)
+			{
+				for (int c = 0; c < channels; ++c)
+					sound->samples.push_back(0.1f * std::sin(i * (440.0f + 110.0f * c) * XM_2PI / rate));
+			}
+			sounds.push_back(sound);
+		}
+	}
+
+	Mixer mixer(sample_rate);
+	std::vector<float> block(block_frames * MIXER_CHANNELS);
+	std::vector<float> output;
+	uint64_t voice_frames = 0;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	for (int frame = 0; frame < sample_rate * seconds; frame += block_frames)
+	{
+		// Keep every voice busy, with a mix of rates, speeds and pans.
+		for (int i = 0; mixer.Play(sounds[i % sounds.size()],
+			{ 0.5f, 0.2f * (i % 3), 0.2f * (i % 2), 0.5f }, (i % 4) ? 1.0f : 1.5f) >= 0; ++i);
+
+		mixer.Render(block.data(), block_frames);
+		voice_frames += static_cast<uint64_t>(block_frames) * MIXER_MAX_VOICES;
+
+		if (!wav_file.empty())
+			output.insert(output.end(), block.begin(), block.end());
+	}
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+	elapsed = std::max(elapsed, 0.001);
+
+	if (!wav_file.empty())
+		WriteWav(wav_file, output, sample_rate);
+
+	printf("%d voices, %ds of audio in %.3fs, %.0fx real time, %.1fM voice frames/sec\n",
+		MIXER_MAX_VOICES, seconds, elapsed, seconds / elapsed, voice_frames / elapsed / 1e6);
+	fflush(stdout);
+
+	return 0;
+}
+
+int BenchmarkHrtf(const std::wstring& wav_file)
+{
+	constexpr auto block_frames = 512;
+	constexpr auto seconds = 60;
+	constexpr auto num_voices = 12;
+
+	std::shared_ptr<const Hrtf> hrtf;
+	try
+	{
+		hrtf = std::make_shared<Hrtf>(HRTF_DATA_FILE);
+	}
+	catch (std::exception& e)
+	{
+		printf("%s\n", e.what());
+		return 1;
+	}
+
+	// A second of quiet noise, which shows off the HRTF better than a tone.
+	auto sound = std::make_shared<SoundData>();
+	sound->sample_rate = hrtf->SampleRate();
+	std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+	std::mt19937 rng(1);
+	for (int i = 0; i < sound->sample_rate; ++i)
+		sound->samples.push_back(noise(rng));
+
+	Mixer mixer(hrtf->SampleRate(), hrtf);
+	std::array<int, num_voices> voices{};
+	for (int i = 0; i < num_voices; ++i)
+		voices[i] = mixer.Play(sound, HrtfDirection{ 0.0f, 0.0f, 1.0f }, 1.0f, true);
+
+	std::vector<float> block(block_frames * MIXER_CHANNELS);
+	std::vector<float> output;
+	auto sample_rate = hrtf->SampleRate();
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+
+	for (int frame = 0; frame < sample_rate * seconds; frame += block_frames)
+	{
+		// Each voice circles the listener at its own speed and elevation, so every block moves them all.
+		auto t = static_cast<float>(frame) / sample_rate;
+		for (int i = 0; i < num_voices; ++i)
+		{
+			HrtfDirection direction{ t * (0.2f + 0.1f * i), (i % 5 - 2) * 0.3f, 1.0f / num_voices };
+			mixer.SetDirection(voices[i], direction);
+		}
+
+		mixer.Render(block.data(), block_frames);
+
+		if (!wav_file.empty())
+			output.insert(output.end(), block.begin(), block.end());
+	}
+
+	auto elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_time).count();
+	elapsed = std::max(elapsed, 0.001);
+
+	if (!wav_file.empty())
+		WriteWav(wav_file, output, sample_rate);
+
+	printf("%d moving HRTF voices, %ds of audio in %.3fs, %.0fx real time, %.2f%% of a core\n",
+		num_voices, seconds, elapsed, seconds / elapsed, 100.0 * elapsed / seconds);
+	fflush(stdout);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "SpscRing.h"
+#include "SoundData.h"
+#include "Hrtf.h"
+
+static constexpr int MIXER_MAX_VOICES = 32;
+static constexpr int MIXER_CHANNELS = 2;	// stereo output bus.
+static constexpr int MIXER_SCRATCH_FRAMES = 256;
+
+// Source channel to output channel gains, indexed [src * MIXER_CHANNELS + dst].
+using VoiceGains = std::array<float, 2 * MIXER_CHANNELS>;
+
+// Unpositioned gains: mono to both outputs, stereo straight through.
+inline VoiceGains DefaultGains(int channels, float volume = 1.0f)
+{
+	if (channels == 1)
+		return { volume, volume, 0.0f, 0.0f };
+
+	return { volume, 0.0f, 0.0f, volume };
+}
+
+enum class MixerCommandType { Play, Stop, SetGains, SetPaused, SetDirection };
+
+struct MixerCommand
+{
+	MixerCommandType type{};
+	int voice{};
+	uint32_t id{};
+	std::shared_ptr<const SoundData> sound;
+	VoiceGains gains{};
+	float speed{ 1.0f };
+	bool loop{ false };
+	bool paused{ false };
+	std::shared_ptr<SoundStream> stream;
+	HrtfDirection direction{};
+	bool directional{ false };
+};
+
+// Software mixer with a fixed voice pool. Voices are controlled from the game thread,
+// which queues commands for the audio thread that calls Render(). Given an HRTF,
+// voices can also be played from a direction, rendered binaurally.
+class Mixer
+{
+public:
+	Mixer(int sample_rate, std::shared_ptr<const Hrtf> hrtf = nullptr);
+
+	// Game thread.
+	int Play(std::shared_ptr<const SoundData> sound, const VoiceGains& gains, float speed = 1.0f, bool loop = false, bool paused = false);
+	int Play(std::shared_ptr<SoundStream> stream, const VoiceGains& gains, float speed = 1.0f, bool loop = false, bool paused = false);
+	int Play(std::shared_ptr<const SoundData> sound, const HrtfDirection& direction, float speed = 1.0f, bool loop = false);
+	void Stop(int voice);
+	void SetGains(int voice, const VoiceGains& gains);
+	void SetDirection(int voice, const HrtfDirection& direction);
+	void SetPaused(int voice, bool paused);
+	bool IsActive(int voice) const;
+	int SampleRate() const { return m_sample_rate; }
+	bool HrtfEnabled() const { return !m_renderers.empty(); }
+
+	// Audio thread.
+	void Render(float* out, int frames);
+
+protected:
+	struct Voice
+	{
+		std::shared_ptr<const SoundData> sound;
+		std::shared_ptr<SoundStream> stream;	// source of further sound data, if streamed.
+		uint32_t id{};
+		double pos{};
+		double step{ 1.0 };
+		VoiceGains gains{};
+		bool loop{ false };
+		bool paused{ false };
+		bool directional{ false };
+	};
+
+	int Play(MixerCommand&& command);
+	void Post(MixerCommand&& command);
+	void Apply(MixerCommand& command);
+	void Finish(Voice& voice, int index);
+	bool NextSoundData(Voice& voice);
+	bool MixVoice(Voice& voice, float* out, int frames);
+	bool MixDirectional(Voice& voice, HrtfRenderer& renderer, float* out, int frames);
+	static void MixUnitRate(const Voice& voice, size_t src_frame, float* out, int frames);
+
+	int m_sample_rate{ 44100 };
+	SpscRing<MixerCommand, 256> m_commands;
+
+	// Game thread view of the voices, by the id of the last sound started on each.
+	std::array<uint32_t, MIXER_MAX_VOICES> m_ids{};
+	std::array<bool, MIXER_MAX_VOICES> m_stopped{};
+	uint32_t m_next_id{ 0 };
+
+	// Id of the sound each voice last finished, written by the audio thread.
+	std::array<std::atomic<uint32_t>, MIXER_MAX_VOICES> m_finished_ids{};
+
+	// Audio thread only.
+	std::array<Voice, MIXER_MAX_VOICES> m_voices;
+	std::vector<std::unique_ptr<HrtfRenderer>> m_renderers;	// one per voice, if HRTF is enabled.
+	std::array<float, MIXER_SCRATCH_FRAMES * MIXER_CHANNELS> m_scratch{};
+	std::array<float, MIXER_SCRATCH_FRAMES> m_mono{};
+};
+
+// Renders a busy mix without an audio device, to a WAV file if a path is given.
+int BenchmarkMixer(const std::wstring& wav_file);
+
+// Renders voices circling the listener through the HRTF, optionally to a WAV file.
+int BenchmarkHrtf(const std::wstring& wav_file);
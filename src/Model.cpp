@@ -1,6 +1,39 @@
 #include "stdafx.h"
 #include "Model.h"
 
+static PackedVertex PackVertex(const Vertex& v)
+{
+	PackedVertex packed;
+	packed.pos = XMHALF4(v.pos.x, v.pos.y, v.pos.z, 1.0f);
+
+	// Octahedral normal: project onto the octahedron, folding the lower half over.
+	auto& n = v.normal;
+	auto l1_norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	auto ox = l1_norm ? (n.x / l1_norm) : 0.0f;
+	auto oy = l1_norm ? (n.y / l1_norm) : 0.0f;
+	if (n.z < 0.0f)
+	{
+		auto fx = (1.0f - std::abs(oy)) * ((ox >= 0.0f) ? 1.0f : -1.0f);
+		auto fy = (1.0f - std::abs(ox)) * ((oy >= 0.0f) ? 1.0f : -1.0f);
+		ox = fx;
+		oy = fy;
+	}
+	packed.normal = XMSHORTN2(ox, oy);
+
+	// Landscape vertices may carry an alternate tile colour.
+	auto colour_idx = static_cast<uint8_t>(v.colour & 0xff);
+	auto alt_colour_idx = (v.colour & CHECKER_COLOUR_FLAG) ? static_cast<uint8_t>((v.colour >> 8) & 0xff) : colour_idx;
+
+	auto u = std::lround(v.texcoord.x * PACKED_TEXCOORD_SCALE);
+	auto w = std::lround(v.texcoord.y * PACKED_TEXCOORD_SCALE);
+	if (u < 0 || u > 0xff || w < 0 || w > 0xff)
+		throw std::exception("Texture coordinate outside packed vertex range");
+
+	packed.colour = XMUBYTE4(colour_idx, alt_colour_idx, static_cast<uint8_t>(u), static_cast<uint8_t>(w));
+
+	return packed;
+}
+
 /*static*/ Model Model::CreateBlock(float width, float height, float depth, uint32_t colour_idx, ModelType type)
 {
 	auto w = width / 2;
@@ -52,6 +85,131 @@
 	return model;
 }
 
+// Linear-speed vertex cache optimisation, after Tom Forsyth.
+/*static*/ std::vector<size_t> Model::CacheOptimisedTriangleOrder(const std::vector<uint32_t>& indices, size_t num_vertices)
+{
+	static constexpr int CACHE_SIZE = 32;
+	static constexpr auto NO_TRIANGLE = std::numeric_limits<size_t>::max();
+
+	auto num_triangles = indices.size() / 3;
+	std::vector<std::vector<size_t>> vertex_triangles(num_vertices);
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		for (int i = 0; i < 3; ++i)
+			vertex_triangles[indices[t * 3 + i]].push_back(t);
+	}
+
+	std::vector<int> cache_pos(num_vertices, -1);
+	std::vector<float> vertex_scores(num_vertices);
+
+	// Favour recently used vertices, and those with few remaining triangles.
+	auto score_vertex = [&](size_t v)
+	{
+		auto remaining = vertex_triangles[v].size();
+		if (!remaining)
+			return -1.0f;
+
+		auto score = 0.0f;
+		auto pos = cache_pos[v];
+		if (pos >= 0 && pos < 3)
+			score = 0.75f;
+		else if (pos >= 3)
+			score = std::pow(1.0f - (pos - 3) / static_cast<float>(CACHE_SIZE - 3), 1.5f);
+
+		return score + 2.0f / std::sqrt(static_cast<float>(remaining));
+	};
+
+	auto score_triangle = [&](size_t t)
+	{
+		return vertex_scores[indices[t * 3 + 0]] +
+			vertex_scores[indices[t * 3 + 1]] +
+			vertex_scores[indices[t * 3 + 2]];
+	};
+
+	for (size_t v = 0; v < num_vertices; ++v)
+		vertex_scores[v] = score_vertex(v);
+
+	auto best = NO_TRIANGLE;
+	auto best_score = -1.0f;
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		auto score = score_triangle(t);
+		if (score > best_score)
+		{
+			best = t;
+			best_score = score;
+		}
+	}
+
+	std::vector<size_t> order;
+	order.reserve(num_triangles);
+	std::vector<bool> added(num_triangles);
+	std::vector<uint32_t> cache;
+	size_t next_unadded = 0;
+
+	while (order.size() < num_triangles)
+	{
+		// Nothing in the cache has work left, so start on the next untouched triangle.
+		if (best == NO_TRIANGLE)
+		{
+			while (added[next_unadded])
+				++next_unadded;
+			best = next_unadded;
+		}
+
+		added[best] = true;
+		order.push_back(best);
+
+		// Move the triangle vertices to the front of the cache.
+		std::vector<uint32_t> new_cache;
+		new_cache.reserve(CACHE_SIZE + 3);
+		for (int i = 0; i < 3; ++i)
+		{
+			auto v = indices[best * 3 + i];
+			auto& tris = vertex_triangles[v];
+			tris.erase(std::remove(tris.begin(), tris.end(), best), tris.end());
+
+			if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+				new_cache.push_back(v);
+		}
+
+		for (auto v : cache)
+		{
+			if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+				new_cache.push_back(v);
+		}
+
+		// Rescore everything that moved, including vertices that fell out.
+		for (size_t i = 0; i < new_cache.size(); ++i)
+		{
+			cache_pos[new_cache[i]] = (i < CACHE_SIZE) ? static_cast<int>(i) : -1;
+			vertex_scores[new_cache[i]] = score_vertex(new_cache[i]);
+		}
+
+		if (new_cache.size() > CACHE_SIZE)
+			new_cache.resize(CACHE_SIZE);
+		cache = std::move(new_cache);
+
+		// Pick the best remaining triangle using a cached vertex.
+		best = NO_TRIANGLE;
+		best_score = -1.0f;
+		for (auto v : cache)
+		{
+			for (auto t : vertex_triangles[v])
+			{
+				auto score = score_triangle(t);
+				if (score > best_score)
+				{
+					best = t;
+					best_score = score;
+				}
+			}
+		}
+	}
+
+	return order;
+}
+
 Model::Model(
 	std::shared_ptr<std::vector<Vertex>>& pVertices,
 	std::shared_ptr<std::vector<uint32_t>>& pIndices,
@@ -87,12 +245,19 @@ Model::Model(
 		}
 	}
 
+	Pack();
+
 	// Determine the bounding box to eliminate unnecessary triangle ray testing.
+	// Use the packed positions, as seen by the GPU and ray tests.
+	std::vector<XMFLOAT3> positions(m_pPackedVertices->size());
+	for (size_t i = 0; i < positions.size(); ++i)
+		XMStoreFloat3(&positions[i], XMLoadHalf4(&(*m_pPackedVertices)[i].pos));
+
 	BoundingBox::CreateFromPoints(
 		m_boundingBox,
-		vertices.size(),
-		&vertices[0].pos,
-		sizeof(vertices[0]));
+		positions.size(),
+		positions.data(),
+		sizeof(positions[0]));
 }
 
 Model::operator bool() const
@@ -167,19 +332,8 @@ bool Model::RayTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, RayTarget& hit) const
 	if (!m_boundingBox.Intersects(vRayOrigin, vRayDir, dist))
 		return false;
 
-	auto& indices = *m_pIndices;
-	auto& vertices = *m_pVertices;
-
-	for (size_t idx = 0; idx < m_pIndices->size(); idx += 3)
+	auto test_triangle = [&](size_t idx, XMVECTOR V0, XMVECTOR V1, XMVECTOR V2)
 	{
-		auto& pos0 = vertices[indices[idx + 0]].pos;
-		auto& pos1 = vertices[indices[idx + 1]].pos;
-		auto& pos2 = vertices[indices[idx + 2]].pos;
-
-		auto V0 = XMVectorSet(pos0.x, pos0.y, pos0.z, 1.0f);
-		auto V1 = XMVectorSet(pos1.x, pos1.y, pos1.z, 1.0f);
-		auto V2 = XMVectorSet(pos2.x, pos2.y, pos2.z, 1.0f);
-
 		if (TriangleTests::Intersects(vRayOrigin, vRayDir, V0, V1, V2, dist))
 		{
 			if (dist < closest_dist)
@@ -188,6 +342,39 @@ bool Model::RayTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, RayTarget& hit) const
 				closest_idx = idx;
 			}
 		}
+	};
+
+	if (m_pPackedVertices)
+	{
+		// Decode the packed vertices, to match what's drawn.
+		auto& indices = *m_pPackedIndices;
+		auto& vertices = *m_pPackedVertices;
+
+		for (size_t idx = 0; idx < indices.size(); idx += 3)
+		{
+			test_triangle(idx,
+				XMLoadHalf4(&vertices[indices[idx + 0]].pos),
+				XMLoadHalf4(&vertices[indices[idx + 1]].pos),
+				XMLoadHalf4(&vertices[indices[idx + 2]].pos));
+		}
+	}
+	else
+	{
+		// Vertices have been edited since they were last packed.
+		auto& indices = *m_pIndices;
+		auto& vertices = *m_pVertices;
+
+		for (size_t idx = 0; idx < indices.size(); idx += 3)
+		{
+			auto& pos0 = vertices[indices[idx + 0]].pos;
+			auto& pos1 = vertices[indices[idx + 1]].pos;
+			auto& pos2 = vertices[indices[idx + 2]].pos;
+
+			test_triangle(idx,
+				XMVectorSet(pos0.x, pos0.y, pos0.z, 1.0f),
+				XMVectorSet(pos1.x, pos1.y, pos1.z, 1.0f),
+				XMVectorSet(pos2.x, pos2.y, pos2.z, 1.0f));
+		}
 	}
 
 	if (closest_idx < m_pIndices->size())
@@ -195,6 +382,7 @@ bool Model::RayTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, RayTarget& hit) const
 		hit.model = this;
 		hit.distance = closest_dist;
 		hit.index = closest_idx;
+		XMStoreFloat3(&hit.pos, XMVectorAdd(vRayOrigin, XMVectorScale(vRayDir, closest_dist)));
 		return true;
 	}
 
@@ -203,18 +391,27 @@ bool Model::RayTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, RayTarget& hit) const
 
 std::vector<XMFLOAT3> Model::GetTileVertices(int x, int z) const
 {
-	std::vector<XMFLOAT3> tile_vertices(ZX_VERTICES_PER_TILE);
-
-	auto& indices = *m_pIndices;
-	auto& vertices = *m_pVertices;
+	// Generated from the height field as the landscape triangles may be merged.
+	assert(type == ModelType::Landscape && m_pLandscapeTiles);
+	auto& landscape = *m_pLandscapeTiles;
+	auto& height_field = landscape.height_field;
 
-	// This function expects a landscape with 6 indices per tile.
-	assert(type == ModelType::Landscape);
-	assert(indices.size() == (SENTINEL_MAP_SIZE - 1) * (SENTINEL_MAP_SIZE - 1) * ZX_VERTICES_PER_TILE);
+	std::array<XMFLOAT3, 4> corners;
+	for (int zz = 0; zz < 2; ++zz)
+	{
+		for (int xx = 0; xx < 2; ++xx)
+		{
+			corners[zz * 2 + xx] = {
+				landscape.origin.x + (x + xx),
+				static_cast<float>(height_field.Height(x + xx, z + zz)),
+				landscape.origin.y + (z + zz) };
+		}
+	}
 
-	auto index_base = static_cast<int>(((z * (SENTINEL_MAP_SIZE - 1)) + x) * ZX_VERTICES_PER_TILE);
-	for (auto& v : tile_vertices)
-		v = vertices[indices[index_base++]].pos;
+	std::vector<XMFLOAT3> tile_vertices;
+	tile_vertices.reserve(ZX_VERTICES_PER_TILE);
+	for (auto corner : HeightField::TileCornerOrder(height_field.Shape(x, z)))
+		tile_vertices.push_back(corners[corner]);
 
 	return tile_vertices;
 }
@@ -241,8 +438,51 @@ std::vector<XMVECTOR> Model::GetTileCorners(int x, int z) const
 	return world_corners;
 }
 
+void Model::GetHitTile(const RayTarget& hit, int& tile_x, int& tile_z, int& tri_index) const
+{
+	assert(type == ModelType::Landscape && m_pLandscapeTiles);
+	auto& landscape = *m_pLandscapeTiles;
+	auto& tri = landscape.triangles[hit.index / 3];
+
+	// Merged triangles cover a range of tiles, so use the hit position to select one.
+	tile_x = static_cast<int>(std::floor(hit.pos.x - landscape.origin.x));
+	tile_z = static_cast<int>(std::floor(hit.pos.z - landscape.origin.y));
+	tile_x = std::max<int>(tri.x0, std::min<int>(tile_x, tri.x1));
+	tile_z = std::max<int>(tri.z0, std::min<int>(tile_z, tri.z1));
+	tri_index = tri.tri_index;
+}
+
 std::vector<Vertex>& Model::EditVertices()
 {
 	m_pHeapVertices.reset();
+	m_pPackedVertices.reset();
 	return *m_pVertices;
 }
+
+void Model::Pack()
+{
+	if (!m_pPackedVertices)
+	{
+		// Packed indices are 16-bit, so larger models can't be drawn.
+		auto& vertices = *m_pVertices;
+		if (vertices.size() > std::numeric_limits<uint16_t>::max() + 1)
+			throw std::exception("Too many vertices for 16-bit indices");
+
+		auto pPackedVertices = std::make_shared<std::vector<PackedVertex>>();
+		pPackedVertices->reserve(vertices.size());
+		for (auto& v : vertices)
+			pPackedVertices->push_back(PackVertex(v));
+
+		m_pPackedVertices = pPackedVertices;
+	}
+
+	if (!m_pPackedIndices)
+	{
+		auto& indices = *m_pIndices;
+		auto pPackedIndices = std::make_shared<std::vector<uint16_t>>(indices.size());
+		std::transform(indices.begin(), indices.end(), pPackedIndices->begin(),
+			[](uint32_t index) { return static_cast<uint16_t>(index); });
+
+		m_pPackedIndices = pPackedIndices;
+	}
+}
@@ -15,12 +15,54 @@ struct RayTarget
 	const Model* model{ nullptr };
 	float distance{ 0.0f };
 	size_t index{ 0 };
+	XMFLOAT3 pos{};		// model space
+};
+
+// Source tiles of a landscape triangle, which may span several merged tiles.
+struct LandscapeTriangle
+{
+	uint8_t x0{}, z0{};
+	uint8_t x1{}, z1{};		// inclusive
+	uint8_t tri_index{};	// triangle within an unmerged tile
+};
+
+// Landscape vertex heights and tile shapes, ignoring any objects placed on them.
+struct HeightField
+{
+	uint8_t Height(int x, int z) const { return entries[z * SENTINEL_MAP_SIZE + x] >> 4; }
+	uint8_t Shape(int x, int z) const { return entries[z * SENTINEL_MAP_SIZE + x] & 0xf; }
+
+	// Tile corners (z * 2 + x) used by the two tile triangles.
+	static std::array<int, ZX_VERTICES_PER_TILE> TileCornerOrder(uint8_t tile_shape)
+	{
+		switch (tile_shape)
+		{
+		case 0b0110:	// outside corner, facing front right
+		case 0b0111:	// inside corner, facing front right
+		case 0b1110:	// outside edge, facing back left
+		case 0b1111:	// inside edge, facing back left
+			return { 0, 2, 1, 1, 2, 3 };
+
+		default:
+			return { 0, 2, 3, 0, 3, 1 };
+		}
+	}
+
+	std::array<uint8_t, SENTINEL_MAP_SIZE * SENTINEL_MAP_SIZE> entries{};	// height << 4 | shape
+};
+
+struct LandscapeTiles
+{
+	XMFLOAT2 origin{};							// model x/z of map vertex 0,0
+	std::vector<LandscapeTriangle> triangles;	// one per landscape triangle
+	HeightField height_field;
 };
 
 class Model
 {
 public:
 	static Model CreateBlock(float width, float height, float depth, uint32_t colour_idx, ModelType type);
+	static std::vector<size_t> CacheOptimisedTriangleOrder(const std::vector<uint32_t>& indices, size_t num_vertices);
 
 	Model() = default;
 	Model(
@@ -36,9 +78,11 @@ public:
 	std::vector<XMVECTOR> GetBoundingBox() const;
 	std::vector<XMFLOAT3> GetTileVertices(int x, int z) const;
 	std::vector<XMVECTOR> GetTileCorners(int x, int z) const;
+	void GetHitTile(const RayTarget& hit, int& tile_x, int& tile_z, int& tri_index) const;
 	bool RayTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, RayTarget& hit) const;
 	bool BoxTest(XMVECTOR vRayOrigin, XMVECTOR vRayDir, float& dist) const;
 	std::vector<Vertex>& EditVertices();
+	void Pack();
 
 	int id{ -1 };
 	ModelType type{ ModelType::Unknown };
@@ -51,9 +95,12 @@ public:
 
 	std::shared_ptr<std::vector<Vertex>> m_pVertices;
 	std::shared_ptr<std::vector<uint32_t>> m_pIndices;
+	std::shared_ptr<std::vector<PackedVertex>> m_pPackedVertices;
+	std::shared_ptr<std::vector<uint16_t>> m_pPackedIndices;
 	std::shared_ptr<D3D11HeapAllocation> m_pHeapVertices;
 	std::shared_ptr<D3D11HeapAllocation> m_pHeapIndices;
 	BoundingBox m_boundingBox;
+	std::shared_ptr<LandscapeTiles> m_pLandscapeTiles;
 
 	ComPtr<ID3D11VertexShader> m_pVertexShader;
 	ComPtr<ID3D11PixelShader> m_pPixelShader;
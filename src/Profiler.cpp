@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "Profiler.h"
+
+static constexpr size_t MAX_CALL_DEPTH = 256;
+static constexpr size_t REPORT_TOP_ROUTINES = 50;
+static constexpr size_t REPORT_TOP_PCS = 100;
+static constexpr size_t REPORT_TOP_CALLS = 100;
+static constexpr int MAX_SYMBOL_OFFSET = 0x100;	// beyond this an address is left unnamed.
+
+// Known Sentinel locations, as used by the hooks and patches in Spectrum.cpp.
+static const std::map<uint16_t, std::string> sentinel_symbols
+{
+	{ 0x7648, "target_tile_check" },
+	{ 0x7fe5, "title_wait_key" },
+	{ 0x7ff8, "landscape_prompt" },
+	{ 0x822c, "read_action_key" },
+	{ 0x839d, "player_object_change" },
+	{ 0x85a9, "secret_code_check" },
+	{ 0x9007, "enemy_object_change" },
+	{ 0x9362, "multiply" },
+	{ 0xa528, "map_entry" },
+	{ 0xad1f, "random" },
+	{ 0xafa9, "secret_code_generate" },
+	{ 0xafc9, "rng_seed_landscape" },
+	{ 0xb1b0, "place_models" },
+	{ 0xb2bc, "player_view" },
+	{ 0xb342, "hide_energy_panel" },
+	{ 0xb8ff, "wait_key_press" },
+	{ 0xbb34, "player_out_of_energy" },
+	{ 0xbb58, "screen_disintegrate" },
+	{ 0xbbfd, "play_tune" },
+	{ 0xbcaf, "sound_effect" },
+	{ 0xbd64, "draw_energy_symbol" },
+	{ 0xbd97, "im2_handler_return" },
+};
+
+static std::mutex profile_mutex;
+static std::atomic<bool> profiling_enabled{ false };
+static std::unique_ptr<ProfileData> total_profile;
+
+void ProfileData::Merge(const ProfileData& other)
+{
+	for (size_t i = 0; i < pcs.size(); ++i)
+	{
+		pcs[i].instructions += other.pcs[i].instructions;
+		pcs[i].cycles += other.pcs[i].cycles;
+		routines[i].instructions += other.routines[i].instructions;
+		routines[i].cycles += other.routines[i].cycles;
+	}
+
+	for (auto& [edge, count] : other.calls)
+		calls[edge] += count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Profiler::OnInstruction(const std::vector<uint8_t>& mem, uint16_t pc, uint16_t sp, uint8_t cycles, uint16_t new_pc, uint16_t new_sp)
+{
+	// Hook breakpoints take no time, and their real instruction is profiled separately.
+	if (!cycles)
+		return;
+
+	// Interrupts and hook handlers can push or pop between instructions.
+	if (pc != m_next_pc)
+	{
+		if (sp == static_cast<uint16_t>(m_sp - 2))
+			EnterRoutine(pc);
+		else if (sp == static_cast<uint16_t>(m_sp + 2))
+			LeaveRoutine();
+	}
+
+	m_data.pcs[pc].instructions++;
+	m_data.pcs[pc].cycles += cycles;
+	m_data.routines[Routine()].instructions++;
+	m_data.routines[Routine()].cycles += cycles;
+
+	auto opcode = mem[pc];
+	auto is_call = opcode == 0xcd || (opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc7;	// CALL, CALL cc, RST
+	auto is_ret = opcode == 0xc9 || (opcode & 0xc7) == 0xc0 ||								// RET, RET cc
+		(opcode == 0xed && (mem[static_cast<uint16_t>(pc + 1)] & 0xc7) == 0x45);			// RETI, RETN
+
+	// Conditional calls and returns only count if taken.
+	if (is_call && new_sp == static_cast<uint16_t>(sp - 2))
+		EnterRoutine(new_pc);
+	else if (is_ret && new_sp == static_cast<uint16_t>(sp + 2))
+		LeaveRoutine();
+
+	m_next_pc = new_pc;
+	m_sp = new_sp;
+}
+
+void Profiler::EnterRoutine(uint16_t entry)
+{
+	m_data.calls[{ Routine(), entry }]++;
+
+	// Code that discards return addresses would otherwise grow the stack forever.
+	if (m_call_stack.size() >= MAX_CALL_DEPTH)
+		m_call_stack.erase(m_call_stack.begin());
+
+	m_call_stack.push_back(entry);
+}
+
+void Profiler::LeaveRoutine()
+{
+	if (!m_call_stack.empty())
+		m_call_stack.pop_back();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void EnableProfiling()
+{
+	profiling_enabled = true;
+}
+
+bool ProfilingEnabled()
+{
+	return profiling_enabled;
+}
+
+void MergeProfile(const ProfileData& data)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+
+	if (!total_profile)
+		total_profile = std::make_unique<ProfileData>();
+
+	total_profile->Merge(data);
+}
+
+// Symbol file lines are a hex address and a name, with # for comments.
+static bool LoadSymbols(const std::wstring& symbols_file, std::map<uint16_t, std::string>& symbols)
+{
+	symbols = sentinel_symbols;
+
+	if (!symbols_file.empty())
+	{
+		std::ifstream file(symbols_file);
+		if (!file)
+			return false;
+
+		for (std::string line; std::getline(file, line);)
+		{
+			line = line.substr(0, line.find('#'));
+
+			std::istringstream ss(line);
+			uint32_t address{};
+			std::string name;
+			if (ss >> std::hex >> address >> name && address <= 0xffff)
+				symbols[static_cast<uint16_t>(address)] = name;
+		}
+	}
+
+	return true;
+}
+
+// Name an address by the nearest symbol at or below it, if close enough.
+static std::string SymbolName(const std::map<uint16_t, std::string>& symbols, uint16_t address)
+{
+	std::stringstream ss;
+	ss << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << address;
+
+	auto it = symbols.upper_bound(address);
+	if (it != symbols.begin() && address - std::prev(it)->first < MAX_SYMBOL_OFFSET)
+	{
+		--it;
+		ss << " " << it->second;
+		if (it->first != address)
+			ss << "+" << std::dec << (address - it->first);
+	}
+
+	return ss.str();
+}
+
+bool WriteProfileReport(const std::wstring& report_file, const std::wstring& symbols_file)
+{
+	std::lock_guard<std::mutex> lock(profile_mutex);
+
+	if (!total_profile)
+		return false;
+
+	std::map<uint16_t, std::string> symbols;
+	if (!LoadSymbols(symbols_file, symbols))
+		return false;
+
+	std::ofstream file(report_file);
+	if (!file)
+		return false;
+
+	auto& data = *total_profile;
+
+	ProfileCounts total;
+	for (auto& counts : data.pcs)
+	{
+		total.instructions += counts.instructions;
+		total.cycles += counts.cycles;
+	}
+
+	auto percent = [&](uint64_t cycles)
+	{
+		return total.cycles ? 100.0 * cycles / total.cycles : 0.0;
+	};
+
+	// Sorted indices of the non-zero entries with the most cycles.
+	auto top = [](const std::vector<ProfileCounts>& counts, size_t max_entries)
+	{
+		std::vector<uint16_t> indices;
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			if (counts[i].cycles)
+				indices.push_back(static_cast<uint16_t>(i));
+		}
+
+		std::sort(indices.begin(), indices.end(), [&](auto a, auto b) { return counts[a].cycles > counts[b].cycles; });
+		indices.resize(std::min(indices.size(), max_entries));
+		return indices;
+	};
+
+	file << "Total: " << total.instructions << " instructions, " << total.cycles << " cycles\n";
+	file << std::fixed << std::setprecision(2);
+
+	file << "\nRoutines by self cycles (0000 is code outside any call):\n";
+	for (auto entry : top(data.routines, REPORT_TOP_ROUTINES))
+	{
+		auto& counts = data.routines[entry];
+		file << std::setw(6) << percent(counts.cycles) << "%  " << std::setw(12) << counts.cycles << " cycles  "
+			<< std::setw(10) << counts.instructions << " instrs  " << SymbolName(symbols, entry) << "\n";
+	}
+
+	file << "\nHottest instructions:\n";
+	for (auto pc : top(data.pcs, REPORT_TOP_PCS))
+	{
+		auto& counts = data.pcs[pc];
+		file << std::setw(6) << percent(counts.cycles) << "%  " << std::setw(12) << counts.cycles << " cycles  "
+			<< std::setw(10) << counts.instructions << " instrs  " << SymbolName(symbols, pc) << "\n";
+	}
+
+	std::vector<std::pair<std::pair<uint16_t, uint16_t>, uint64_t>> calls(data.calls.begin(), data.calls.end());
+	std::sort(calls.begin(), calls.end(), [](auto& a, auto& b) { return a.second > b.second; });
+	calls.resize(std::min(calls.size(), REPORT_TOP_CALLS));
+
+	file << "\nMost frequent calls:\n";
+	for (auto& [edge, count] : calls)
+		file << std::setw(12) << count << "  " << SymbolName(symbols, edge.first) << " -> " << SymbolName(symbols, edge.second) << "\n";
+
+	return true;
+}
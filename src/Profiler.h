@@ -0,0 +1,40 @@
+#pragma once
+
+struct ProfileCounts
+{
+	uint64_t instructions{};
+	uint64_t cycles{};
+};
+
+// Z80 execution profile, gathered by a single emulation.
+struct ProfileData
+{
+	std::vector<ProfileCounts> pcs = std::vector<ProfileCounts>(0x10000);			// by instruction address.
+	std::vector<ProfileCounts> routines = std::vector<ProfileCounts>(0x10000);	// self time, by routine entry.
+	std::map<std::pair<uint16_t, uint16_t>, uint64_t> calls;					// caller and callee entries.
+
+	void Merge(const ProfileData& other);
+};
+
+// Tracks the routine being executed from CALL/RET instructions, to attribute cycles.
+class Profiler
+{
+public:
+	void OnInstruction(const std::vector<uint8_t>& mem, uint16_t pc, uint16_t sp, uint8_t cycles, uint16_t new_pc, uint16_t new_sp);
+	const ProfileData& Data() const { return m_data; }
+
+protected:
+	uint16_t Routine() const { return m_call_stack.empty() ? 0 : m_call_stack.back(); }
+	void EnterRoutine(uint16_t entry);
+	void LeaveRoutine();
+
+	ProfileData m_data;
+	std::vector<uint16_t> m_call_stack;
+	uint16_t m_next_pc{};
+	uint16_t m_sp{};
+};
+
+void EnableProfiling();
+bool ProfilingEnabled();
+void MergeProfile(const ProfileData& data);
+bool WriteProfileReport(const std::wstring& report_file, const std::wstring& symbols_file);
@@ -0,0 +1,301 @@
+#include "stdafx.h"
+#include "ReplayService.h"
+#include "Journal.h"
+#include "LandscapeCodes.h"
+#include "Settings.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+// Runs the worker on every core until each returns, giving the number of workers used.
+static unsigned RunWorkers(const std::function<void()>& worker)
+{
+	auto num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < num_workers; ++i)
+		workers.emplace_back(worker);
+
+	for (auto& t : workers)
+		t.join();
+
+	return num_workers;
+}
+
+int VerifyJournals(const std::wstring& source)
+{
+	std::vector<std::wstring> files;
+	size_t next_file = 0;
+	auto from_stdin = source == L"-";
+
+	if (!from_stdin)
+	{
+		if (!fs::is_directory(source))
+			files.push_back(source);
+		else
+		{
+			for (auto& p : fs::directory_iterator(source))
+			{
+				if (p.path().extension() == JOURNAL_EXTENSION)
+					files.push_back(p.path());
+			}
+
+			std::sort(files.begin(), files.end());
+		}
+	}
+
+	std::mutex mutex;
+	size_t num_sessions = 0, num_passed = 0;
+	uint64_t total_frames = 0;
+
+	// Fetch the next journal to replay, with the mutex held.
+	auto next_journal = [&](std::wstring& filename)
+	{
+		if (from_stdin)
+		{
+			std::string line;
+			while (std::getline(std::cin, line))
+			{
+				if (!line.empty())
+				{
+					filename = to_wstring(line);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		if (next_file >= files.size())
+			return false;
+
+		filename = files[next_file++];
+		return true;
+	};
+
+	// Each session has its own Spectrum, so workers share nothing but the job list and totals.
+	auto worker = [&]
+	{
+		std::wstring filename;
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!next_journal(filename))
+					return;
+			}
+
+			auto session_start = Clock::now();
+			auto result = ReplayJournal(filename);
+			auto session_time = std::chrono::duration<float>(Clock::now() - session_start).count();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			num_sessions++;
+			num_passed += result.passed ? 1 : 0;
+			total_frames += result.frames;
+
+			printf("%s %s: %zu commands, %llu frames, %.3fs", result.passed ? "PASS" : "FAIL",
+				to_string(filename).c_str(), result.commands, static_cast<unsigned long long>(result.frames), session_time);
+
+			if (result.complete)
+				printf(", landscape %04X code %08X", result.landscape_bcd, result.secret_code_bcd);
+
+			if (!result.passed)
+				printf(" (%s)", result.error.c_str());
+
+			printf("\n");
+			fflush(stdout);
+		}
+	};
+
+	auto start_time = Clock::now();
+
+	auto num_workers = RunWorkers(worker);
+
+	auto total_time = std::chrono::duration<float>(Clock::now() - start_time).count();
+	total_time = std::max(total_time, 0.001f);
+
+	printf("%zu sessions, %zu passed, %u workers, %.2fs, %.1f sessions/sec, %.0f frames/sec\n",
+		num_sessions, num_passed, num_workers, total_time,
+		num_sessions / total_time, total_frames / total_time);
+	fflush(stdout);
+
+	return (num_passed == num_sessions) ? 0 : 1;
+}
+
+int CheckDisplayPatches(int num_landscapes)
+{
+	constexpr auto max_state_frames = 1000;
+	constexpr auto game_frames = 250;
+
+	// Title screen, landscape preview, then into the game.
+	constexpr auto num_state_changes = 3;
+
+	std::map<uint16_t, DisplayWriteStats> display_writes;
+	std::vector<uint16_t> patches;
+	int num_passed = 0;
+
+	for (int i = 0; i < num_landscapes; ++i)
+	{
+		auto landscape_bcd = to_bcd(i);
+
+		// Invalid codes are accepted, so any code will do.
+		Emulation original(SENTINEL_SNAPSHOT_FILE, landscape_bcd, 0, nullptr, false, false);
+		Emulation patched(SENTINEL_SNAPSHOT_FILE, landscape_bcd, 0, nullptr, false, true);
+		patches = patched.GetSpectrum().GetDisplayPatches();
+
+		std::string error;
+		float times[2]{};
+
+		auto run = [&](const EmulationCommand& command)
+		{
+			Emulation* emulations[]{ &original, &patched };
+			bool ok[2]{};
+
+			for (int j = 0; j < 2; ++j)
+			{
+				auto start_time = Clock::now();
+				ok[j] = emulations[j]->Run(command);
+				times[j] += std::chrono::duration<float>(Clock::now() - start_time).count();
+
+				EmulationEvent event;
+				while (emulations[j]->PollEvent(event));
+			}
+
+			if (ok[0] != ok[1])
+				error = "game state reached by only one emulation";
+			else if (original.GetSpectrum().GameTablesHash() != patched.GetSpectrum().GameTablesHash())
+				error = "object tables, map or codes differ";
+
+			return ok[0] && error.empty();
+		};
+
+		auto passed = true;
+		for (int j = 0; j < num_state_changes && passed; ++j)
+			passed = run({ EmulationCommandType::RunUntilStateChange, max_state_frames });
+
+		// Idle in the game, which still draws the view, panel and effects.
+		for (int j = 0; j < game_frames && passed; ++j)
+		{
+			EmulationCommand command{ EmulationCommandType::RunGameFrame, 1 };
+			command.run_frame = true;
+			passed = run(command);
+		}
+
+		if (passed)
+			num_passed++;
+		else if (error.empty())
+			error = "failed to reach the game";
+
+		for (auto& [pc, stats] : patched.GetSpectrum().GetDisplayWriteStats())
+		{
+			auto& total = display_writes[pc];
+			total.caller = stats.caller;
+			total.writes += stats.writes;
+		}
+
+		printf("%s landscape %04X: %.3fs original, %.3fs patched", passed ? "PASS" : "FAIL", landscape_bcd, times[0], times[1]);
+		if (!passed)
+			printf(" (%s)", error.c_str());
+		printf("\n");
+		fflush(stdout);
+	}
+
+	printf("%d landscapes, %d passed, %zu display patches\n", num_landscapes, num_passed, patches.size());
+
+	// Any remaining writes, if DisplayWriteTrace is enabled.
+	for (auto& [pc, stats] : display_writes)
+	{
+		printf("  display write at %04X (called from %04X): %llu writes\n",
+			pc, stats.caller, static_cast<unsigned long long>(stats.writes));
+	}
+
+	fflush(stdout);
+
+	return (num_passed == num_landscapes) ? 0 : 1;
+}
+
+int GenerateLandscapes(int first_landscape, int num_landscapes)
+{
+	constexpr auto max_state_frames = 1000;
+
+	// Landscape numbers are 0000 to 9999, or to DFFF with hex landscapes enabled.
+	// The game wraps anything higher back to 0000, so those would only repeat earlier codes.
+	auto hex_landscapes = GetFlag(HEX_LANDSCAPES_KEY, DEFAULT_HEX_LANDSCAPES);
+	auto end_landscape = hex_landscapes ? 0xe000 : 10000;
+	first_landscape = std::max(std::min(first_landscape, end_landscape - 1), 0);
+	num_landscapes = std::max(std::min(num_landscapes, end_landscape - first_landscape), 0);
+
+	auto landscape_bcd = [&](int i)
+	{
+		return hex_landscapes ? first_landscape + i : to_bcd(first_landscape + i);
+	};
+
+	struct LandscapeResult
+	{
+		bool generated{ false };
+		uint32_t secret_code_bcd{ 0 };
+	};
+
+	std::vector<LandscapeResult> results(num_landscapes);
+	std::atomic<int> next_landscape{ 0 };
+	std::atomic<uint64_t> total_frames{ 0 };
+
+	// Landscapes are independent, so workers only share the next index.
+	auto worker = [&]
+	{
+		for (int i; (i = next_landscape++) < num_landscapes;)
+		{
+			auto& result = results[i];
+
+			try
+			{
+				// Invalid codes are accepted, and the correct one is captured as it's checked.
+				Emulation emulation(SENTINEL_SNAPSHOT_FILE, landscape_bcd(i), 0, nullptr, false);
+
+				// Title screen, then the generated landscape.
+				result.generated =
+					emulation.Run({ EmulationCommandType::RunUntilStateChange, max_state_frames }) &&
+					emulation.Run({ EmulationCommandType::RunUntilStateChange, max_state_frames });
+
+				result.secret_code_bcd = emulation.GetSpectrum().GetExpectedSecretCode();
+				total_frames += emulation.FrameCount();
+			}
+			catch (std::exception&)
+			{
+				result.generated = false;
+			}
+		}
+	};
+
+	auto start_time = Clock::now();
+
+	auto num_workers = RunWorkers(worker);
+
+	auto total_time = std::chrono::duration<float>(Clock::now() - start_time).count();
+	total_time = std::max(total_time, 0.001f);
+
+	// Generated codes are added to the codes file used by the game, in landscape order.
+	LandscapeCodes codes;
+	auto codes_path = LandscapeCodes::DefaultPath();
+	codes.Load(codes_path);
+
+	int num_generated = 0;
+	for (int i = 0; i < num_landscapes; ++i)
+	{
+		auto& result = results[i];
+		if (result.generated)
+		{
+			num_generated++;
+			codes.Add(landscape_bcd(i), result.secret_code_bcd);
+			printf("%04X: %08X\n", landscape_bcd(i), result.secret_code_bcd);
+		}
+		else
+			printf("%04X: failed to generate\n", landscape_bcd(i));
+	}
+
+	printf("%d landscapes, %d generated, %u workers, %.2fs, %.1f landscapes/sec, %.0f frames/sec\n",
+		num_landscapes, num_generated, num_workers, total_time,
+		num_landscapes / total_time, total_frames / total_time);
+	printf("%zu codes in %s\n", codes.Size(), codes_path.string().c_str());
+	fflush(stdout);
+
+	return (num_generated == num_landscapes) ? 0 : 1;
+}
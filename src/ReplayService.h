@@ -0,0 +1,17 @@
+#pragma once
+
+static constexpr auto JOURNAL_EXTENSION = L".journal";
+
+// Replays recorded session journals across all cores, to verify completed landscapes.
+// The source is a journal file, a directory of journals, or "-" for a list of paths on stdin.
+// The tiles targeted by each action are replayed from the journal, as they came from the 3D
+// scene, so a pass shows the game accepts them but not that the player could see them.
+int VerifyJournals(const std::wstring& source);
+
+// Plays the opening of each landscape with and without the display patches, checking
+// the object tables, map and codes are unaffected. Also reports any remaining display writes.
+int CheckDisplayPatches(int num_landscapes);
+
+// Generates landscapes across all cores, adding each secret code to the landscape codes file.
+// Landscape numbers are decimal, or hex up to DFFF if the HexLandscapes option is enabled.
+int GenerateLandscapes(int first_landscape, int num_landscapes);
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "Resampler.h"
+
+static constexpr double RESAMPLER_KAISER_BETA = 8.0;
+static constexpr double RESAMPLER_BANDWIDTH = 0.95;	// fraction of the lower Nyquist frequency kept.
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+static double BesselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; ++k)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+
+	return sum;
+}
+
+Resampler::Resampler(int from_rate, int to_rate)
+	: m_from_rate(from_rate), m_to_rate(to_rate)
+{
+	if (from_rate <= 0 || to_rate <= 0)
+		throw std::exception("invalid resampler rates");
+
+	// Low-pass below the lower of the two Nyquist frequencies, in cycles per input sample.
+	auto cutoff = 0.5 * RESAMPLER_BANDWIDTH * std::min(1.0, static_cast<double>(to_rate) / from_rate);
+	auto half_taps = RESAMPLER_TAPS / 2;
+
+	// Row p holds the taps for an output sample p/RESAMPLER_PHASES of the way between
+	// two input samples, with an extra row to interpolate towards the next sample.
+	m_bank.resize((RESAMPLER_PHASES + 1) * RESAMPLER_TAPS);
+	for (int p = 0; p <= RESAMPLER_PHASES; ++p)
+	{
+		auto row = &m_bank[p * RESAMPLER_TAPS];
+		auto frac = static_cast<double>(p) / RESAMPLER_PHASES;
+
+		double sum = 0.0;
+		for (int k = 0; k < RESAMPLER_TAPS; ++k)
+		{
+			auto t = frac + half_taps - 1 - k;
+			auto x = 2.0 * cutoff * t;
+			auto sinc = (x == 0.0) ? 1.0 : std::sin(XM_PI * x) / (XM_PI * x);
+
+			auto w = t / half_taps;
+			auto window = (std::fabs(w) < 1.0) ? BesselI0(RESAMPLER_KAISER_BETA * std::sqrt(1.0 - w * w)) / BesselI0(RESAMPLER_KAISER_BETA) : 0.0;
+
+			row[k] = static_cast<float>(sinc * window);
+			sum += row[k];
+		}
+
+		// Unity gain at DC for every phase.
+		for (int k = 0; k < RESAMPLER_TAPS; ++k)
+			row[k] = static_cast<float>(row[k] / sum);
+	}
+}
+
+std::shared_ptr<SoundData> Resampler::Process(const SoundData& sound) const
+{
+	auto out = std::make_shared<SoundData>();
+	out->channels = sound.channels;
+	out->sample_rate = m_to_rate;
+
+	auto in_frames = sound.Frames();
+	auto out_frames = static_cast<size_t>((static_cast<uint64_t>(in_frames) * m_to_rate + m_from_rate - 1) / m_from_rate);
+	out->samples.resize(out_frames * sound.channels);
+
+	// Each channel is filtered separately, from a copy padded with silence for the filter edges.
+	std::vector<float> padded(in_frames + RESAMPLER_TAPS);
+	for (int c = 0; c < sound.channels; ++c)
+	{
+		for (size_t i = 0; i < in_frames; ++i)
+			padded[RESAMPLER_TAPS / 2 + i] = sound.samples[i * sound.channels + c];
+
+		ProcessChannel(padded.data(), in_frames, out->samples.data() + c, out_frames, sound.channels);
+	}
+
+	return out;
+}
+
+void Resampler::ProcessChannel(const float* in, size_t in_frames, float* out, size_t out_frames, int stride) const
+{
+	for (size_t n = 0; n < out_frames; ++n)
+	{
+		// Exact input position, as a whole frame and a fraction.
+		auto pos = static_cast<uint64_t>(n) * m_from_rate;
+		auto frame = static_cast<size_t>(pos / m_to_rate);
+		auto frac = static_cast<float>(pos % m_to_rate) / m_to_rate * RESAMPLER_PHASES;
+
+		auto phase = std::min(static_cast<int>(frac), RESAMPLER_PHASES - 1);
+		auto t = XMVectorReplicate(frac - phase);
+		auto row0 = &m_bank[phase * RESAMPLER_TAPS];
+		auto row1 = row0 + RESAMPLER_TAPS;
+
+		// The padding offset cancels the filter's centre, so taps start at the frame itself.
+		auto src = in + frame + 1;
+		auto sum = XMVectorZero();
+		for (int k = 0; k < RESAMPLER_TAPS; k += 4)
+		{
+			auto c0 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row0 + k));
+			auto c1 = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row1 + k));
+			auto x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(src + k));
+			sum = XMVectorMultiplyAdd(x, XMVectorLerpV(c0, c1, t), sum);
+		}
+
+		out[n * stride] = XMVectorGetX(XMVector4Dot(sum, g_XMOne));
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "SoundData.h"
+
+static constexpr int RESAMPLER_TAPS = 32;		// per phase, a multiple of 4.
+static constexpr int RESAMPLER_PHASES = 256;	// filter phases, interpolated between.
+
+// Windowed sinc polyphase resampler, for converting sounds to the mix rate once
+// at load time rather than on every play.
+class Resampler
+{
+public:
+	Resampler(int from_rate, int to_rate);
+
+	std::shared_ptr<SoundData> Process(const SoundData& sound) const;
+
+protected:
+	void ProcessChannel(const float* in, size_t in_frames, float* out, size_t out_frames, int stride) const;
+
+	int m_from_rate{ 0 };
+	int m_to_rate{ 0 };
+	std::vector<float> m_bank;	// RESAMPLER_PHASES + 1 rows of RESAMPLER_TAPS coefficients.
+};
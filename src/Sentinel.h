@@ -37,6 +37,9 @@ constexpr float EYE_HEIGHT = 0.875f;
 
 constexpr uint32_t SPECTRUM_LANDSCAPE_0000_CODE = 0x75914644;
 
+// Tune number played by the game when a landscape is completed.
+constexpr int SENTINEL_COMPLETE_TUNE = 0x42;
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // Model face colours from the DOS version.
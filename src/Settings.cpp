@@ -1,8 +1,396 @@
 #include "stdafx.h"
 #include "Settings.h"
 
+static constexpr auto SETTINGS_FLUSH_DELAY = std::chrono::milliseconds(500);
+
 std::wstring settings_path;
 
+// Settings file parsed once into memory, with changes written back in the background
+// once they've settled. Lines are kept as read, so comments and ordering survive.
+class SettingsStore
+{
+public:
+	~SettingsStore() { Flush(); }
+
+	void Load(const fs::path& path);
+	bool Get(const std::wstring& section, const std::wstring& key, std::wstring& value);
+	std::vector<std::wstring> Keys(const std::wstring& section);
+	void Set(const std::wstring& section, const std::wstring& key, const std::wstring* value);
+	void SetSection(const std::wstring& section, const std::vector<std::pair<std::wstring, std::wstring>>& values);
+	void Flush();
+
+protected:
+	static std::wstring Trim(const std::wstring& str);
+	static std::wstring Lower(const std::wstring& str);
+	static std::wstring Index(const std::wstring& section, const std::wstring& key);
+	static bool ParseEntry(const std::wstring& line, std::wstring& key, std::wstring& value);
+	static bool ParseSection(const std::wstring& line, std::wstring& section);
+	static void SaveFile(const fs::path& path, bool utf16, const std::wstring& text);
+	void Changed(std::unique_lock<std::mutex>& lock);
+	void FlushThread();
+	void Write(std::unique_lock<std::mutex>& lock);
+
+	std::mutex m_mutex;
+	std::mutex m_write_mutex;	// keeps file writes in order, without blocking changes.
+	fs::path m_path;
+	bool m_utf16{ false };
+	std::vector<std::wstring> m_lines;
+	std::unordered_map<std::wstring, std::wstring> m_values;	// by lower-case section and key.
+
+	std::thread m_thread;
+	std::condition_variable m_cv;
+	std::chrono::steady_clock::time_point m_changed_time;
+	bool m_dirty{ false };
+	bool m_stop{ false };
+};
+
+static SettingsStore settings_store;
+
+/*static*/ std::wstring SettingsStore::Trim(const std::wstring& str)
+{
+	auto start = str.find_first_not_of(L" \t\r");
+	auto end = str.find_last_not_of(L" \t\r");
+	return (start == std::wstring::npos) ? L"" : str.substr(start, end - start + 1);
+}
+
+/*static*/ std::wstring SettingsStore::Lower(const std::wstring& str)
+{
+	auto lower = str;
+	CharLowerBuff(lower.data(), static_cast<DWORD>(lower.size()));
+	return lower;
+}
+
+// Sections and keys are case-insensitive, as with the profile API.
+/*static*/ std::wstring SettingsStore::Index(const std::wstring& section, const std::wstring& key)
+{
+	return Lower(section) + L'\n' + Lower(key);
+}
+
+/*static*/ bool SettingsStore::ParseSection(const std::wstring& line, std::wstring& section)
+{
+	auto trimmed = Trim(line);
+	if (trimmed.size() < 2 || trimmed.front() != L'[' || trimmed.back() != L']')
+		return false;
+
+	section = Trim(trimmed.substr(1, trimmed.size() - 2));
+	return true;
+}
+
+/*static*/ bool SettingsStore::ParseEntry(const std::wstring& line, std::wstring& key, std::wstring& value)
+{
+	auto trimmed = Trim(line);
+	auto equals = trimmed.find(L'=');
+	if (trimmed.empty() || trimmed[0] == L';' || equals == std::wstring::npos)
+		return false;
+
+	key = Trim(trimmed.substr(0, equals));
+	value = Trim(trimmed.substr(equals + 1));
+
+	// Surrounding quotes are removed, as GetPrivateProfileString does.
+	if (value.size() >= 2 && value.front() == L'"' && value.back() == L'"')
+		value = value.substr(1, value.size() - 2);
+
+	return !key.empty();
+}
+
+void SettingsStore::Load(const fs::path& path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_path = path;
+	m_lines.clear();
+	m_values.clear();
+
+	std::ifstream file(path, std::ios::binary);
+	std::string bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+	// The profile API writes ANSI files, but reads UTF-16 ones with a BOM.
+	std::wstring text;
+	m_utf16 = bytes.size() >= 2 && static_cast<uint8_t>(bytes[0]) == 0xff && static_cast<uint8_t>(bytes[1]) == 0xfe;
+	if (m_utf16)
+		text.assign(reinterpret_cast<const wchar_t*>(bytes.data() + 2), (bytes.size() - 2) / sizeof(wchar_t));
+	else if (!bytes.empty())
+	{
+		text.resize(bytes.size());
+		auto len = MultiByteToWideChar(CP_ACP, 0, bytes.data(), static_cast<int>(bytes.size()), text.data(), static_cast<int>(text.size()));
+		text.resize(std::max(len, 0));
+	}
+
+	std::wstringstream ss(text);
+	std::wstring line, section, key, value;
+	while (std::getline(ss, line))
+	{
+		if (!line.empty() && line.back() == L'\r')
+			line.pop_back();
+
+		if (!ParseSection(line, section) && ParseEntry(line, key, value))
+			m_values.emplace(Index(section, key), value);	// first entry wins.
+
+		m_lines.push_back(line);
+	}
+}
+
+bool SettingsStore::Get(const std::wstring& section, const std::wstring& key, std::wstring& value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_values.find(Index(section, key));
+	if (it == m_values.end())
+		return false;
+
+	value = it->second;
+	return true;
+}
+
+std::vector<std::wstring> SettingsStore::Keys(const std::wstring& section)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::vector<std::wstring> keys;
+	std::wstring line_section, key, value;
+	auto in_section = false;
+
+	for (auto& line : m_lines)
+	{
+		if (ParseSection(line, line_section))
+			in_section = !lstrcmpi(line_section.c_str(), section.c_str());
+		else if (in_section && ParseEntry(line, key, value))
+			keys.push_back(key);
+	}
+
+	return keys;
+}
+
+// Sets a value, or removes it if null, then schedules a write.
+void SettingsStore::Set(const std::wstring& section, const std::wstring& key, const std::wstring* value)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// Find the existing entry, or the end of the section's entries to add to.
+	std::wstring line_section, line_key, line_value;
+	auto in_section = false;
+	auto section_end = m_lines.size();
+	auto found = m_lines.size();
+
+	for (size_t i = 0; i < m_lines.size() && found == m_lines.size(); ++i)
+	{
+		if (ParseSection(m_lines[i], line_section))
+		{
+			if (in_section)
+				break;
+
+			in_section = !lstrcmpi(line_section.c_str(), section.c_str());
+			if (in_section)
+				section_end = i + 1;
+		}
+		else if (in_section && ParseEntry(m_lines[i], line_key, line_value))
+		{
+			if (!lstrcmpi(line_key.c_str(), key.c_str()))
+				found = i;
+			else
+				section_end = i + 1;
+		}
+	}
+
+	if (value)
+	{
+		auto line = key + L'=' + *value;
+		if (found != m_lines.size() && m_lines[found] == line)
+			return;
+		else if (found != m_lines.size())
+			m_lines[found] = line;
+		else if (in_section)
+			m_lines.insert(m_lines.begin() + section_end, line);
+		else
+		{
+			m_lines.push_back(L'[' + section + L']');
+			m_lines.push_back(line);
+		}
+
+		m_values[Index(section, key)] = *value;
+	}
+	else
+	{
+		if (found == m_lines.size())
+			return;
+
+		m_lines.erase(m_lines.begin() + found);
+		m_values.erase(Index(section, key));
+	}
+
+	Changed(lock);
+}
+
+// Replaces all entries in a section, leaving any comments in place, then schedules a write.
+void SettingsStore::SetSection(const std::wstring& section, const std::vector<std::pair<std::wstring, std::wstring>>& values)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// Find the section's lines, up to the next section or the end.
+	std::wstring line_section, line_key, line_value;
+	auto start = m_lines.size(), end = m_lines.size();
+	for (size_t i = 0; i < m_lines.size(); ++i)
+	{
+		if (!ParseSection(m_lines[i], line_section))
+			continue;
+		else if (start != m_lines.size())
+		{
+			end = i;
+			break;
+		}
+		else if (!lstrcmpi(line_section.c_str(), section.c_str()))
+			start = i;
+	}
+
+	if (start == m_lines.size() && values.empty())
+		return;
+
+	std::vector<std::wstring> lines(m_lines.begin(), m_lines.begin() + start);
+	lines.push_back((start != m_lines.size()) ? m_lines[start] : L'[' + section + L']');
+
+	// The new entries go where the old ones started.
+	auto insert_at = lines.size();
+	auto first_entry = true;
+	for (auto i = start + 1; i < end; ++i)
+	{
+		if (!ParseEntry(m_lines[i], line_key, line_value))
+			lines.push_back(m_lines[i]);
+		else if (first_entry)
+		{
+			insert_at = lines.size();
+			first_entry = false;
+		}
+	}
+
+	std::vector<std::wstring> entries;
+	for (auto& [key, value] : values)
+		entries.push_back(key + L'=' + value);
+
+	lines.insert(lines.begin() + insert_at, entries.begin(), entries.end());
+	if (end < m_lines.size())
+		lines.insert(lines.end(), m_lines.begin() + end, m_lines.end());
+
+	if (lines == m_lines)
+		return;
+
+	m_lines = std::move(lines);
+
+	auto prefix = Index(section, L"");
+	for (auto it = m_values.begin(); it != m_values.end(); )
+		it = (it->first.compare(0, prefix.size(), prefix) == 0) ? m_values.erase(it) : std::next(it);
+
+	for (auto& [key, value] : values)
+		m_values.emplace(Index(section, key), value);	// first entry wins.
+
+	Changed(lock);
+}
+
+// Called with the lock held, to schedule a write of the changes.
+void SettingsStore::Changed(std::unique_lock<std::mutex>& lock)
+{
+	m_dirty = true;
+	m_changed_time = std::chrono::steady_clock::now();
+
+	if (!m_thread.joinable())
+		m_thread = std::thread(&SettingsStore::FlushThread, this);
+
+	lock.unlock();
+	m_cv.notify_one();
+}
+
+// Writes changes once no more have been made for a short time, so a burst of
+// changes from the options dialog is a single write.
+void SettingsStore::FlushThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop)
+	{
+		if (!m_dirty)
+			m_cv.wait(lock);
+		else if (m_cv.wait_until(lock, m_changed_time + SETTINGS_FLUSH_DELAY) == std::cv_status::timeout &&
+			std::chrono::steady_clock::now() >= m_changed_time + SETTINGS_FLUSH_DELAY)
+		{
+			Write(lock);
+		}
+	}
+}
+
+void SettingsStore::Flush()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_one();
+
+	if (m_thread.joinable())
+		m_thread.join();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stop = false;
+
+	if (m_dirty)
+		Write(lock);
+}
+
+// Called with the lock held, which is released while writing so settings can still be
+// read and changed. The new contents replace the file in one step, so it's never left
+// half-written.
+void SettingsStore::Write(std::unique_lock<std::mutex>& lock)
+{
+	// Take the write lock first, so the contents are written in the order they were taken.
+	lock.unlock();
+	std::lock_guard<std::mutex> write_lock(m_write_mutex);
+	lock.lock();
+
+	m_dirty = false;
+	if (m_path.empty())
+		return;
+
+	auto path = m_path;
+	auto utf16 = m_utf16;
+	std::wstring text;
+	for (auto& line : m_lines)
+		text += line + L"\r\n";
+
+	lock.unlock();
+	SaveFile(path, utf16, text);
+	lock.lock();
+}
+
+/*static*/ void SettingsStore::SaveFile(const fs::path& path, bool utf16, const std::wstring& text)
+{
+	std::string bytes;
+	if (utf16)
+	{
+		bytes = "\xff\xfe";
+		bytes.append(reinterpret_cast<const char*>(text.data()), text.size() * sizeof(wchar_t));
+	}
+	else if (!text.empty())
+	{
+		auto len = WideCharToMultiByte(CP_ACP, 0, text.data(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+		bytes.resize(std::max(len, 0));
+		WideCharToMultiByte(CP_ACP, 0, text.data(), static_cast<int>(text.size()), bytes.data(), len, nullptr, nullptr);
+	}
+
+	auto temp_path = path;
+	temp_path += L".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		file.write(bytes.data(), bytes.size());
+		if (!file)
+		{
+			file.close();
+			DeleteFile(temp_path.c_str());
+			return;
+		}
+	}
+
+	if (!MoveFileEx(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		DeleteFile(temp_path.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 void InitSettings(const std::string& app_name)
 {
 	wchar_t wpath[MAX_PATH];
@@ -25,52 +413,62 @@ void InitSettings(const std::string& app_name)
 	}
 
 	settings_path = path;
+	settings_store.Load(path);
+}
+
+void FlushSettings()
+{
+	settings_store.Flush();
 }
 
 std::vector<std::wstring> GetSettingKeys(const std::wstring& section)
 {
 	assert(!settings_path.empty());
-	std::vector<wchar_t> key_strings(0x10000);	// 64K max
-
-	GetPrivateProfileString(
-		section.c_str(),
-		NULL, L"",
-		key_strings.data(),
-		static_cast<DWORD>(key_strings.size()),
-		settings_path.c_str());
-
-	std::vector<std::wstring> keys;
-	for (auto p = key_strings.data(); *p; p += wcslen(p) + 1)
-		keys.emplace_back(p);
-
-	return keys;
+	return settings_store.Keys(section);
 }
 
 std::wstring GetSetting(const std::wstring& key, const std::wstring& default_value, const std::wstring& section)
 {
 	assert(!settings_path.empty());
 
-	wchar_t value[0x400];	// 1K max
-	GetPrivateProfileString(section.c_str(), key.c_str(), default_value.c_str(), value, _countof(value), settings_path.c_str());
-	return value[0] ? value : default_value;
+	std::wstring value;
+	settings_store.Get(section, key, value);
+	return !value.empty() ? value : default_value;
 }
 
 int GetSetting(const std::wstring& key, int default_value, const std::wstring& section)
 {
 	assert(!settings_path.empty());
-	return GetPrivateProfileInt(section.c_str(), key.c_str(), default_value, settings_path.c_str());
+
+	std::wstring value;
+	if (!settings_store.Get(section, key, value))
+		return default_value;
+
+	return static_cast<int>(std::wcstol(value.c_str(), nullptr, 10));
 }
 
 bool GetFlag(const std::wstring& key, bool default_value, const std::wstring& section)
 {
 	assert(!settings_path.empty());
 
-	wchar_t value[64];
-	GetPrivateProfileString(section.c_str(), key.c_str(), L"", value, _countof(value), settings_path.c_str());
-	return value[0] ? !!std::stoul(value) : default_value;
+	std::wstring value;
+	settings_store.Get(section, key, value);
+	return !value.empty() ? !!std::stoul(value) : default_value;
+}
+
+void SetSettingValue(const std::wstring& key, const std::wstring& value, const std::wstring& section)
+{
+	assert(!settings_path.empty());
+	settings_store.Set(section, key, &value);
 }
 
 void RemoveSetting(const std::wstring& key, const std::wstring& section)
 {
-	WritePrivateProfileString(section.c_str(), key.c_str(), nullptr, settings_path.c_str());
+	settings_store.Set(section, key, nullptr);
+}
+
+void SetSettingSection(const std::wstring& section, const std::vector<std::pair<std::wstring, std::wstring>>& values)
+{
+	assert(!settings_path.empty());
+	settings_store.SetSection(section, values);
 }
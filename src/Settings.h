@@ -4,18 +4,19 @@ static constexpr auto DEFAULT_SECTION = L"Main";
 extern std::wstring settings_path;
 
 void InitSettings(const std::string& app_name);
+void FlushSettings();
 std::vector<std::wstring> GetSettingKeys(const std::wstring& section = DEFAULT_SECTION);
 std::wstring GetSetting(const std::wstring& key, const std::wstring& default_value, const std::wstring& section = DEFAULT_SECTION);
 int GetSetting(const std::wstring& key, int default_value, const std::wstring& section = DEFAULT_SECTION);
 bool GetFlag(const std::wstring& key, bool default_value, const std::wstring& section = DEFAULT_SECTION);
+void SetSettingValue(const std::wstring& key, const std::wstring& value, const std::wstring& section = DEFAULT_SECTION);
 void RemoveSetting(const std::wstring& key, const std::wstring& section = DEFAULT_SECTION);
+void SetSettingSection(const std::wstring& section, const std::vector<std::pair<std::wstring, std::wstring>>& values);
 
 template<typename T>
 void SetSetting(const std::wstring& key, const T& value, const std::wstring& section = DEFAULT_SECTION)
 {
 	std::wstringstream ss;
 	ss << value;
-
-	assert(!settings_path.empty());
-	WritePrivateProfileString(section.c_str(), key.c_str(), ss.str().c_str(), settings_path.c_str());
+	SetSettingValue(key, ss.str(), section);
 }
@@ -1,2 +1,8 @@
 // Constants shaded between application and shaders.
 #define PALETTE_SIZE	20
+
+// Vertex colour flag for alternating tile colours, with the odd tile colour in bits 8-15.
+#define CHECKER_COLOUR_FLAG	0x10000
+
+// Fixed-point scale of packed 8-bit texture coordinates, for map coordinates up to 31.
+#define PACKED_TEXCOORD_SCALE	8.0f
@@ -0,0 +1,132 @@
+#include "stdafx.h"
+#include "SoundCache.h"
+#include "Resampler.h"
+
+#define fourccCACHE 'DNSA'
+
+struct SoundCacheHeader
+{
+	uint32_t fourcc;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t channels;
+	uint32_t sample_rate;
+	uint64_t frames;
+};
+
+// 64-bit FNV-1a, which is plenty to tell sound files apart.
+static uint64_t HashData(ByteSpan data)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (auto b : data)
+	{
+		hash ^= b;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+SoundCache::SoundCache(int sample_rate)
+	: m_sample_rate(sample_rate)
+{
+	// Local rather than roaming app data, as it's only a cache.
+	wchar_t wpath[MAX_PATH]{};
+	if (SUCCEEDED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, wpath)))
+	{
+		m_dir = fs::path(wpath) / APP_NAME / SOUND_CACHE_SUBDIR;
+
+		std::error_code ec;
+		fs::create_directories(m_dir, ec);
+		if (ec)
+			m_dir.clear();
+	}
+}
+
+std::shared_ptr<SoundData> SoundCache::Load(const fs::path& path, const std::function<std::shared_ptr<SoundData>(const MappedFile&)>& decode) const
+{
+	MappedFile file(path, true);
+	auto hash = HashData(file.Span());
+
+	std::wstringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill(L'0') << hash << L".snd";
+	auto cache_file = m_dir.empty() ? fs::path() : m_dir / ss.str();
+
+	if (!cache_file.empty())
+	{
+		if (auto sound = Read(cache_file, hash))
+			return sound;
+	}
+
+	auto sound = decode(file);
+	if (sound->sample_rate != m_sample_rate)
+		sound = Resampler(sound->sample_rate, m_sample_rate).Process(*sound);
+
+	if (!cache_file.empty())
+		Write(cache_file, hash, *sound);
+
+	return sound;
+}
+
+std::shared_ptr<SoundData> SoundCache::Read(const fs::path& cache_file, uint64_t hash) const
+{
+	std::ifstream file(cache_file, std::ios::binary);
+	if (!file)
+		return nullptr;
+
+	SoundCacheHeader header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	// Anything unexpected is treated as a miss, and rewritten.
+	if (!file ||
+		header.fourcc != fourccCACHE ||
+		header.version != SOUND_CACHE_VERSION ||
+		header.hash != hash ||
+		header.channels < 1 || header.channels > 2 ||
+		static_cast<int>(header.sample_rate) != m_sample_rate ||
+		header.frames > (1ULL << 32))
+	{
+		return nullptr;
+	}
+
+	auto sound = std::make_shared<SoundData>();
+	sound->channels = static_cast<int>(header.channels);
+	sound->sample_rate = m_sample_rate;
+	sound->samples.resize(static_cast<size_t>(header.frames) * header.channels);
+
+	file.read(reinterpret_cast<char*>(sound->samples.data()), sound->samples.size() * sizeof(float));
+	if (!file)
+		return nullptr;
+
+	return sound;
+}
+
+void SoundCache::Write(const fs::path& cache_file, uint64_t hash, const SoundData& sound) const
+{
+	SoundCacheHeader header{};
+	header.fourcc = fourccCACHE;
+	header.version = SOUND_CACHE_VERSION;
+	header.hash = hash;
+	header.channels = static_cast<uint32_t>(sound.channels);
+	header.sample_rate = static_cast<uint32_t>(sound.sample_rate);
+	header.frames = sound.Frames();
+
+	// Written under a temporary name and renamed into place, so other threads or
+	// instances never see a partial file. Failures just leave it uncached.
+	auto temp_file = cache_file;
+	temp_file += L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+	{
+		std::ofstream file(temp_file, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(sound.samples.data()), sound.samples.size() * sizeof(float));
+		if (!file)
+		{
+			file.close();
+			DeleteFile(temp_file.c_str());
+			return;
+		}
+	}
+
+	if (!MoveFileEx(temp_file.c_str(), cache_file.c_str(), MOVEFILE_REPLACE_EXISTING))
+		DeleteFile(temp_file.c_str());
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "SoundData.h"
+
+static constexpr auto SOUND_CACHE_SUBDIR = L"SoundCache";
+static constexpr uint32_t SOUND_CACHE_VERSION = 1;
+
+// Sounds decoded and converted to the mix rate, saved on disk by the hash of the
+// source file so later runs load them with a straight copy.
+class SoundCache
+{
+public:
+	SoundCache(int sample_rate);
+
+	// Returns the converted sound, decoding and caching it if needed. The source file is
+	// mapped once, for both hashing and decoding. Safe to use from multiple loader threads.
+	std::shared_ptr<SoundData> Load(const fs::path& path, const std::function<std::shared_ptr<SoundData>(const MappedFile&)>& decode) const;
+
+protected:
+	std::shared_ptr<SoundData> Read(const fs::path& cache_file, uint64_t hash) const;
+	void Write(const fs::path& cache_file, uint64_t hash, const SoundData& sound) const;
+
+	fs::path m_dir;
+	int m_sample_rate{ 0 };
+};
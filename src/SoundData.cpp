@@ -0,0 +1,284 @@
+#include "stdafx.h"
+#include "SoundData.h"
+
+#define fourccRIFF 'FFIR'
+#define fourccDATA 'atad'
+#define fourccFMT  ' tmf'
+#define fourccWAVE 'EVAW'
+
+bool DecodePCM(int format_tag, int bits, const uint8_t* data, size_t num_samples, float* out)
+{
+	if (format_tag == WAV_FORMAT_PCM && bits == 8)
+	{
+		for (size_t i = 0; i < num_samples; ++i)
+			out[i] = (data[i] - 128) / 128.0f;
+	}
+	else if (format_tag == WAV_FORMAT_PCM && bits == 16)
+	{
+		auto src = reinterpret_cast<const int16_t*>(data);
+		for (size_t i = 0; i < num_samples; ++i)
+			out[i] = src[i] / 32768.0f;
+	}
+	else if (format_tag == WAV_FORMAT_IEEE_FLOAT && bits == 32)
+	{
+		if (num_samples)
+			std::memcpy(out, data, num_samples * sizeof(float));
+	}
+	else
+		return false;
+
+	return true;
+}
+
+WavInfo ParseWAV(ByteSpan file)
+{
+	auto read32 = [&](size_t offset)
+	{
+		uint32_t value;
+		std::memcpy(&value, file.data() + offset, sizeof(value));
+		return value;
+	};
+
+	if (file.size() < 12 || read32(0) != fourccRIFF || read32(8) != fourccWAVE)
+		throw std::exception("not a WAV");
+
+	WAVEFORMATEXTENSIBLE wfx{};
+	auto have_format = false;
+
+	// Chunks are padded to even sizes.
+	for (size_t offset = 12; offset + 8 <= file.size(); )
+	{
+		auto fourcc = read32(offset);
+		auto chunk = file.subspan(offset + 8, read32(offset + 4));
+		offset += 8;
+
+		if (fourcc == fourccFMT)
+		{
+			std::memcpy(&wfx, chunk.data(), std::min(chunk.size(), sizeof(wfx)));
+			have_format = true;
+		}
+		else if (fourcc == fourccDATA && have_format)
+		{
+			WavInfo info;
+			info.channels = wfx.Format.nChannels;
+			info.sample_rate = static_cast<int>(wfx.Format.nSamplesPerSec);
+			info.bits = wfx.Format.wBitsPerSample;
+			info.block_align = wfx.Format.nBlockAlign;
+			info.data = chunk;
+
+			// Extensible formats give the real format in the first part of the sub-format GUID.
+			info.format_tag = wfx.Format.wFormatTag;
+			if (info.format_tag == WAVE_FORMAT_EXTENSIBLE)
+				info.format_tag = static_cast<int>(wfx.SubFormat.Data1);
+
+			return info;
+		}
+
+		offset += chunk.size() + (chunk.size() & 1);
+	}
+
+	throw std::exception("missing WAV chunk");
+}
+
+/*static*/ std::shared_ptr<SoundData> SoundData::FromPCM(int format_tag, int channels, int sample_rate, int bits, ByteSpan data)
+{
+	if (channels < 1 || channels > 2 || sample_rate <= 0 || bits < 8)
+		throw std::exception("unsupported WAV channels or rate");
+
+	auto sound = std::make_shared<SoundData>();
+	sound->channels = channels;
+	sound->sample_rate = sample_rate;
+
+	// Whole frames only.
+	auto frame_bytes = static_cast<size_t>(channels) * (bits / 8);
+	sound->samples.resize(data.size() / frame_bytes * channels);
+
+	if (!DecodePCM(format_tag, bits, data.data(), sound->samples.size(), sound->samples.data()))
+		throw std::exception("unsupported WAV sample format");
+
+	return sound;
+}
+
+// Frames in a Microsoft ADPCM block, including the two held in its header.
+static size_t ADPCMBlockFrames(int channels, size_t block_bytes)
+{
+	auto header_bytes = static_cast<size_t>(7 * channels);
+	return (block_bytes < header_bytes) ? 0 : (block_bytes - header_bytes) * 2 / channels + 2;
+}
+
+// Decodes one Microsoft ADPCM block, using the standard coefficient set, returning the frames written.
+static size_t DecodeADPCMBlock(int channels, const uint8_t* block, size_t block_bytes, float* out)
+{
+	static constexpr int coeffs1[]{ 256, 512, 0, 192, 240, 460, 392 };
+	static constexpr int coeffs2[]{ 0, -256, 0, 64, 0, -208, -232 };
+	static constexpr int adaptation[]{ 230, 230, 230, 230, 307, 409, 512, 614, 768, 614, 512, 409, 307, 230, 230, 230 };
+
+	auto frames = ADPCMBlockFrames(channels, block_bytes);
+	if (!frames)
+		return 0;
+
+	auto header_bytes = static_cast<size_t>(7 * channels);
+	auto block_end = block + header_bytes + (frames - 2) * channels / 2;
+	auto read16 = [&](size_t i) { return static_cast<int16_t>(block[i] | (block[i + 1] << 8)); };
+
+	// Block header, with the values for each channel interleaved.
+	int coeff1[2]{}, coeff2[2]{}, delta[2]{}, sample1[2]{}, sample2[2]{};
+	for (int c = 0; c < channels; ++c)
+	{
+		auto predictor = std::min<int>(block[c], _countof(coeffs1) - 1);
+		coeff1[c] = coeffs1[predictor];
+		coeff2[c] = coeffs2[predictor];
+		delta[c] = read16(channels + c * 2);
+		sample1[c] = read16(channels * 3 + c * 2);
+		sample2[c] = read16(channels * 5 + c * 2);
+	}
+
+	// The header holds the first two samples, oldest last.
+	for (int c = 0; c < channels; ++c)
+		*out++ = sample2[c] / 32768.0f;
+	for (int c = 0; c < channels; ++c)
+		*out++ = sample1[c] / 32768.0f;
+
+	// Then one nibble per sample, high nibble first, alternating channels if stereo.
+	int c = 0;
+	for (auto p = block + header_bytes; p < block_end; ++p)
+	{
+		for (auto nibble : { *p >> 4, *p & 0xf })
+		{
+			auto predicted = (sample1[c] * coeff1[c] + sample2[c] * coeff2[c]) / 256;
+			auto sample = predicted + ((nibble & 8) ? nibble - 16 : nibble) * delta[c];
+			sample = std::max(-32768, std::min(32767, sample));
+
+			sample2[c] = sample1[c];
+			sample1[c] = sample;
+			delta[c] = std::max(16, adaptation[nibble] * delta[c] / 256);
+
+			*out++ = sample / 32768.0f;
+			c = (c + 1) % channels;
+		}
+	}
+
+	return frames;
+}
+
+// Microsoft ADPCM, as used by some of the sound packs.
+/*static*/ std::shared_ptr<SoundData> SoundData::FromADPCM(int channels, int sample_rate, int block_align, ByteSpan data)
+{
+	if (channels < 1 || channels > 2 || sample_rate <= 0 || block_align <= 7 * channels)
+		throw std::exception("unsupported ADPCM channels, rate or block size");
+
+	auto sound = std::make_shared<SoundData>();
+	sound->channels = channels;
+	sound->sample_rate = sample_rate;
+
+	// Whole blocks, then any partial block at the end.
+	auto full_blocks = data.size() / block_align;
+	auto frames = full_blocks * ADPCMBlockFrames(channels, block_align) +
+		ADPCMBlockFrames(channels, data.size() % block_align);
+	sound->samples.resize(frames * channels);
+
+	auto out = sound->samples.data();
+	for (size_t offset = 0; offset < data.size(); offset += block_align)
+	{
+		auto block_bytes = std::min(static_cast<size_t>(block_align), data.size() - offset);
+		out += DecodeADPCMBlock(channels, data.data() + offset, block_bytes, out) * channels;
+	}
+
+	return sound;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SoundStream::SoundStream(const fs::path& path)
+	: m_file(path, true)
+{
+	try
+	{
+		auto wav = ParseWAV(m_file.Span());
+
+		m_format_tag = wav.format_tag;
+		m_bits = wav.bits;
+		m_block.channels = wav.channels;
+		m_block.sample_rate = wav.sample_rate;
+
+		if (m_block.channels < 1 || m_block.channels > 2 || m_block.sample_rate <= 0)
+			throw std::exception("unsupported WAV channels or rate");
+
+		m_pData = wav.data.data();
+		m_data_bytes = wav.data.size();
+
+		if (m_format_tag == WAV_FORMAT_ADPCM)
+		{
+			// Decoded a whole ADPCM block at a time, as each depends on its own header.
+			if (wav.block_align <= 7 * m_block.channels)
+				throw std::exception("unsupported ADPCM block size");
+
+			m_adpcm_block_bytes = wav.block_align;
+			m_adpcm_block_frames = ADPCMBlockFrames(m_block.channels, m_adpcm_block_bytes);
+			m_data_frames = m_data_bytes / m_adpcm_block_bytes * m_adpcm_block_frames +
+				ADPCMBlockFrames(m_block.channels, m_data_bytes % m_adpcm_block_bytes);
+		}
+		else
+		{
+			if (!DecodePCM(m_format_tag, m_bits, m_pData, 0, nullptr))
+				throw std::exception("unsupported WAV sample format");
+
+			m_frame_bytes = static_cast<size_t>(m_block.channels) * (m_bits / 8);
+			m_data_frames = m_data_bytes / m_frame_bytes;
+		}
+	}
+	catch (...)
+	{
+		auto str = "Invalid WAV: " + to_string(path);
+		throw std::runtime_error(str);
+	}
+
+	// The block buffer is sized once, so decoding never allocates.
+	m_block.samples.reserve(std::max(SOUND_STREAM_BLOCK_FRAMES, m_adpcm_block_frames) * m_block.channels);
+}
+
+void SoundStream::Rewind()
+{
+	m_next_frame = 0;
+}
+
+const SoundData* SoundStream::NextBlock()
+{
+	if (m_adpcm_block_frames)
+		return NextADPCMBlock();
+
+	auto frames = std::min(SOUND_STREAM_BLOCK_FRAMES, m_data_frames - m_next_frame);
+	if (!frames)
+		return nullptr;
+
+	m_block.samples.resize(frames * m_block.channels);
+	DecodePCM(m_format_tag, m_bits, m_pData + m_next_frame * m_frame_bytes, m_block.samples.size(), m_block.samples.data());
+	m_next_frame += frames;
+
+	return &m_block;
+}
+
+// As many whole ADPCM blocks as fit the stream block, but always at least one.
+const SoundData* SoundStream::NextADPCMBlock()
+{
+	// Only the final block can be partial, so earlier blocks are found from the frame count.
+	if (m_next_frame >= m_data_frames)
+		return nullptr;
+
+	auto offset = m_next_frame / m_adpcm_block_frames * m_adpcm_block_bytes;
+	auto num_blocks = std::max<size_t>(SOUND_STREAM_BLOCK_FRAMES / m_adpcm_block_frames, 1);
+	m_block.samples.resize(num_blocks * m_adpcm_block_frames * m_block.channels);
+
+	size_t frames = 0;
+	for (size_t i = 0; i < num_blocks && offset < m_data_bytes; ++i, offset += m_adpcm_block_bytes)
+	{
+		auto block_bytes = std::min(m_adpcm_block_bytes, m_data_bytes - offset);
+		frames += DecodeADPCMBlock(m_block.channels, m_pData + offset, block_bytes,
+			m_block.samples.data() + frames * m_block.channels);
+	}
+
+	m_block.samples.resize(frames * m_block.channels);
+	m_next_frame += frames;
+
+	return &m_block;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "MappedFile.h"
+
+static constexpr uint16_t WAV_FORMAT_PCM = 1;
+static constexpr uint16_t WAV_FORMAT_ADPCM = 2;
+static constexpr uint16_t WAV_FORMAT_IEEE_FLOAT = 3;
+static constexpr size_t SOUND_STREAM_BLOCK_FRAMES = 4096;
+
+// Decoded sound, as interleaved float samples.
+struct SoundData
+{
+	std::vector<float> samples;
+	int channels{ 1 };
+	int sample_rate{ 44100 };
+
+	size_t Frames() const { return samples.size() / channels; }
+	float LengthInSeconds() const { return static_cast<float>(Frames()) / sample_rate; }
+
+	static std::shared_ptr<SoundData> FromPCM(int format_tag, int channels, int sample_rate, int bits, ByteSpan data);
+	static std::shared_ptr<SoundData> FromADPCM(int channels, int sample_rate, int block_align, ByteSpan data);
+};
+
+// Converts PCM samples to float, returning false for unsupported formats.
+bool DecodePCM(int format_tag, int bits, const uint8_t* data, size_t num_samples, float* out);
+
+// Format and sample data of a WAV file in memory.
+struct WavInfo
+{
+	int format_tag{ 0 };
+	int channels{ 0 };
+	int sample_rate{ 0 };
+	int bits{ 0 };
+	int block_align{ 0 };
+	ByteSpan data;
+};
+
+// Finds the format and data chunks, throwing if either is missing.
+WavInfo ParseWAV(ByteSpan file);
+
+// WAV file decoded a block at a time from a memory mapping, so long music tracks
+// cost little memory, and nothing until they're played. Plays on one voice at a time.
+class SoundStream
+{
+public:
+	SoundStream(const fs::path& path);
+	SoundStream(const SoundStream&) = delete;
+	SoundStream& operator=(const SoundStream&) = delete;
+	virtual ~SoundStream() = default;
+
+	int Channels() const { return m_block.channels; }
+	int SampleRate() const { return m_block.sample_rate; }
+	size_t Frames() const { return m_data_frames; }
+	float LengthInSeconds() const { return static_cast<float>(m_data_frames) / m_block.sample_rate; }
+
+	// Decodes the next block into a buffer owned by the stream, or returns nullptr at the end.
+	const SoundData* NextBlock();
+	void Rewind();
+
+protected:
+	const SoundData* NextADPCMBlock();
+
+	MappedFile m_file;
+
+	int m_format_tag{ 0 };
+	int m_bits{ 0 };
+	const uint8_t* m_pData{ nullptr };
+	size_t m_data_bytes{ 0 };
+	size_t m_data_frames{ 0 };
+	size_t m_frame_bytes{ 0 };
+	size_t m_next_frame{ 0 };
+
+	size_t m_adpcm_block_bytes{ 0 };
+	size_t m_adpcm_block_frames{ 0 };	// non-zero for ADPCM streams.
+
+	SoundData m_block;
+};
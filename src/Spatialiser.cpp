@@ -0,0 +1,143 @@
+#include "stdafx.h"
+#include "Spatialiser.h"
+
+void Spatialiser::SetListener(XMFLOAT3 pos, XMFLOAT3 front_dir, XMFLOAT3 up_dir)
+{
+	m_pos = pos;
+
+	// Left-handed, as used by X3DAudio and the views.
+	auto front = XMVector3Normalize(XMLoadFloat3(&front_dir));
+	auto right = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&up_dir), front));
+	auto up = XMVector3Cross(front, right);
+
+	XMStoreFloat3(&m_front, front);
+	XMStoreFloat3(&m_right, right);
+	XMStoreFloat3(&m_up, up);
+}
+
+// Gathers 4 emitters at a time, padding with copies of the first, and passes the
+// listener-relative position, inverse distance and attenuated volume of each lane.
+template <typename F>
+void Spatialiser::ForEachBatch(const XMFLOAT3* positions, const float* volumes, size_t count, F&& func) const
+{
+	auto lx = XMVectorReplicate(m_pos.x), ly = XMVectorReplicate(m_pos.y), lz = XMVectorReplicate(m_pos.z);
+	auto min_distance = XMVectorReplicate(0.001f);
+	auto curve_distance = XMVectorReplicate(SPATIAL_CURVE_DISTANCE);
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		auto n = std::min<size_t>(4, count - i);
+
+		XMVECTORF32 xs{}, ys{}, zs{}, vs{};
+		for (size_t j = 0; j < 4; ++j)
+		{
+			auto k = i + ((j < n) ? j : 0);
+			xs.f[j] = positions[k].x;
+			ys.f[j] = positions[k].y;
+			zs.f[j] = positions[k].z;
+			vs.f[j] = volumes[k];
+		}
+
+		auto dx = XMVectorSubtract(xs, lx);
+		auto dy = XMVectorSubtract(ys, ly);
+		auto dz = XMVectorSubtract(zs, lz);
+
+		auto distance_sq = XMVectorMultiplyAdd(dz, dz, XMVectorMultiplyAdd(dy, dy, XMVectorMultiply(dx, dx)));
+		auto distance = XMVectorMax(XMVectorSqrt(distance_sq), min_distance);
+		auto inv_distance = XMVectorReciprocal(distance);
+
+		// Inverse distance attenuation beyond the curve distance.
+		auto attenuation = XMVectorMin(XMVectorMultiply(curve_distance, inv_distance), g_XMOne);
+		attenuation = XMVectorMultiply(attenuation, vs);
+
+		func(i, n, dx, dy, dz, inv_distance, attenuation);
+	}
+}
+
+VoiceGains Spatialiser::Calculate(XMFLOAT3 pos, int channels, float volume) const
+{
+	VoiceGains gains;
+	Calculate(&pos, &channels, &volume, &gains, 1);
+	return gains;
+}
+
+void Spatialiser::Calculate(const XMFLOAT3* positions, const int* channels, const float* volumes, VoiceGains* gains, size_t count) const
+{
+	auto rx = XMVectorReplicate(m_right.x), ry = XMVectorReplicate(m_right.y), rz = XMVectorReplicate(m_right.z);
+	auto quarter_pi = XMVectorReplicate(XM_PIDIV4);
+
+	ForEachBatch(positions, volumes, count, [&](size_t i, size_t n, XMVECTOR dx, XMVECTOR dy, XMVECTOR dz, XMVECTOR inv_distance, XMVECTOR attenuation)
+		{
+			// Constant power pan from the sideways component of the direction to the emitter.
+			auto lateral = XMVectorMultiplyAdd(dz, rz, XMVectorMultiplyAdd(dy, ry, XMVectorMultiply(dx, rx)));
+			auto pan = XMVectorClamp(XMVectorMultiply(lateral, inv_distance), g_XMNegativeOne, g_XMOne);
+			auto angle = XMVectorMultiply(XMVectorAdd(pan, g_XMOne), quarter_pi);
+
+			XMVECTOR sin_angle, cos_angle;
+			XMVectorSinCos(&sin_angle, &cos_angle, angle);
+
+			XMVECTORF32 left{}, right{};
+			left.v = XMVectorMultiply(cos_angle, attenuation);
+			right.v = XMVectorMultiply(sin_angle, attenuation);
+
+			for (size_t j = 0; j < n; ++j)
+			{
+				auto l = left.f[j], r = right.f[j];
+				if (channels[i + j] == 1)
+					gains[i + j] = { l, r, 0.0f, 0.0f };
+				else
+					gains[i + j] = { l, r, l, r };
+			}
+		});
+}
+
+HrtfDirection Spatialiser::Direction(XMFLOAT3 pos, float volume) const
+{
+	HrtfDirection direction;
+	Directions(&pos, &volume, &direction, 1);
+	return direction;
+}
+
+void Spatialiser::Directions(const XMFLOAT3* positions, const float* volumes, HrtfDirection* directions, size_t count) const
+{
+	auto rx = XMVectorReplicate(m_right.x), ry = XMVectorReplicate(m_right.y), rz = XMVectorReplicate(m_right.z);
+	auto ux = XMVectorReplicate(m_up.x), uy = XMVectorReplicate(m_up.y), uz = XMVectorReplicate(m_up.z);
+	auto fx = XMVectorReplicate(m_front.x), fy = XMVectorReplicate(m_front.y), fz = XMVectorReplicate(m_front.z);
+
+	ForEachBatch(positions, volumes, count, [&](size_t i, size_t n, XMVECTOR dx, XMVECTOR dy, XMVECTOR dz, XMVECTOR inv_distance, XMVECTOR attenuation)
+		{
+			auto lateral = XMVectorMultiplyAdd(dz, rz, XMVectorMultiplyAdd(dy, ry, XMVectorMultiply(dx, rx)));
+			auto vertical = XMVectorMultiplyAdd(dz, uz, XMVectorMultiplyAdd(dy, uy, XMVectorMultiply(dx, ux)));
+			auto forward = XMVectorMultiplyAdd(dz, fz, XMVectorMultiplyAdd(dy, fy, XMVectorMultiply(dx, fx)));
+
+			// Azimuth is clockwise from the front, as seen from above.
+			XMVECTORF32 azimuth{}, elevation{}, gain{};
+			azimuth.v = XMVectorATan2(lateral, forward);
+			elevation.v = XMVectorASin(XMVectorClamp(XMVectorMultiply(vertical, inv_distance), g_XMNegativeOne, g_XMOne));
+			gain.v = attenuation;
+
+			for (size_t j = 0; j < n; ++j)
+				directions[i + j] = { azimuth.f[j], elevation.f[j], gain.f[j] };
+		});
+}
+
+/*static*/ bool Spatialiser::GainsChanged(const VoiceGains& a, const VoiceGains& b)
+{
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (std::fabs(a[i] - b[i]) > SPATIAL_GAIN_THRESHOLD)
+			return true;
+	}
+
+	return false;
+}
+
+/*static*/ bool Spatialiser::DirectionChanged(const HrtfDirection& a, const HrtfDirection& b)
+{
+	// Azimuth wraps, so compare the smaller angle between the two.
+	auto azimuth_change = std::fabs(std::remainder(a.azimuth - b.azimuth, XM_2PI));
+
+	return azimuth_change > SPATIAL_ANGLE_THRESHOLD ||
+		std::fabs(a.elevation - b.elevation) > SPATIAL_ANGLE_THRESHOLD ||
+		std::fabs(a.gain - b.gain) > SPATIAL_GAIN_THRESHOLD;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "Mixer.h"
+
+static constexpr float SPATIAL_CURVE_DISTANCE = 6.0f;	// full volume up to this distance, then inverse distance.
+static constexpr float SPATIAL_GAIN_THRESHOLD = 0.01f;	// smaller gain changes aren't worth sending to the mixer.
+static constexpr float SPATIAL_ANGLE_THRESHOLD = 0.02f;	// radians, for HRTF direction changes.
+
+// Distance attenuation and stereo panning or HRTF direction for positioned sounds,
+// calculated for 4 emitters at a time. All emitter channels are treated as coming
+// from a single point.
+class Spatialiser
+{
+public:
+	void SetListener(XMFLOAT3 pos, XMFLOAT3 front_dir, XMFLOAT3 up_dir);
+
+	VoiceGains Calculate(XMFLOAT3 pos, int channels, float volume = 1.0f) const;
+	void Calculate(const XMFLOAT3* positions, const int* channels, const float* volumes, VoiceGains* gains, size_t count) const;
+
+	HrtfDirection Direction(XMFLOAT3 pos, float volume = 1.0f) const;
+	void Directions(const XMFLOAT3* positions, const float* volumes, HrtfDirection* directions, size_t count) const;
+
+	static bool GainsChanged(const VoiceGains& a, const VoiceGains& b);
+	static bool DirectionChanged(const HrtfDirection& a, const HrtfDirection& b);
+
+protected:
+	template <typename F>
+	void ForEachBatch(const XMFLOAT3* positions, const float* volumes, size_t count, F&& func) const;
+
+	XMFLOAT3 m_pos{};
+	XMFLOAT3 m_right{ 1.0f, 0.0f, 0.0f };
+	XMFLOAT3 m_up{ 0.0f, 1.0f, 0.0f };
+	XMFLOAT3 m_front{ 0.0f, 0.0f, 1.0f };
+};
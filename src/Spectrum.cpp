@@ -1,7 +1,9 @@
 #include "stdafx.h"
 #include "Spectrum.h"
 #include "Settings.h"
+#include "AssetLoader.h"
 #include "Vertex.h"
+#include "Beeper.h"
 
 static constexpr int SNA_HEADER_SIZE = 27;
 
@@ -16,6 +18,12 @@ static constexpr int ZX_NUM_SENTS = 0x606f;
 static constexpr int ZX_MAP_ADDR = 0x6100;
 static constexpr int ZX_PLACED_OBJ_IDX_ADDR = 0x6501;
 static constexpr int ZX_PLAYER_OBJ_IDX_ADDR = 0x650b;
+static constexpr int ZX_TILE_X_ADDR = 0x6524;
+static constexpr int ZX_TILE_Z_ADDR = 0x6526;
+static constexpr int ZX_MAP_PTR_ADDR = 0x655e;
+static constexpr int ZX_PRODUCT_LSB_ADDR = 0x6574;
+static constexpr int ZX_MULTIPLIER_ADDR = 0x6575;
+static constexpr int ZX_RNG_STATE_ADDR = 0x607b;	// 5 bytes: E, D, C, L, H.
 static constexpr int ZX_VERTEX_INDICES_ADDR = 0x6600;
 static constexpr int ZX_FACE_INDICES_ADDR = 0x660b;
 static constexpr int ZX_COORDS_ADDR = 0x66a0;
@@ -34,7 +42,38 @@ static constexpr int ZX_OBJS_YAW = 0xf8c0;
 static constexpr int ZX_OBJS_Y_FRAC = 0xf9c0;
 static constexpr int ZX_OBJS_TYPE = 0xfac0;
 
-Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
+static constexpr int ZX_DISPLAY_ADDR = 0x4000;
+static constexpr int ZX_DISPLAY_END = 0x5b00;	// end of attributes.
+
+// Idle loop detection, sampled between short runs of emulation.
+static constexpr int IDLE_SLICE_CYCLES = 512;	// cycles between idle loop checks.
+static constexpr int IDLE_MAX_LOOP_STEPS = 32;	// max instructions in an idle loop.
+static constexpr int IDLE_MAX_LOOP_BYTES = 32;	// max code size of an idle loop.
+
+// Z80 flags, which native routines must leave exactly as the originals do.
+static constexpr uint8_t FLAG_C = 0x01, FLAG_N = 0x02, FLAG_PV = 0x04, FLAG_X = 0x08;
+static constexpr uint8_t FLAG_H = 0x10, FLAG_Y = 0x20, FLAG_Z = 0x40, FLAG_S = 0x80;
+
+static uint8_t ParityFlag(uint8_t value)
+{
+	value ^= value >> 4;
+	value ^= value >> 2;
+	value ^= value >> 1;
+	return (value & 1) ? 0 : FLAG_PV;
+}
+
+// Flags after a shift or rotate of a register through carry (RL r, RR r, SRL r).
+static uint8_t ShiftFlags(uint8_t result, int carry)
+{
+	return (result & (FLAG_S | FLAG_Y | FLAG_X)) | (result ? 0 : FLAG_Z) | ParityFlag(result) | carry;
+}
+
+/*static*/ std::map<std::pair<char, int>, Model> Spectrum::s_char_cache;
+/*static*/ std::mutex Spectrum::s_char_cache_mutex;
+/*static*/ std::map<uint8_t, std::shared_ptr<const SoundData>> Spectrum::s_tune_cache;
+/*static*/ std::mutex Spectrum::s_tune_cache_mutex;
+
+Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents, bool display_patches)
 	: m_pEvents(pEvents)
 {
 	// Initialise the emulation.
@@ -56,6 +95,29 @@ Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
 	m_mem[0x85D8] = 0x3e;	// ignore invalid secret codes
 	m_mem[0x9c84] = 0xc3;	// skip game start code check
 
+	// Skip idle loops by fast-forwarding to the end of the emulated period?
+	m_idle_skip = GetFlag(L"IdleSkip", m_idle_skip);
+
+	// Stub out display drawing routines, listed as hex addresses of routine entry points,
+	// or "none" to keep the original drawing.
+	auto patch_list = GetSetting(DISPLAY_PATCHES_KEY, std::wstring(DEFAULT_DISPLAY_PATCHES));
+	if (display_patches && patch_list != NO_DISPLAY_PATCHES)
+	{
+		std::wstringstream ss(patch_list);
+		for (std::wstring token; std::getline(ss, token, L',');)
+		{
+			auto address = std::wcstoul(token.c_str(), nullptr, 16);
+			if (address >= SPECTRUM_ROM_SIZE && address < SPECTRUM_MEM_SIZE)
+			{
+				m_mem[address] = 0xc9;	// RET
+				m_display_patches.push_back(static_cast<uint16_t>(address));
+			}
+		}
+	}
+
+	// Log code writing to the display, to find more routines to stub out.
+	m_trace_display_writes = GetFlag(DISPLAY_WRITE_TRACE_KEY, false);
+
 	// Blind Sentinel and sentries?
 	if (GetFlag(L"Invisible", false))
 		m_mem[0x9024] = 0xc3;
@@ -134,18 +196,22 @@ Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
 			EndFrame();
 		});
 
-#ifdef _DEBUG
-	// Secret code check -- log expected/correct secret code in DEBUG ONLY!
-	Hook(0x85a9, 0x96, [&]
+	// Secret code check -- capture the correct code for the landscape being entered.
+	Hook(0x85a9, 0x96 /*SUB (HL)*/, [&]
 		{
-			if (Z80_HL >= 0x60f0 && Z80_HL <= 0x60f3)
+			if (Z80_HL >= ZX_BCD_SECRET_CODE_ADDR && Z80_HL <= ZX_BCD_SECRET_CODE_ADDR + 3)
 			{
+				auto shift = (Z80_HL - ZX_BCD_SECRET_CODE_ADDR) * 8;
+				m_expected_code_bcd = (m_expected_code_bcd & ~(0xffu << shift)) | (static_cast<uint32_t>(Z80_A) << shift);
+
+#ifdef _DEBUG
+				// Log expected/correct secret code in DEBUG ONLY!
 				std::wstringstream ss;
 				ss << std::hex << Z80_HL << " = " << std::setw(2) << std::setfill(L'0') << (int)Z80_A << "\n";
 				OutputDebugString(ss.str().c_str());
+#endif
 			}
 		});
-#endif
 
 	// Secret code generation -- capture newly generated code.
 	Hook(0xafa9, 0xcd /*CALL nn*/, [&]
@@ -215,6 +281,9 @@ Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
 	// Tune playback.
 	Hook(0xbbfd, 0x32 /*LD (nn),A*/, [&]
 		{
+			if (m_beeper)
+				m_tune_sound = CaptureTune(Z80_A);
+
 			m_pEvents->OnPlayTune(Z80_A);
 			Ret();	// Skip Spectrum tune player.
 		});
@@ -232,6 +301,17 @@ Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
 			m_pEvents->OnPlayerDead();
 		});
 
+	// Native replacements for hot routines.
+	if (GetFlag(HLE_ENABLED_KEY, true))
+	{
+		m_hle_validate = GetFlag(HLE_VALIDATE_KEY, false);
+		RegisterHleRoutines();
+	}
+
+	// Original Spectrum tunes, in place of the sound pack.
+	if (GetFlag(ORIGINAL_AUDIO_KEY, false))
+		m_beeper = std::make_unique<Beeper>(SPECTRUM_CYCLES_PER_SECOND);
+
 	// Set object context for callbacks.
 	m_z80.context = this;
 
@@ -242,11 +322,37 @@ Spectrum::Spectrum(std::wstring filename, ISentinelEvents* pEvents)
 	};
 	m_z80.write = [](void* context, zuint16 address, zuint8 value) {
 		auto& zx = *reinterpret_cast<Spectrum*>(context);
-		if (address >= 0x4000)
+
+		if (zx.m_trace_display_writes && address >= ZX_DISPLAY_ADDR && address < ZX_DISPLAY_END)
+		{
+			auto& stats = zx.m_display_writes[Z_Z80_STATE_PC(&zx.m_z80.state)];
+			stats.caller = zx.DPeek(Z_Z80_STATE_SP(&zx.m_z80.state));
+			stats.writes++;
+		}
+
+		if (address >= 0x4000 && zx.m_mem[address] != value)
+		{
 			zx.m_mem[address] = value;
+			zx.m_side_effects++;
+		}
 	};
+	if (ProfilingEnabled())
+	{
+		m_profiler = std::make_unique<Profiler>();
+		m_z80.profile = [](void* context, zuint16 pc, zuint16 sp, zuint8 cycles) {
+			auto& zx = *reinterpret_cast<Spectrum*>(context);
+			zx.m_profiler->OnInstruction(zx.m_mem, pc, sp, cycles,
+				Z_Z80_STATE_PC(&zx.m_z80.state), Z_Z80_STATE_SP(&zx.m_z80.state));
+		};
+	}
 	m_z80.in = [](void* /*context*/, zuint16 /*address*/) -> zuint8 { return 0xff; };
-	m_z80.out = [](void* /*context*/, zuint16 /*address*/, zuint8 /*value*/) {};
+	m_z80.out = [](void* context, zuint16 address, zuint8 value) {
+		auto& zx = *reinterpret_cast<Spectrum*>(context);
+
+		// Speaker is bit 4 of the ULA port, on any even address.
+		if (zx.m_capturing && !(address & 1))
+			zx.m_beeper->Write(zx.m_capture_cycles + zx.m_z80.cycles, (value & 0x10) != 0);
+	};
 	m_z80.int_data = [](void* /*context*/) -> zuint32 { return 0xffff; };
 	m_z80.hook = [](void* context, zuint16 address) {
 		auto& zx = *reinterpret_cast<Spectrum*>(context);
@@ -300,13 +406,33 @@ uint16_t Spectrum::DPoke(uint16_t address, uint16_t value)
 	return value;
 }
 
+Spectrum::~Spectrum()
+{
+	if (m_profiler)
+		MergeProfile(m_profiler->Data());
+}
+
 void Spectrum::LoadSnapshot(const std::wstring& filename)
 {
-	m_mem = FileContents(L"48.rom");
+	// Both files are mapped once and shared, as every new game creates a new emulation.
+	// Memory is filled straight from the mappings, with no intermediate copies.
+	auto rom = AssetLoader::Instance().Load(SPECTRUM_ROM_FILE).get();
+	auto snapshot = AssetLoader::Instance().Load(filename).get();
+
+	if (rom->size() < SPECTRUM_ROM_SIZE)
+		throw std::runtime_error("Invalid ROM: " + to_string(rom->Path()));
+
+	if (snapshot->size() < SNA_HEADER_SIZE + SPECTRUM_RAM_SIZE)
+		throw std::runtime_error("Invalid snapshot: " + to_string(snapshot->Path()));
+
 	m_mem.resize(SPECTRUM_MEM_SIZE);
+	std::copy(rom->begin(), rom->begin() + SPECTRUM_ROM_SIZE, m_mem.begin());
+
+	// Z80 reads come straight from memory, in Z80_DIRECT_MEMORY builds.
+	m_z80.memory = m_mem.data();
 
-	auto file = FileContents(filename);
-	std::copy(file.begin() + 27, file.end(), m_mem.begin() + 0x4000);
+	auto& file = *snapshot;
+	std::copy(file.begin() + SNA_HEADER_SIZE, file.begin() + SNA_HEADER_SIZE + SPECTRUM_RAM_SIZE, m_mem.begin() + SPECTRUM_ROM_SIZE);
 
 	Z80_SP = file[23] + (file[24] << 8);
 	Z80_AF = file[21] + (file[22] << 8);
@@ -337,7 +463,7 @@ void Spectrum::LoadSnapshot(const std::wstring& filename)
 
 void Spectrum::RunFrame(bool interrupt)
 {
-	EmulateCycles(SPECTRUM_CYCLES_BEFORE_INT);
+	RunCycles(SPECTRUM_CYCLES_BEFORE_INT);
 
 	if (interrupt)
 		RunInterrupt();
@@ -347,11 +473,87 @@ void Spectrum::RunInterrupt()
 {
 	// Run for interrupt active period.
 	ActivateInterrupt(true);
+	m_run_limit = SPECTRUM_CYCLES_PER_INT;
 	EmulateCycles(SPECTRUM_CYCLES_PER_INT);
 	ActivateInterrupt(false);
 
 	// Run until IM 2 handler returns.
-	EmulateCycles(SPECTRUM_CYCLES_PER_FRAME);
+	RunCycles(SPECTRUM_CYCLES_PER_FRAME);
+}
+
+void Spectrum::RunCycles(int cycles)
+{
+	if (!m_idle_skip)
+	{
+		m_run_limit = cycles;
+		EmulateCycles(cycles);
+		return;
+	}
+
+	// Run in short slices, carrying any overrun into the next. If a slice has no side
+	// effects and PC is still nearby, the CPU may be spinning in a polling loop.
+	int consumed = 0;
+	while (consumed < cycles)
+	{
+		auto pc = Z80_PC;
+		auto side_effects = m_side_effects;
+
+		m_run_limit = cycles - consumed;
+		consumed += static_cast<int>(EmulateCycles(std::min(IDLE_SLICE_CYCLES, cycles - consumed)));
+
+		if (consumed < cycles && m_side_effects == side_effects && std::abs(Z80_PC - pc) <= IDLE_MAX_LOOP_BYTES)
+			consumed += SkipIdleLoop(cycles - consumed);
+	}
+}
+
+int Spectrum::SkipIdleLoop(int remaining)
+{
+	const auto start_state = Z80_STATE;
+	const auto side_effects = m_side_effects;
+	auto min_pc = Z80_PC, max_pc = Z80_PC;
+	int traced = 0, period = 0;
+
+	// Single-step until the CPU state repeats, to find the exact loop period.
+	for (int step = 0; step < IDLE_MAX_LOOP_STEPS && !period; ++step)
+	{
+		// The loop mustn't depend on R, as skipping doesn't run the refresh cycles.
+		if (m_mem[Z80_PC] == 0xed && m_mem[(Z80_PC + 1) & 0xffff] == 0x5f)	// LD A,R
+			return traced;
+
+		m_run_limit = remaining - traced;
+		traced += static_cast<int>(EmulateCycles(1));
+		min_pc = std::min(min_pc, Z80_PC);
+		max_pc = std::max(max_pc, Z80_PC);
+
+		if (traced >= remaining || m_side_effects != side_effects || max_pc - min_pc > IDLE_MAX_LOOP_BYTES)
+			return traced;
+
+		auto state = start_state;
+		state.r = Z80_R;
+		if (!memcmp(&state, &Z80_STATE, sizeof(state)))
+			period = traced;
+	}
+
+	// No repeat found, so it's not a simple polling loop.
+	if (!period)
+		return traced;
+
+	// Skip whole iterations, but leave the last for normal emulation so we
+	// stop on the same instruction as we would have without skipping.
+	auto iterations = (remaining - traced) / period - 1;
+	if (iterations <= 0)
+		return traced;
+
+	auto r_step = (Z80_R - start_state.r) & 0x7f;
+	Z80_R = static_cast<uint8_t>((Z80_R & 0x80) | ((Z80_R + iterations * r_step) & 0x7f));
+
+	auto& stats = m_idle_loops[min_pc];
+	stats.end_pc = max_pc;
+	stats.period_cycles = period;
+	stats.hits++;
+	stats.skipped_cycles += static_cast<uint64_t>(iterations) * period;
+
+	return traced + iterations * period;
 }
 
 void Spectrum::Hook(uint16_t address, uint8_t expected_opcode, HookFunction fn)
@@ -376,18 +578,24 @@ void Spectrum::OnHook(uint16_t address)
 	if (it != m_hooks.end())
 	{
 		const auto& hook = it->second;
+		m_side_effects++;
 
 		// Unhook
 		m_mem[address] = hook.orig_opcode;
 
-		// Call the hook handler
-		hook.func();
+		// Call the hook handler, unless capturing, when only the original code runs.
+		if (!m_capturing)
+			hook.func();
 
-		// If PC hasn't been changed, single-step past the hooked instruction.
+		// If PC hasn't been changed, single-step past the hooked instruction. The interrupt
+		// was already checked before the hook, so hold it off until the instruction is done.
 		if (Z80_PC == address)
 		{
 			auto old_cycles = Z80_CYCLES;
+			auto irq = Z_Z80_STATE_IRQ(&Z80_STATE);
+			ActivateInterrupt(false);
 			EmulateCycles(1);
+			ActivateInterrupt(irq);
 			Z80_CYCLES += old_cycles;
 		}
 
@@ -406,6 +614,265 @@ void Spectrum::OnHook(uint16_t address)
 	}
 }
 
+void Spectrum::Replace(uint16_t address, uint8_t expected_opcode, const char* name, int max_cycles, HleFunction fn)
+{
+	Hook(address, expected_opcode, [this, name, max_cycles, fn]
+		{
+			// The hook fetch has already refreshed R, but the original's first fetch will count it.
+			Z80_R--;
+
+			if ((Z_Z80_STATE_IRQ(&Z80_STATE) && Z_Z80_STATE_IFF1(&Z80_STATE)) ||
+				static_cast<int>(Z80_CYCLES) + max_cycles > m_run_limit)
+			{
+				// The original could be interrupted or cut short by the end of the run,
+				// so leave it to run as normal, from the single-step past the hook.
+			}
+			else if (m_hle_validate)
+				ValidateHle(name, fn);
+			else
+			{
+				// Charge the original routine's cycles and refreshes, so timing and R are unchanged.
+				auto cost = fn();
+				Z80_CYCLES += cost.cycles;
+				Z80_R += cost.m1;
+				Ret();
+			}
+		});
+}
+
+void Spectrum::ValidateHle(const char* name, HleFunction fn)
+{
+	constexpr auto max_cycles = SPECTRUM_CYCLES_PER_SECOND * 10;
+
+	auto old_cycles = Z80_CYCLES;
+	auto start_state = Z80_STATE;
+	auto start_mem = m_mem;
+
+	// Run the native version.
+	auto native_cost = fn();
+	Z80_R += native_cost.m1;
+	Ret();
+	auto native_state = Z80_STATE;
+	auto native_mem = m_mem;
+
+	// Rewind and emulate the original until it returns to the caller.
+	Z80_STATE = start_state;
+	std::copy(start_mem.begin(), start_mem.end(), m_mem.begin());
+
+	auto return_address = DPeek(Z80_SP);
+	auto return_sp = static_cast<uint16_t>(Z80_SP + 2);
+	auto emulated_cycles = 0;
+
+	while (Z80_PC != return_address || Z80_SP != return_sp)
+	{
+		emulated_cycles += static_cast<int>(EmulateCycles(1));
+		if (emulated_cycles > max_cycles)
+			throw std::runtime_error(std::string("HLE validation: ") + name + " did not return");
+	}
+
+	Z80_CYCLES = old_cycles + emulated_cycles;
+
+	// MEMPTR isn't visible to the game, and R bit 7 is only restored when a run ends.
+	native_state.memptr = Z80_STATE.memptr;
+	native_state.r = (native_state.r & 0x7f) | (Z80_R & 0x80);
+
+	std::stringstream ss;
+	ss << std::hex << std::uppercase;
+
+	if (memcmp(&native_state, &Z80_STATE, sizeof(native_state)))
+	{
+		ss << "HLE validation: " << name << " registers differ (AF=" << native_state.af.value_uint16
+			<< "/" << Z80_AF << " BC=" << native_state.bc.value_uint16 << "/" << Z80_BC
+			<< " DE=" << native_state.de.value_uint16 << "/" << Z80_DE
+			<< " HL=" << native_state.hl.value_uint16 << "/" << Z80_HL
+			<< " R=" << static_cast<int>(native_state.r) << "/" << static_cast<int>(Z80_R) << ")";
+	}
+	else if (native_mem != m_mem)
+	{
+		auto mismatch = std::mismatch(native_mem.begin(), native_mem.end(), m_mem.begin());
+		ss << "HLE validation: " << name << " memory differs at " << (mismatch.first - native_mem.begin());
+	}
+	else if (native_cost.cycles != emulated_cycles)
+	{
+		ss << "HLE validation: " << name << " took " << std::dec << native_cost.cycles
+			<< " cycles instead of " << emulated_cycles;
+	}
+
+	// The emulated result stands, but any difference is fatal.
+	if (!ss.str().empty())
+		throw std::runtime_error(ss.str());
+}
+
+// Runs the original tune player to completion on a copy of the machine state, with speaker
+// changes timed in CPU cycles, then restores the state so the game continues as if it had
+// been skipped. Tunes are the same each time, so they're only captured once.
+std::shared_ptr<const SoundData> Spectrum::CaptureTune(uint8_t tune)
+{
+	constexpr auto max_cycles = SPECTRUM_CYCLES_PER_SECOND * 30;
+
+	{
+		std::lock_guard<std::mutex> lock(s_tune_cache_mutex);
+		auto it = s_tune_cache.find(tune);
+		if (it != s_tune_cache.end())
+			return it->second;
+	}
+
+	auto old_cycles = Z80_CYCLES;
+	auto start_state = Z80_STATE;
+	auto start_mem = m_mem;
+	auto side_effects = m_side_effects;
+
+	auto return_address = DPeek(Z80_SP);
+	auto return_sp = static_cast<uint16_t>(Z80_SP + 2);
+
+	m_capturing = true;
+	m_capture_cycles = 0;
+	m_beeper->Start();
+
+	while ((Z80_PC != return_address || Z80_SP != return_sp) && m_capture_cycles < max_cycles)
+		m_capture_cycles += EmulateCycles(1);
+
+	m_capturing = false;
+	std::shared_ptr<const SoundData> sound = m_beeper->Render(m_capture_cycles);
+
+	Z80_STATE = start_state;
+	Z80_CYCLES = old_cycles;
+	std::copy(start_mem.begin(), start_mem.end(), m_mem.begin());
+	m_side_effects = side_effects;
+
+	std::lock_guard<std::mutex> lock(s_tune_cache_mutex);
+	s_tune_cache[tune] = sound;
+	return sound;
+}
+
+void Spectrum::RegisterHleRoutines()
+{
+	// Replacements are added here as hot routines are identified by profiling (--profile).
+	// Each must read its inputs from registers and memory, write outputs using Poke(),
+	// and return the exact cycles and opcode fetches (for R) taken by the original, so the
+	// game runs identically. The worst case cycles decide when the original must run instead.
+	// Check new routines by playing or replaying sessions with HLEValidate=1.
+
+	// Random number generator, clocking a 40-bit shift register 8 times for a new byte in A.
+	Replace(0xad1f, 0xd5 /*PUSH DE*/, "random", 772, [&]
+		{
+			Push(Z80_DE);
+			Push(Z80_BC);
+
+			uint8_t e = m_mem[ZX_RNG_STATE_ADDR + 0];
+			uint8_t d = m_mem[ZX_RNG_STATE_ADDR + 1];
+			uint8_t c = m_mem[ZX_RNG_STATE_ADDR + 2];
+			uint16_t hl = DPeek(ZX_RNG_STATE_ADDR + 3);
+			uint8_t f = Z80_F;
+
+			for (int i = 0; i < 8; ++i)
+			{
+				// Feedback from C.3 xor H.0, shifted through E, D, C and HL.
+				int carry = ((c >> 3) ^ (hl >> 8)) & 1;
+				int carry_e = e >> 7;
+				e = static_cast<uint8_t>((e << 1) | carry);
+				int carry_d = d >> 7;
+				d = static_cast<uint8_t>((d << 1) | carry_e);
+				int carry_c = c >> 7;
+				c = static_cast<uint8_t>((c << 1) | carry_d);
+
+				// ADC HL,HL
+				auto result = static_cast<uint16_t>(hl + hl + carry_c);
+				auto total = static_cast<int16_t>(hl) * 2 + carry_c;
+				f = static_cast<uint8_t>(((result >> 8) & (FLAG_S | FLAG_Y | FLAG_X)) |
+					(result ? 0 : FLAG_Z) |
+					((((hl & 0xfff) * 2 + carry_c) >> 8) & FLAG_H) |
+					((total < -32768 || total > 32767) ? FLAG_PV : 0) |
+					(hl >> 15));
+				hl = result;
+			}
+
+			Poke(ZX_RNG_STATE_ADDR + 2, c);
+			Poke(ZX_RNG_STATE_ADDR + 0, e);
+			Poke(ZX_RNG_STATE_ADDR + 1, d);
+			Poke(ZX_RNG_STATE_ADDR + 3, hl & 0xff);
+			Poke(ZX_RNG_STATE_ADDR + 4, hl >> 8);
+
+			Z80_HL = hl;
+			Z80_A = hl >> 8;
+			Z80_F = f;
+			Z80_BC = Pop();
+			Z80_DE = Pop();
+			return HleCost{ 772, 137 };
+		});
+
+	// Unsigned 8x8 multiply of A by the multiplier, for a high byte in A and low byte in memory.
+	Replace(0x9362, 0xc5 /*PUSH BC*/, "multiply", 273, [&]
+		{
+			Push(Z80_BC);
+
+			uint8_t b = m_mem[ZX_MULTIPLIER_ADDR];
+			uint8_t c = Z80_A;
+			uint8_t a = 0;
+			int cycles = 44, m1 = 7;
+
+			// SRL C, then 8 steps of shift and add.
+			int carry = c & 1;
+			c >>= 1;
+			for (int i = 0; i < 8; ++i)
+			{
+				if (carry)
+				{
+					carry = (a + b) > 0xff;
+					a += b;
+					cycles += 11;
+					m1++;
+				}
+				else
+					cycles += 12;
+
+				int carry_a = a & 1;
+				a = static_cast<uint8_t>((a >> 1) | (carry << 7));
+				carry = c & 1;
+				c = static_cast<uint8_t>((c >> 1) | (carry_a << 7));
+				cycles += 12;
+				m1 += 4;
+			}
+
+			Poke(ZX_PRODUCT_LSB_ADDR, c);
+
+			Z80_HL = ZX_PRODUCT_LSB_ADDR;
+			Z80_A = a;
+			Z80_F = ShiftFlags(c, carry);
+			Z80_BC = Pop();
+			return HleCost{ cycles + 37, m1 + 4 };
+		});
+
+	// Map entry at the current tile, with carry set if it holds an object.
+	Replace(0xa528, 0x3a /*LD A,(nn)*/, "map_entry", 160, [&]
+		{
+			auto x = m_mem[ZX_TILE_X_ADDR];
+			auto z = m_mem[ZX_TILE_Z_ADDR];
+
+			Z80_E = static_cast<uint8_t>(((x << 3) & 0xe0) | z);
+			Poke(ZX_MAP_PTR_ADDR + 1, 0x61 + (x & 3));
+			Z80_HL = DPeek(ZX_MAP_PTR_ADDR) + Z80_DE;
+
+			// CP 0xC0, then CCF.
+			uint8_t a = m_mem[Z80_HL];
+			auto diff = static_cast<uint8_t>(a - 0xc0);
+			auto total = static_cast<int8_t>(a) + 64;
+			uint8_t f = static_cast<uint8_t>((diff & FLAG_S) | (diff ? 0 : FLAG_Z) |
+				((total > 127) ? FLAG_PV : 0));
+			int carry = a < 0xc0;
+
+			Z80_A = a;
+			Z80_F = static_cast<uint8_t>(f | (a & (FLAG_Y | FLAG_X)) | (carry << 4) | (carry ^ 1));
+			return HleCost{ 160, 21 };
+		});
+}
+
+void Spectrum::Poke(uint16_t address, uint8_t value)
+{
+	// Write as the Z80 would, so idle loop detection sees the change.
+	m_z80.write(this, address, value);
+}
+
 void Spectrum::GetLandscapeAndCode(int& landscape_bcd, uint32_t& secret_code_bcd) const
 {
 	landscape_bcd = (m_mem[ZX_BCD_LANDSCAPE_MSB] << 8) | m_mem[ZX_BCD_LANDSCAPE_LSB];
@@ -445,145 +912,162 @@ Model Spectrum::GetModel(int idx, bool ignore_under) const
 	return model;
 }
 
-uint8_t Spectrum::GetTileShape(int x, int z) const
+HeightField Spectrum::ExtractHeightField() const
 {
-	auto map_entry = m_mem[GetMapAddress(x, z)];
-	if (map_entry >= 0xc0)
+	HeightField height_field;
+
+	for (int z = 0; z < SENTINEL_MAP_SIZE; ++z)
 	{
-		for (auto entry = map_entry; entry > 0x40; )
+		for (int x = 0; x < SENTINEL_MAP_SIZE; ++x)
 		{
-			map_entry = m_mem[ZX_OBJS_Y + (entry & 0x3f)] << 4;
-			entry = m_mem[ZX_OBJS_UNDER + (entry & 0x3f)];
+			// Walk down any object stack to find the original map entry.
+			auto map_entry = m_mem[GetMapAddress(x, z)];
+			if (map_entry >= 0xc0)
+			{
+				for (auto entry = map_entry; entry > 0x40; )
+				{
+					map_entry = m_mem[ZX_OBJS_Y + (entry & 0x3f)] << 4;
+					entry = m_mem[ZX_OBJS_UNDER + (entry & 0x3f)];
+				}
+			}
+
+			height_field.entries[z * SENTINEL_MAP_SIZE + x] = map_entry;
 		}
 	}
 
-	return map_entry & 0xf;
-}
-
-void Spectrum::LandscapeVertexIndexToTile(int vertex_index, int& tile_x, int& tile_z)
-{
-	// This calculation must match the order in ExtractLandscape below.
-	auto tile_index = vertex_index / ZX_VERTICES_PER_TILE;
-	tile_x = tile_index % (SENTINEL_MAP_SIZE - 1);
-	tile_z = tile_index / (SENTINEL_MAP_SIZE - 1);
+	return height_field;
 }
 
-Model Spectrum::ExtractLandscape() const
+Model Spectrum::ExtractLandscape(bool optimised) const
 {
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 
-	for (int z = 0; z < SENTINEL_MAP_SIZE - 1; ++z)
+	auto pLandscapeTiles = std::make_shared<LandscapeTiles>();
+	pLandscapeTiles->origin = { -(SENTINEL_MAP_SIZE / 2) - 0.5f, -(SENTINEL_MAP_SIZE / 2) - 0.5f };
+	pLandscapeTiles->height_field = ExtractHeightField();
+	auto& height_field = pLandscapeTiles->height_field;
+	auto& tile_triangles = pLandscapeTiles->triangles;
+
+	if (optimised)
+		BuildOptimisedLandscape(height_field, vertices, indices, tile_triangles);
+	else
 	{
-		for (int x = 0; x < SENTINEL_MAP_SIZE - 1; ++x)
+		// Convert the map entries to vertex heights, 4 at a time.
+		std::array<float, SENTINEL_MAP_SIZE * SENTINEL_MAP_SIZE> heights;
+		for (size_t i = 0; i < heights.size(); i += 4)
 		{
-			uint8_t tile_entry = 0;
-			std::array<Vertex, 4> tile_vertices;
-			uint32_t colour{};
+			XMUBYTE4 packed_entries;
+			std::memcpy(&packed_entries, &height_field.entries[i], sizeof(packed_entries));
 
-			for (int zz = 0; zz < 2; ++zz)
+			auto vHeights = XMVectorFloor(XMVectorScale(XMLoadUByte4(&packed_entries), 1.0f / 16.0f));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&heights[i]), vHeights);
+		}
+
+		for (int z = 0; z < SENTINEL_MAP_SIZE - 1; ++z)
+		{
+			for (int x = 0; x < SENTINEL_MAP_SIZE - 1; ++x)
 			{
-				for (int xx = 0; xx < 2; ++xx)
-				{
-					auto map_x = (x + xx);
-					auto map_z = (z + zz);
-					auto offset = GetMapAddress(map_x, map_z);
-					auto map_entry = m_mem[offset];
+				auto tile_shape = height_field.Shape(x, z);
+				std::array<Vertex, 4> tile_vertices;
+				uint32_t colour{};
 
-					if (map_entry >= 0xc0)
-					{
-						for (auto entry = map_entry; entry > 0x40; )
-						{
-							map_entry = m_mem[ZX_OBJS_Y + (entry & 0x3f)] << 4;
-							entry = m_mem[ZX_OBJS_UNDER + (entry & 0x3f)];
-						}
-					}
+				bool alt_colour = ((x ^ z) & 1) != 0;
+				if (tile_shape)
+					colour = alt_colour ? 0x10 : 0x11;	// sloped
+				else
+					colour = alt_colour ? 0x1 : 0x3;	// flat
 
-					if (xx == 0 && zz == 0)
+				for (int zz = 0; zz < 2; ++zz)
+				{
+					for (int xx = 0; xx < 2; ++xx)
 					{
-						tile_entry = map_entry;
-						bool alt_colour = ((x ^ z) & 1) != 0;
+						auto map_x = (x + xx);
+						auto map_z = (z + zz);
 
-						if (tile_entry & 0xf)
-							colour = alt_colour ? 0x10 : 0x11;	// sloped
-						else
-							colour = alt_colour ? 0x1 : 0x3;	// flat
+						float xxx = (map_x - (SENTINEL_MAP_SIZE / 2)) - 0.5f;
+						float yyy = heights[map_z * SENTINEL_MAP_SIZE + map_x];
+						float zzz = (map_z - (SENTINEL_MAP_SIZE / 2)) - 0.5f;
+
+						Vertex v{ xxx, yyy, zzz, colour, xx ? 1.0f : 0.0f, zz ? 1.0f : 0.0f };
+						tile_vertices[zz * 2 + xx] = std::move(v);
 					}
+				}
 
-					float xxx = (map_x - (SENTINEL_MAP_SIZE / 2)) - 0.5f;
-					float yyy = (map_entry >> 4) * 1.0f;
-					float zzz = (map_z - (SENTINEL_MAP_SIZE / 2)) - 0.5f;
+				auto base_vertex = static_cast<uint32_t>(vertices.size());
+				auto num_triangles = indices.size() / 3;
 
-					Vertex v{ xxx, yyy, zzz, colour, xx ? 1.0f : 0.0f, zz ? 1.0f : 0.0f };
-					tile_vertices[zz * 2 + xx] = std::move(v);
+				switch (tile_shape)
+				{
+				// Simple case: 4 vertices for 2 triangles (shared normals)
+				case 0b0000:	// flat
+				case 0b0001:	// slope facing back
+				case 0b0101:	// slope facing right
+				case 0b1001:	// slope facing front
+				case 0b1101:	// slope facing left
+					vertices.insert(vertices.end(), tile_vertices.begin(), tile_vertices.end());
+
+					indices.push_back(base_vertex + 0);
+					indices.push_back(base_vertex + 2);
+					indices.push_back(base_vertex + 3);
+
+					indices.push_back(base_vertex + 0);
+					indices.push_back(base_vertex + 3);
+					indices.push_back(base_vertex + 1);
+					break;
+
+				// Corners: 6 vertices for 2 triangles (separate normals)
+				case 0b0010:	// inside corner, facing front
+				case 0b0011:	// inside corner, facing back
+				case 0b0100:	// stretched faces
+				case 0b1010:	// outside corner, facing front left
+				case 0b1011:	// outside corner, facing back right
+				case 0b1100:	// flat diagonal diamond
+					vertices.push_back(tile_vertices[0]);
+					vertices.push_back(tile_vertices[2]);
+					vertices.push_back(tile_vertices[3]);
+					indices.push_back(base_vertex + 0);
+					indices.push_back(base_vertex + 1);
+					indices.push_back(base_vertex + 2);
+
+					vertices.push_back(tile_vertices[0]);
+					vertices.push_back(tile_vertices[3]);
+					vertices.push_back(tile_vertices[1]);
+					indices.push_back(base_vertex + 3);
+					indices.push_back(base_vertex + 4);
+					indices.push_back(base_vertex + 5);
+					break;
+
+				// Corners (other diagonal): 6 vertices for 2 triangles (separate normals)
+				case 0b0110:	// outside corner, facing front right
+				case 0b0111:	// inside corner, facing front right
+				case 0b1110:	// outside edge, facing back left
+				case 0b1111:	// inside edge, facing back left
+					vertices.push_back(tile_vertices[0]);
+					vertices.push_back(tile_vertices[2]);
+					vertices.push_back(tile_vertices[1]);
+					indices.push_back(base_vertex + 0);
+					indices.push_back(base_vertex + 1);
+					indices.push_back(base_vertex + 2);
+
+					vertices.push_back(tile_vertices[1]);
+					vertices.push_back(tile_vertices[2]);
+					vertices.push_back(tile_vertices[3]);
+					indices.push_back(base_vertex + 3);
+					indices.push_back(base_vertex + 4);
+					indices.push_back(base_vertex + 5);
+					break;
+
+				case 0b1000:	// unused
+					break;
 				}
-			}
 
-			auto base_vertex = static_cast<uint32_t>(vertices.size());
-
-			switch (tile_entry & 0xf)
-			{
-			// Simple case: 4 vertices for 2 triangles (shared normals)
-			case 0b0000:	// flat
-			case 0b0001:	// slope facing back
-			case 0b0101:	// slope facing right
-			case 0b1001:	// slope facing front
-			case 0b1101:	// slope facing left
-				vertices.insert(vertices.end(), tile_vertices.begin(), tile_vertices.end());
-
-				indices.push_back(base_vertex + 0);
-				indices.push_back(base_vertex + 2);
-				indices.push_back(base_vertex + 3);
-
-				indices.push_back(base_vertex + 0);
-				indices.push_back(base_vertex + 3);
-				indices.push_back(base_vertex + 1);
-				break;
-
-			// Corners: 6 vertices for 2 triangles (separate normals)
-			case 0b0010:	// inside corner, facing front
-			case 0b0011:	// inside corner, facing back
-			case 0b0100:	// stretched faces
-			case 0b1010:	// outside corner, facing front left
-			case 0b1011:	// outside corner, facing back right
-			case 0b1100:	// flat diagonal diamond
-				vertices.push_back(tile_vertices[0]);
-				vertices.push_back(tile_vertices[2]);
-				vertices.push_back(tile_vertices[3]);
-				indices.push_back(base_vertex + 0);
-				indices.push_back(base_vertex + 1);
-				indices.push_back(base_vertex + 2);
-
-				vertices.push_back(tile_vertices[0]);
-				vertices.push_back(tile_vertices[3]);
-				vertices.push_back(tile_vertices[1]);
-				indices.push_back(base_vertex + 3);
-				indices.push_back(base_vertex + 4);
-				indices.push_back(base_vertex + 5);
-				break;
-
-			// Corners (other diagonal): 6 vertices for 2 triangles (separate normals)
-			case 0b0110:	// outside corner, facing front right
-			case 0b0111:	// inside corner, facing front right
-			case 0b1110:	// outside edge, facing back left
-			case 0b1111:	// inside edge, facing back left
-				vertices.push_back(tile_vertices[0]);
-				vertices.push_back(tile_vertices[2]);
-				vertices.push_back(tile_vertices[1]);
-				indices.push_back(base_vertex + 0);
-				indices.push_back(base_vertex + 1);
-				indices.push_back(base_vertex + 2);
-
-				vertices.push_back(tile_vertices[1]);
-				vertices.push_back(tile_vertices[2]);
-				vertices.push_back(tile_vertices[3]);
-				indices.push_back(base_vertex + 3);
-				indices.push_back(base_vertex + 4);
-				indices.push_back(base_vertex + 5);
-				break;
-
-			case 0b1000:	// unused
-				break;
+				for (auto i = num_triangles; i < indices.size() / 3; ++i)
+				{
+					auto tri_index = static_cast<uint8_t>(i - num_triangles);
+					tile_triangles.push_back({ static_cast<uint8_t>(x), static_cast<uint8_t>(z),
+						static_cast<uint8_t>(x), static_cast<uint8_t>(z), tri_index });
+				}
 			}
 		}
 	}
@@ -592,11 +1076,202 @@ Model Spectrum::ExtractLandscape() const
 	auto pIndices = std::make_shared<std::vector<uint32_t>>(std::move(indices));
 
 	auto landscape = Model{ pVertices, pIndices, ModelType::Landscape };
+	landscape.m_pLandscapeTiles = pLandscapeTiles;
 	landscape.pos.x = SENTINEL_MAP_SIZE / 2;
 	landscape.pos.z = SENTINEL_MAP_SIZE / 2;
 	return landscape;
 }
 
+// Merge rectangles of coplanar tiles and share vertices between triangles. The
+// alternating tile colours are selected by the pixel shader using the map
+// coordinates in the texture coordinates, so neighbouring tiles can be merged.
+/*static*/ void Spectrum::BuildOptimisedLandscape(
+	const HeightField& height_field,
+	std::vector<Vertex>& vertices,
+	std::vector<uint32_t>& indices,
+	std::vector<LandscapeTriangle>& tile_triangles)
+{
+	static constexpr int TILES_PER_SIDE = SENTINEL_MAP_SIZE - 1;
+	static constexpr uint32_t FLAT_COLOURS = CHECKER_COLOUR_FLAG | (0x1 << 8) | 0x3;
+	static constexpr uint32_t SLOPED_COLOURS = CHECKER_COLOUR_FLAG | (0x10 << 8) | 0x11;
+
+	std::map<std::tuple<float, float, float, float, float, float, uint32_t>, uint32_t> vertex_lookup;
+
+	auto add_vertex = [&](const XMFLOAT3& pos, const XMFLOAT3& normal, uint32_t colour)
+	{
+		auto key = std::make_tuple(pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, colour);
+		auto it = vertex_lookup.find(key);
+		if (it != vertex_lookup.end())
+			return it->second;
+
+		// Texture coordinates are map coordinates, for the tile colour selection.
+		Vertex v{ pos.x, pos.y, pos.z, colour, pos.x + (SENTINEL_MAP_SIZE / 2) + 0.5f, pos.z + (SENTINEL_MAP_SIZE / 2) + 0.5f };
+		v.normal = normal;
+
+		auto index = static_cast<uint32_t>(vertices.size());
+		vertices.push_back(std::move(v));
+		vertex_lookup[key] = index;
+		return index;
+	};
+
+	auto add_triangle = [&](const XMFLOAT3& p1, const XMFLOAT3& p2, const XMFLOAT3& p3, uint32_t colour, const LandscapeTriangle& tri)
+	{
+		auto v1 = XMLoadFloat3(&p1);
+		auto v2 = XMLoadFloat3(&p2);
+		auto v3 = XMLoadFloat3(&p3);
+
+		XMFLOAT3 normal;
+		XMStoreFloat3(&normal, XMVector3Normalize(XMVector3Cross(
+			XMVectorSubtract(v2, v1), XMVectorSubtract(v3, v2))));
+
+		indices.push_back(add_vertex(p1, normal, colour));
+		indices.push_back(add_vertex(p2, normal, colour));
+		indices.push_back(add_vertex(p3, normal, colour));
+		tile_triangles.push_back(tri);
+	};
+
+	auto corner_pos = [&](int map_x, int map_z)
+	{
+		return XMFLOAT3{
+			(map_x - (SENTINEL_MAP_SIZE / 2)) - 0.5f,
+			static_cast<float>(height_field.Height(map_x, map_z)),
+			(map_z - (SENTINEL_MAP_SIZE / 2)) - 0.5f };
+	};
+
+	// Planar tiles are keyed by the plane equation y = a*x + b*z + c, in map units.
+	auto plane_key = [&](int x, int z, std::tuple<int, int, int>& key)
+	{
+		auto y0 = static_cast<int>(height_field.Height(x, z));
+		auto a = height_field.Height(x + 1, z) - y0;
+		auto b = height_field.Height(x, z + 1) - y0;
+
+		switch (height_field.Shape(x, z))
+		{
+		case 0b0000:	// flat
+		case 0b0001:	// slope facing back
+		case 0b0101:	// slope facing right
+		case 0b1001:	// slope facing front
+		case 0b1101:	// slope facing left
+			key = std::make_tuple(a, b, y0 - a * x - b * z);
+			return height_field.Height(x + 1, z + 1) == y0 + a + b;
+		}
+
+		return false;
+	};
+
+	std::vector<bool> merged(TILES_PER_SIDE * TILES_PER_SIDE);
+
+	for (int z = 0; z < TILES_PER_SIDE; ++z)
+	{
+		for (int x = 0; x < TILES_PER_SIDE; ++x)
+		{
+			auto tile_index = z * TILES_PER_SIDE + x;
+			if (merged[tile_index])
+				continue;
+
+			auto tile_shape = height_field.Shape(x, z);
+			auto colour = tile_shape ? SLOPED_COLOURS : FLAT_COLOURS;
+			LandscapeTriangle tri{ static_cast<uint8_t>(x), static_cast<uint8_t>(z),
+				static_cast<uint8_t>(x), static_cast<uint8_t>(z), 0 };
+
+			std::tuple<int, int, int> key, other_key;
+			if (!plane_key(x, z, key))
+			{
+				// Non-planar tiles keep their two triangles.
+				if (tile_shape == 0b1000)
+					continue;
+
+				std::array<XMFLOAT3, 4> corners
+				{
+					corner_pos(x, z), corner_pos(x + 1, z),
+					corner_pos(x, z + 1), corner_pos(x + 1, z + 1)
+				};
+
+				auto order = HeightField::TileCornerOrder(tile_shape);
+				add_triangle(corners[order[0]], corners[order[1]], corners[order[2]], colour, tri);
+				tri.tri_index = 1;
+				add_triangle(corners[order[3]], corners[order[4]], corners[order[5]], colour, tri);
+				continue;
+			}
+
+			auto same_plane = [&](int x2, int z2)
+			{
+				return !merged[z2 * TILES_PER_SIDE + x2] &&
+					(height_field.Shape(x2, z2) != 0) == (tile_shape != 0) &&
+					plane_key(x2, z2, other_key) && other_key == key;
+			};
+
+			// Grow the rectangle right as far as possible, then down by whole rows.
+			auto width = 1;
+			while (x + width < TILES_PER_SIDE && same_plane(x + width, z))
+				++width;
+
+			auto height = 1;
+			for (; z + height < TILES_PER_SIDE; ++height)
+			{
+				auto row_matches = true;
+				for (int xx = 0; xx < width && row_matches; ++xx)
+					row_matches = same_plane(x + xx, z + height);
+
+				if (!row_matches)
+					break;
+			}
+
+			for (int zz = 0; zz < height; ++zz)
+			{
+				for (int xx = 0; xx < width; ++xx)
+					merged[(z + zz) * TILES_PER_SIDE + (x + xx)] = true;
+			}
+
+			// Rectangle corners are map vertices, so they come from the height field too.
+			auto p0 = corner_pos(x, z);
+			auto p1 = corner_pos(x + width, z);
+			auto p2 = corner_pos(x, z + height);
+			auto p3 = corner_pos(x + width, z + height);
+
+			tri.x1 = static_cast<uint8_t>(x + width - 1);
+			tri.z1 = static_cast<uint8_t>(z + height - 1);
+			add_triangle(p0, p2, p3, colour, tri);
+			add_triangle(p0, p3, p1, colour, tri);
+		}
+	}
+
+	// Reorder the triangles for post-transform cache reuse.
+	auto order = Model::CacheOptimisedTriangleOrder(indices, vertices.size());
+
+	std::vector<uint32_t> ordered_indices;
+	std::vector<LandscapeTriangle> ordered_triangles;
+	ordered_indices.reserve(indices.size());
+	ordered_triangles.reserve(tile_triangles.size());
+
+	for (auto t : order)
+	{
+		ordered_indices.insert(ordered_indices.end(), indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+		ordered_triangles.push_back(tile_triangles[t]);
+	}
+
+	// Renumber the vertices in order of first use, for pre-transform locality.
+	static constexpr auto UNUSED = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex> ordered_vertices;
+	ordered_vertices.reserve(vertices.size());
+
+	for (auto& index : ordered_indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(ordered_vertices.size());
+			ordered_vertices.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices = std::move(ordered_vertices);
+	indices = std::move(ordered_indices);
+	tile_triangles = std::move(ordered_triangles);
+}
+
 std::vector<Model> Spectrum::ExtractText() const
 {
 	std::vector<Model> models;
@@ -729,39 +1404,32 @@ struct CharBlock
 std::vector<CharBlock> BitsToBlocks(std::vector<uint8_t> bits)
 {
 	std::vector<CharBlock> blocks;
-	bool again{};
 
-	do
+	// Single top-down pass over the rows. Each row gives up its runs leftmost first,
+	// with each run extended down as far as the rows below also contain it. Those
+	// bits are cleared so they're not claimed again when the lower rows are reached.
+	for (auto it = bits.begin(); it != bits.end(); ++it)
 	{
-		again = false;
-
-		for (auto it = bits.begin(); it != bits.end(); ++it)
+		while (uint8_t bitmap = *it)
 		{
-			if (uint8_t bitmap = *it)
-			{
-				int start, end;
-				for (start = 7; (start > 0) && !(bitmap & (1 << start)); --start);
-				for (end = start; (end >= 0) && (bitmap & (1 << end)); --end);
-
-				uint8_t mask = ((1 << (start + 1)) - 1) & ~((1 << (end + 1)) - 1);
-
-
-				auto it2 = it;
-				for (; it2 != bits.end() && ((*it2 & mask) == mask); ++it2)
-					*it2 &= ~mask;
-
-				blocks.push_back({
-				   7 - start,
-				   static_cast<int>(std::distance(bits.begin(), it)),
-				   start - end,
-				   static_cast<int>(std::distance(it, it2))
-					});
-
-				again = true;
-				break;
-			}
+			int start, end;
+			for (start = 7; (start > 0) && !(bitmap & (1 << start)); --start);
+			for (end = start; (end >= 0) && (bitmap & (1 << end)); --end);
+
+			uint8_t mask = ((1 << (start + 1)) - 1) & ~((1 << (end + 1)) - 1);
+
+			auto it2 = it;
+			for (; it2 != bits.end() && ((*it2 & mask) == mask); ++it2)
+				*it2 &= ~mask;
+
+			blocks.push_back({
+			   7 - start,
+			   static_cast<int>(std::distance(bits.begin(), it)),
+			   start - end,
+			   static_cast<int>(std::distance(it, it2))
+				});
 		}
-	} while (again);
+	}
 
 	return blocks;
 }
@@ -815,11 +1483,18 @@ void AppendExtrudedBlock(const CharBlock& block, std::vector<Vertex>& char_verti
 	}
 }
 
-Model Spectrum::CharToModel(char ch, int colour) const
+Model Spectrum::CharToModel(char ch, int colour)
 {
 	constexpr float scale_x = 0.1f;
 	constexpr float scale_y = 0.05f;
 
+	// The font is part of the fixed game snapshot, so glyphs survive game resets.
+	auto key = std::make_pair(ch, colour);
+	std::lock_guard<std::mutex> lock(s_char_cache_mutex);
+	auto it = s_char_cache.find(key);
+	if (it != s_char_cache.end())
+		return it->second;
+
 	auto addr = ZX_GAME_FONT_ADDR + (ch - ' ') * 8;
 	std::vector<uint8_t> char_data(m_mem.begin() + addr, m_mem.begin() + addr + 8);
 
@@ -833,6 +1508,46 @@ Model Spectrum::CharToModel(char ch, int colour) const
 	auto pVertices = std::make_shared<std::vector<Vertex>>(std::move(vertices));
 	auto pIndices = std::make_shared<std::vector<uint32_t>>(std::move(indices));
 
+	auto model = Model{ pVertices, pIndices, ModelType::Letter };
+	s_char_cache[key] = model;
+	return model;
+}
+
+Model Spectrum::StringToModel(const std::string& str, int colour, float spacing)
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	float x_offset = 0.0f;
+
+	// Combine the cached glyphs into a single mesh, with the characters spaced
+	// along the x-axis in model space.
+	for (auto ch : str)
+	{
+		if (ch != ' ')
+		{
+			auto glyph = CharToModel(ch, colour);
+			auto base_vertex = static_cast<uint32_t>(vertices.size());
+
+			for (auto v : *glyph.m_pVertices)
+			{
+				v.pos.x += x_offset;
+				vertices.push_back(std::move(v));
+			}
+
+			for (auto idx : *glyph.m_pIndices)
+				indices.push_back(base_vertex + idx);
+		}
+
+		x_offset += spacing;
+	}
+
+	// Nothing to draw for an empty or blank string.
+	if (vertices.empty())
+		return {};
+
+	auto pVertices = std::make_shared<std::vector<Vertex>>(std::move(vertices));
+	auto pIndices = std::make_shared<std::vector<uint32_t>>(std::move(indices));
+
 	return Model{ pVertices, pIndices, ModelType::Letter };
 }
 
@@ -928,6 +1643,41 @@ SeenState Spectrum::GetPlayerSeenState() const
 		return SeenState::HalfSeen;
 }
 
+uint64_t Spectrum::MemoryHash() const
+{
+	// 64-bit FNV-1a over the full address space.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (auto b : m_mem)
+		hash = (hash ^ b) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+uint64_t Spectrum::GameTablesHash() const
+{
+	// 64-bit FNV-1a over the object tables and landscape map, which are all we read back.
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto add = [&](int addr, int len)
+	{
+		for (auto i = addr; i < addr + len; ++i)
+			hash = (hash ^ m_mem[i]) * 0x100000001b3ULL;
+	};
+
+	add(ZX_OBJS_UNDER, MAX_OBJECTS);
+	add(ZX_OBJS_PITCH, MAX_OBJECTS);
+	add(ZX_OBJS_X, MAX_OBJECTS);
+	add(ZX_OBJS_Y, MAX_OBJECTS);
+	add(ZX_OBJS_Z, MAX_OBJECTS);
+	add(ZX_OBJS_YAW, MAX_OBJECTS);
+	add(ZX_OBJS_Y_FRAC, MAX_OBJECTS);
+	add(ZX_OBJS_TYPE, MAX_OBJECTS);
+	add(ZX_MAP_ADDR, SENTINEL_MAP_SIZE * SENTINEL_MAP_SIZE);
+	add(ZX_BCD_SECRET_CODE_ADDR, 4);
+	add(ZX_BCD_LANDSCAPE_LSB, 2);
+
+	return hash;
+}
+
 Vertex Spectrum::PolarToCartesian(uint8_t yaw, float y, uint8_t mag) const
 {
 	constexpr auto y_scale = 2.0f;
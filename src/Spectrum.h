@@ -1,5 +1,9 @@
 #pragma once
 #include "Model.h"
+#include "Profiler.h"
+
+static constexpr auto SENTINEL_SNAPSHOT_FILE = L"./sentinel.sna";
+static constexpr auto SPECTRUM_ROM_FILE = L"48.rom";
 
 static constexpr auto HEX_LANDSCAPES_KEY = L"HexLandscapes";
 static constexpr auto DEFAULT_HEX_LANDSCAPES = false;
@@ -51,46 +55,116 @@ static constexpr int SPECTRUM_CYCLES_PER_FRAME = SPECTRUM_CYCLES_PER_SECOND / SP
 static constexpr int SPECTRUM_CYCLES_PER_INT = 32;
 static constexpr int SPECTRUM_CYCLES_BEFORE_INT = SPECTRUM_CYCLES_PER_FRAME - SPECTRUM_CYCLES_PER_INT;
 
+static constexpr auto HLE_ENABLED_KEY = L"HLE";
+static constexpr auto HLE_VALIDATE_KEY = L"HLEValidate";
+static constexpr auto DISPLAY_PATCHES_KEY = L"DisplayPatches";
+static constexpr auto DISPLAY_WRITE_TRACE_KEY = L"DisplayWriteTrace";
+static constexpr auto DEFAULT_DISPLAY_PATCHES = L"9874,98fd";	// clear 3D view, fill polygon spans.
+static constexpr auto NO_DISPLAY_PATCHES = L"none";				// an empty value reads as unset.
+static constexpr auto ORIGINAL_AUDIO_KEY = L"OriginalAudio";
+
 enum class SeenState { Unseen, HalfSeen, FullSeen };
 
+class Beeper;
+struct SoundData;
+
+struct IdleLoopStats
+{
+	uint16_t end_pc{};
+	int period_cycles{};
+	uint64_t hits{};
+	uint64_t skipped_cycles{};
+};
+
+struct DisplayWriteStats
+{
+	uint16_t caller{};			// most recent return address on the stack.
+	uint64_t writes{};
+};
+
 class Spectrum
 {
 public:
-	Spectrum(std::wstring filename, ISentinelEvents* pCallback = nullptr);
+	Spectrum(std::wstring filename, ISentinelEvents* pCallback = nullptr, bool display_patches = true);
+	~Spectrum();
 
 	void LoadSnapshot(const std::wstring& filename);
 	void RunFrame(bool interrupt = true);
 	void RunInterrupt();
 
 	void GetLandscapeAndCode(int& landscape_bcd, uint32_t& secret_code_bcd) const;
+	uint32_t GetExpectedSecretCode() const { return m_expected_code_bcd; }
 	Model GetModel(ModelType type) const;
 	Model GetModel(int idx, bool ignore_under = false) const;
-	uint8_t GetTileShape(int x, int z) const;
-	void LandscapeVertexIndexToTile(int vertex_index, int& tile_x, int& tile_z);
-	Model ExtractLandscape() const;
+	HeightField ExtractHeightField() const;
+	Model ExtractLandscape(bool optimised = false) const;
 	std::vector<Model> ExtractText() const;
 	Model ExtractPlayerModel() const;
 	std::vector<Model> ExtractPlacedModels() const;
-	Model CharToModel(char ch, int colour) const;
+	Model CharToModel(char ch, int colour);
+	Model StringToModel(const std::string& str, int colour, float spacing);
 	Model IconToModel(int icon_idx, int colour);
 	std::vector<XMFLOAT4> GetGamePalette(int num_sentries = -1) const;
 	std::vector<XMFLOAT4> GetTitlePalette() const;
 	void SetPlayerPitch(float radians);
 	void SetPlayerYaw(float radians);
 	SeenState GetPlayerSeenState() const;
+	uint64_t MemoryHash() const;
+	uint64_t GameTablesHash() const;
+	const std::vector<uint16_t>& GetDisplayPatches() const { return m_display_patches; }
+	const std::map<uint16_t, DisplayWriteStats>& GetDisplayWriteStats() const { return m_display_writes; }
+	const std::map<uint16_t, IdleLoopStats>& GetIdleLoopStats() const { return m_idle_loops; }
+	std::shared_ptr<const SoundData> GetTuneSound() const { return m_tune_sound; }
 
 protected:
 	ISentinelEvents* m_pEvents{ nullptr };
 
+	void RunCycles(int cycles);
+	int SkipIdleLoop(int remaining);
+
 	std::vector<Model> ExtractModels();
 	Vertex PolarToCartesian(uint8_t yaw, float y, uint8_t mag) const;
+	static void BuildOptimisedLandscape(
+		const HeightField& height_field,
+		std::vector<Vertex>& vertices,
+		std::vector<uint32_t>& indices,
+		std::vector<LandscapeTriangle>& tile_triangles);
 
 	Z80 m_z80{};
 
 	uint32_t m_secret_code_bcd{};
+	uint32_t m_expected_code_bcd{};
 	std::vector<uint8_t> m_mem;
+
+	// Idle loops skipped, keyed by lowest loop address.
+	bool m_idle_skip{ true };
+	uint64_t m_side_effects{ 0 };	// memory changes and hook calls.
+	std::map<uint16_t, IdleLoopStats> m_idle_loops;
+
+	// Routines stubbed out as we draw the display ourselves, and any writes that remain.
+	std::vector<uint16_t> m_display_patches;
+	bool m_trace_display_writes{ false };
+	std::map<uint16_t, DisplayWriteStats> m_display_writes;
+
+	// Run native routines alongside the originals, to check for identical results?
+	bool m_hle_validate{ false };
+	int m_run_limit{ 0 };	// cycles left in the current run, from the start of this EmulateCycles.
+
+	// Original speaker output, captured from the tune player if enabled.
+	std::unique_ptr<Beeper> m_beeper;
+	bool m_capturing{ false };
+	uint64_t m_capture_cycles{ 0 };
+	std::shared_ptr<const SoundData> m_tune_sound;
+	static std::map<uint8_t, std::shared_ptr<const SoundData>> s_tune_cache;
+	static std::mutex s_tune_cache_mutex;
+
+	// Execution profile, merged into the process total on destruction.
+	std::unique_ptr<Profiler> m_profiler;
+
 	std::vector<Model> m_models;
 	std::map<std::pair<int, int>, Model> m_icon_cache;
+	static std::map<std::pair<char, int>, Model> s_char_cache;
+	static std::mutex s_char_cache_mutex;
 
 	void Push(uint16_t value);
 	uint16_t Pop();
@@ -104,6 +178,21 @@ protected:
 	void Hook(uint16_t address, uint8_t expected_opcode, HookFunction fn);
 	void OnHook(uint16_t address);
 
+	// Cycles and opcode fetches (M1) taken by the original routine, to advance the clock and R.
+	struct HleCost
+	{
+		int cycles{ 0 };
+		int m1{ 0 };
+	};
+
+	// Native replacement for a pure Z80 routine, returning what the original would take.
+	using HleFunction = std::function<HleCost()>;
+	void Replace(uint16_t address, uint8_t expected_opcode, const char* name, int max_cycles, HleFunction fn);
+	void ValidateHle(const char* name, HleFunction fn);
+	std::shared_ptr<const SoundData> CaptureTune(uint8_t tune);
+	void RegisterHleRoutines();
+	void Poke(uint16_t address, uint8_t value);
+
 	struct HookData
 	{
 		HookFunction func{ nullptr };
@@ -0,0 +1,43 @@
+#pragma once
+
+// Lock-free ring buffer for a single producer thread and a single consumer thread.
+template <typename T, size_t Size>
+class SpscRing
+{
+	static_assert((Size & (Size - 1)) == 0, "ring size must be a power of 2");
+
+public:
+	bool Push(T&& item)
+	{
+		auto tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == Size)
+			return false;
+
+		m_items[tail & (Size - 1)] = std::move(item);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item)
+	{
+		auto head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		item = std::move(m_items[head & (Size - 1)]);
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Empty() const
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+	}
+
+protected:
+	std::array<T, Size> m_items{};
+
+	// Head and tail on separate cache lines, as they're written by different threads.
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
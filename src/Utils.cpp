@@ -42,34 +42,16 @@ fs::path WorkingDirectory()
 	return wpath;
 }
 
-std::vector<uint8_t> FileContents(const std::wstring& filename)
+// Data files are found relative to the module, falling back to the working directory.
+fs::path FindFile(const std::wstring& filename)
 {
-	wchar_t szPath[MAX_PATH];
-	GetModuleFileName(NULL, szPath, _countof(szPath));
+	auto module_path = ModuleDirectory() / filename;
 
-	// Form a full path relative to the module path.
-	std::wstring full_path = szPath;
-	full_path = full_path.substr(0, full_path.rfind(L'\\') + 1);
-	full_path += filename;
+	std::error_code ec;
+	if (fs::exists(module_path, ec))
+		return module_path;
 
-	// Try module relative, falling back to CWD relative path.
-	HANDLE hfile = CreateFile(full_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hfile == INVALID_HANDLE_VALUE)
-		hfile = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-
-	if (hfile == INVALID_HANDLE_VALUE)
-	{
-		auto str = "File not found: " + to_string(filename);
-		throw std::runtime_error(str);
-	}
-
-	DWORD dwSize = GetFileSize(hfile, NULL), dwRead;
-	std::vector<BYTE> file(dwSize);
-	if (!ReadFile(hfile, file.data(), dwSize, &dwRead, NULL))
-		file.clear();
-	CloseHandle(hfile);
-
-	return file;
+	return filename;
 }
 
 std::mt19937& random_source()
@@ -4,7 +4,7 @@ void Fail(HRESULT hr, LPCWSTR pszOperation);
 fs::path ModulePath(HMODULE hmod = NULL);
 fs::path ModuleDirectory(HMODULE hmod = NULL);
 fs::path WorkingDirectory();
-std::vector<uint8_t> FileContents(const std::wstring& filename);
+fs::path FindFile(const std::wstring& filename);
 std::wstring WindowText(HWND hwnd);
 
 
@@ -67,5 +67,11 @@ inline float yaw_from_dir(const XMFLOAT3& dir)
 	return std::atan2(dir.x, dir.z);
 }
 
+// Decimal to BCD, as used for landscape numbers.
+inline int to_bcd(int n)
+{
+	return ((n / 1000) << 12) | (((n / 100) % 10) << 8) | (((n / 10) % 10) << 4) | (n % 10);
+}
+
 std::mt19937& random_source();
 uint32_t random_uint32();
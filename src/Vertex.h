@@ -10,3 +10,11 @@ struct Vertex
 	UINT32 colour{};
 	XMFLOAT2 texcoord{};
 };
+
+// Compact GPU vertex, converted from Vertex when a model is created.
+struct PackedVertex
+{
+	XMHALF4 pos{};			// w = 1
+	XMSHORTN2 normal{};		// octahedral encoding
+	XMUBYTE4 colour{};		// palette index, alternate palette index, u, v
+};
@@ -305,8 +305,8 @@ void View::InitScene()
 {
 	HRESULT hr;
 
-	m_pVertexHeap = std::make_unique<D3D11VertexHeap<Vertex>>(m_pDevice.Get(), MAX_HEAP_VERTICES);
-	m_pIndexHeap = std::make_unique<D3D11IndexHeap<uint32_t>>(m_pDevice.Get(), MAX_HEAP_INDICES);
+	m_pVertexHeap = std::make_unique<D3D11VertexHeap<PackedVertex>>(m_pDevice.Get(), MAX_HEAP_VERTICES);
+	m_pIndexHeap = std::make_unique<D3D11IndexHeap<uint16_t>>(m_pDevice.Get(), MAX_HEAP_INDICES);
 
 	hr = m_pDevice->CreateVertexShader(g_Sentinel_VS, sizeof(g_Sentinel_VS), NULL, m_pSentinelVertexShader.GetAddressOf());
 	if (FAILED(hr))
@@ -326,10 +326,9 @@ void View::InitScene()
 
 	static const std::vector<D3D11_INPUT_ELEMENT_DESC> layout
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "COLOR", 0, DXGI_FORMAT_R32_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
 	};
 
 	hr = m_pDevice->CreateInputLayout(layout.data(), static_cast<DWORD>(layout.size()), g_Sentinel_VS, static_cast<DWORD>(sizeof(g_Sentinel_VS)), m_pSentinelInputLayout.GetAddressOf());
@@ -516,11 +515,14 @@ void View::DrawModel(Model& model, const Model& relativeModel)
 {
 	assert(model.type != ModelType::Unknown);
 
+	// Repack if the vertices have been edited.
+	model.Pack();
+
 	if (!model.m_pHeapVertices)
-		model.m_pHeapVertices = m_pVertexHeap->alloc(m_pDeviceContext.Get(), *(model.m_pVertices));
+		model.m_pHeapVertices = m_pVertexHeap->alloc(m_pDeviceContext.Get(), *(model.m_pPackedVertices));
 
 	if (!model.m_pHeapIndices)
-		model.m_pHeapIndices = m_pIndexHeap->alloc(m_pDeviceContext.Get(), *(model.m_pIndices));
+		model.m_pHeapIndices = m_pIndexHeap->alloc(m_pDeviceContext.Get(), *(model.m_pPackedIndices));
 
 	if (!model.m_pVertexShader)
 		model.m_pVertexShader = m_pSentinelVertexShader;
@@ -543,7 +545,7 @@ void View::DrawModel(Model& model, const Model& relativeModel)
 	UpdateConstants(m_pPixelShaderConstantBuffer.Get(), m_pixelConstants);
 
 	m_pStateTracker->SetVertexBuffer(model.m_pHeapVertices->m_pBuffer.Get(), model.m_pHeapVertices->stride);
-	m_pStateTracker->SetIndexBuffer(model.m_pHeapIndices->m_pBuffer.Get(), DXGI_FORMAT_R32_UINT);
+	m_pStateTracker->SetIndexBuffer(model.m_pHeapIndices->m_pBuffer.Get(), DXGI_FORMAT_R16_UINT);
 	m_pStateTracker->SetVertexShader(model.m_pVertexShader.Get());
 	m_pStateTracker->SetPixelShader(model.m_pPixelShader.Get());
 	m_pStateTracker->SetRasterizerState(model.type == ModelType::Landscape ?
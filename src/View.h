@@ -165,8 +165,8 @@ protected:
 	ComPtr<ID3D11Buffer> m_pVertexShaderConstantBuffer;
 	ComPtr<ID3D11Buffer> m_pPixelShaderConstantBuffer;
 
-	std::unique_ptr<D3D11VertexHeap<Vertex>> m_pVertexHeap;
-	std::unique_ptr<D3D11IndexHeap<uint32_t>> m_pIndexHeap;
+	std::unique_ptr<D3D11VertexHeap<PackedVertex>> m_pVertexHeap;
+	std::unique_ptr<D3D11IndexHeap<uint16_t>> m_pIndexHeap;
 
 	std::unique_ptr<D3D11StateTracker> m_pStateTracker;
 
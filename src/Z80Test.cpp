@@ -0,0 +1,209 @@
+#include "stdafx.h"
+#include "Z80Test.h"
+#include "MappedFile.h"
+#include "Emulation.h"
+
+using Clock = std::chrono::high_resolution_clock;
+
+static constexpr uint16_t CPM_TPA_ADDR = 0x0100;		// program load address.
+static constexpr uint16_t CPM_BDOS_ADDR = 0x0005;		// system call entry point.
+static constexpr uint16_t CPM_BDOS_STUB_ADDR = 0xfe00;	// our BDOS, also the top of usable memory.
+static constexpr int CPM_RUN_CYCLES = 10'000'000;		// cycles between checks for exit.
+
+// Minimal CP/M machine, with BDOS calls trapped by the core's LD H,H hook.
+struct CpmMachine
+{
+	Z80 z80{};
+	std::vector<uint8_t> mem = std::vector<uint8_t>(0x10000);
+	std::string output;
+	size_t flushed{ 0 };
+	bool done{ false };
+};
+
+static void CpmHook(void* context, zuint16 address)
+{
+	auto& cpm = *reinterpret_cast<CpmMachine*>(context);
+	auto cpu = &cpm.z80.state;
+
+	// Warm boot, as the program exits.
+	if (address == 0x0000)
+	{
+		cpm.done = true;
+		cpm.z80.cycles += CPM_RUN_CYCLES;
+		return;
+	}
+
+	switch (Z_Z80_STATE_C(cpu))
+	{
+	case 2:		// console output of E.
+		cpm.output += static_cast<char>(Z_Z80_STATE_E(cpu));
+		break;
+
+	case 9:		// print string at DE, terminated by '$'.
+		for (auto addr = Z_Z80_STATE_DE(cpu); cpm.mem[addr] != '$'; ++addr)
+			cpm.output += static_cast<char>(cpm.mem[addr]);
+		break;
+	}
+
+	// Flush completed lines, as some tests take minutes.
+	auto eol = cpm.output.rfind('\n');
+	if (eol != std::string::npos && eol >= cpm.flushed)
+	{
+		fwrite(cpm.output.data() + cpm.flushed, 1, eol + 1 - cpm.flushed, stdout);
+		fflush(stdout);
+		cpm.flushed = eol + 1;
+	}
+
+	// Return to the caller.
+	auto sp = Z_Z80_STATE_SP(cpu);
+	Z_Z80_STATE_PC(cpu) = static_cast<zuint16>(cpm.mem[sp] | (cpm.mem[sp + 1] << 8));
+	Z_Z80_STATE_SP(cpu) = static_cast<zuint16>(sp + 2);
+	cpm.z80.cycles += 10;
+}
+
+int RunZ80Exerciser(const std::wstring& com_file)
+{
+	MappedFile program(FindFile(com_file));
+	if (program.empty() || program.size() > CPM_BDOS_STUB_ADDR - CPM_TPA_ADDR)
+	{
+		printf("Invalid CP/M program\n");
+		return 1;
+	}
+
+	auto pcpm = std::make_unique<CpmMachine>();
+	auto& cpm = *pcpm;
+	std::copy(program.begin(), program.end(), cpm.mem.begin() + CPM_TPA_ADDR);
+
+	// JP to the BDOS stub, which also gives the top of memory for the stack.
+	cpm.mem[0x0000] = BREAKPOINT_OPCODE;
+	cpm.mem[CPM_BDOS_ADDR + 0] = 0xc3;
+	cpm.mem[CPM_BDOS_ADDR + 1] = CPM_BDOS_STUB_ADDR & 0xff;
+	cpm.mem[CPM_BDOS_ADDR + 2] = CPM_BDOS_STUB_ADDR >> 8;
+	cpm.mem[CPM_BDOS_STUB_ADDR] = BREAKPOINT_OPCODE;
+
+	auto& z80 = cpm.z80;
+	z80.context = &cpm;
+	z80.memory = cpm.mem.data();
+	z80.read = [](void* context, zuint16 address) -> zuint8 {
+		return reinterpret_cast<CpmMachine*>(context)->mem[address];
+	};
+	z80.write = [](void* context, zuint16 address, zuint8 value) {
+		reinterpret_cast<CpmMachine*>(context)->mem[address] = value;
+	};
+	z80.in = [](void* /*context*/, zuint16 /*port*/) -> zuint8 { return 0xff; };
+	z80.out = [](void* /*context*/, zuint16 /*port*/, zuint8 /*value*/) {};
+	z80.int_data = [](void* /*context*/) -> zuint32 { return 0xffff; };
+	z80.hook = CpmHook;
+
+	z80_power(&z80, TRUE);
+	z80_reset(&z80);
+	Z_Z80_STATE_PC(&z80.state) = CPM_TPA_ADDR;
+	Z_Z80_STATE_SP(&z80.state) = CPM_BDOS_STUB_ADDR;
+
+	auto start_time = Clock::now();
+	uint64_t total_cycles = 0;
+
+	while (!cpm.done)
+		total_cycles += z80_run(&z80, CPM_RUN_CYCLES);
+
+	auto elapsed = std::chrono::duration<double>(Clock::now() - start_time).count();
+	elapsed = std::max(elapsed, 0.001);
+
+	// Remaining partial line.
+	printf("%s\n", cpm.output.substr(cpm.flushed).c_str());
+
+	// The exit hook adds a full run to end emulation, which isn't real work.
+	total_cycles -= CPM_RUN_CYCLES;
+
+	auto passed = cpm.output.find("ERROR") == std::string::npos;
+	printf("%s: %llu cycles in %.2fs, %.1f MHz (%.0fx Spectrum speed)\n", passed ? "PASS" : "FAIL",
+		static_cast<unsigned long long>(total_cycles), elapsed,
+		total_cycles / elapsed / 1e6, total_cycles / elapsed / SPECTRUM_CYCLES_PER_SECOND);
+	fflush(stdout);
+
+	return passed ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int RunSentinelDifferential(int num_landscapes, const std::wstring& reference_file, int game_frames)
+{
+	constexpr auto max_state_frames = 1000;
+
+	// Reference lines are the landscape number and memory hash, both in hex.
+	std::map<int, uint64_t> reference;
+	std::ifstream ref_in(reference_file);
+	auto have_reference = !!ref_in;
+	for (std::string line; std::getline(ref_in, line);)
+	{
+		std::istringstream ss(line);
+		int landscape_bcd{};
+		uint64_t hash{};
+		if (ss >> std::hex >> landscape_bcd >> hash)
+			reference[landscape_bcd] = hash;
+	}
+	ref_in.close();
+
+	std::stringstream ss_out;
+	int num_passed = 0;
+	uint64_t total_frames = 0;
+	auto start_time = Clock::now();
+
+	for (int i = 0; i < num_landscapes; ++i)
+	{
+		auto landscape_bcd = to_bcd(i);
+		uint64_t hash{};
+		auto ok = false;
+
+		try
+		{
+			Emulation emulation(SENTINEL_SNAPSHOT_FILE, landscape_bcd, 0, nullptr, false);
+
+			// Title screen, landscape preview, then into the game.
+			ok = true;
+			for (int j = 0; j < 3 && ok; ++j)
+				ok = emulation.Run({ EmulationCommandType::RunUntilStateChange, max_state_frames });
+
+			for (int j = 0; j < game_frames && ok; ++j)
+			{
+				EmulationCommand command{ EmulationCommandType::RunGameFrame, 1 };
+				command.run_frame = true;
+				ok = emulation.Run(command);
+			}
+
+			hash = emulation.GetSpectrum().MemoryHash();
+			total_frames += emulation.FrameCount();
+		}
+		catch (std::exception&)
+		{
+			ok = false;
+		}
+
+		auto it = reference.find(landscape_bcd);
+		auto matched = ok && (!have_reference || (it != reference.end() && it->second == hash));
+		num_passed += matched ? 1 : 0;
+
+		printf("%s landscape %04X: %016llx%s\n", matched ? "PASS" : "FAIL", landscape_bcd,
+			static_cast<unsigned long long>(hash), ok ? "" : " (failed to reach the game)");
+
+		ss_out << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << landscape_bcd
+			<< " " << std::setw(16) << hash << "\n";
+	}
+
+	auto elapsed = std::chrono::duration<double>(Clock::now() - start_time).count();
+	elapsed = std::max(elapsed, 0.001);
+
+	if (!have_reference)
+	{
+		std::ofstream ref_out(reference_file);
+		ref_out << ss_out.str();
+		printf("Created reference %s\n", to_string(reference_file).c_str());
+	}
+
+	printf("%d landscapes, %d passed, %.2fs, %.0f frames/sec (%.1fx real time)\n",
+		num_landscapes, num_passed, elapsed,
+		total_frames / elapsed, total_frames / elapsed / SPECTRUM_FRAMES_PER_SECOND);
+	fflush(stdout);
+
+	return (num_passed == num_landscapes) ? 0 : 1;
+}
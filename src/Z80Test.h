@@ -0,0 +1,9 @@
+#pragma once
+
+// Runs a CP/M instruction exerciser (such as zexdoc.com or zexall.com) on the Z80 core,
+// printing its output and speed. Returns 0 if no test reported an error.
+int RunZ80Exerciser(const std::wstring& com_file);
+
+// Plays the opening of each landscape for a number of game frames, comparing memory
+// hashes against a reference file. The reference is created if it doesn't exist.
+int RunSentinelDifferential(int num_landscapes, const std::wstring& reference_file, int game_frames = 500);
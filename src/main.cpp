@@ -8,17 +8,21 @@ int WINAPI WinMain(
 	_In_ int /*nShowCmd*/)
 {
 	std::unique_ptr<Application> pApplication;
+	int exit_code = 0;
 
 	try
 	{
 		pApplication = std::make_unique<Application>(hInstance);
 		if (pApplication->Init())
 			pApplication->Run();
+
+		exit_code = pApplication->ExitCode();
 	}
 	catch (std::exception& e)
 	{
 		MessageBoxA(NULL, e.what(), APP_NAME, MB_ICONERROR);
+		exit_code = 1;
 	}
 
-	return 0;
+	return exit_code;
 }
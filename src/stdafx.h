@@ -8,7 +8,9 @@
 
 #include <array>
 #include <vector>
+#include <deque>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <fstream>
 #include <chrono>
@@ -18,8 +20,14 @@
 #include <random>
 #include <functional>
 #include <sstream>
+#include <iostream>
 #include <iomanip>
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
 namespace fs = std::filesystem;
 
 #define NOMINMAX
@@ -48,13 +56,6 @@ namespace fs = std::filesystem;
 #include <xapofx.h>
 #endif
 
-
-#ifdef _WIN64
-constexpr auto X3D_HRTF_HOOK_DLL = L"hrtf/x64/x3daudio1_7.dll";
-#else
-constexpr auto X3D_HRTF_HOOK_DLL = L"hrtf/x86/x3daudio1_7.dll";
-#endif
-
 #include <wrl/client.h>
 using Microsoft::WRL::ComPtr;
 
@@ -63,7 +64,9 @@ using Microsoft::WRL::ComPtr;
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3d11.lib")
 #include <DirectXMath.h>
+#include <DirectXPackedVector.h>
 using namespace DirectX;
+using namespace DirectX::PackedVector;
 
 #include "SharedConstants.h"
 #include "Utils.h"
@@ -65,7 +65,11 @@ typedef zuint8 (* Instruction)(Z80 *object);
 
 /* MARK: - Macros & Functions: Callback */
 
-#define READ_8(address)		object->read	(object->context, (zuint16)(address))
+#if defined(Z80_DIRECT_MEMORY) /* SNO */
+#	define READ_8(address)	object->memory[(zuint16)(address)]
+#else
+#	define READ_8(address)	object->read	(object->context, (zuint16)(address))
+#endif
 #define WRITE_8(address, value) object->write	(object->context, (zuint16)(address), (zuint8)(value))
 #define IN(port)		object->in	(object->context, (zuint16)(port   ))
 #define OUT(port, value)	object->out	(object->context, (zuint16)(port   ), (zuint8)(value))
@@ -1588,7 +1592,16 @@ CPU_Z80_API zusize z80_run(Z80 *object, zusize cycles)
 		/*-----------------------------------------------.
 		| Execute instruction and update consumed cycles |
 		'-----------------------------------------------*/
-		CYCLES += instruction_table[BYTE0 = READ_8(PC)](object);
+		if (object->profile != NULL) /* SNO */
+			{
+			zuint16 pc = PC, sp = SP;
+			zuint8 instruction_cycles = instruction_table[BYTE0 = READ_8(PC)](object);
+
+			CYCLES += instruction_cycles;
+			object->profile(object->context, pc, sp, instruction_cycles);
+			}
+
+		else CYCLES += instruction_table[BYTE0 = READ_8(PC)](object);
 		}
 
 	/*---------------.
@@ -100,6 +100,23 @@ typedef struct {
 
 	void(* hook)(void *context, zuint16 address);
 
+	/** Callback: Called after each instruction is executed, for profiling.
+	  * @param context The value of the member @c context.
+	  * @param pc The address of the instruction executed.
+	  * @param sp The stack pointer before the instruction was executed.
+	  * @param cycles The number of cycles taken by the instruction.
+	  * @note This callback is optional and must be set to @c NULL if not
+	  * used. */
+
+	void(* profile)(void *context, zuint16 pc, zuint16 sp, zuint8 cycles);
+
+	/** 64K address space read directly, instead of calling @c read.
+	  * @details Only used when built with @c Z80_DIRECT_MEMORY defined, which
+	  * removes the callback from every opcode and operand fetch. Writes still
+	  * use @c write. */
+
+	zuint8 const *memory;
+
 	/** CPU registers and internal bits.
 	  * @details It contains the state of the registers, as well as the
 	  * interrupt flip-flops, variables related to interrupts and other